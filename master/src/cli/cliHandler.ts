@@ -81,6 +81,33 @@ export class CLIHandler {
       case "UPLOAD":
         this.handleUpload();
         break;
+      // Latency percentiles; RESET starts a new window after the export
+      case "HIST":
+      case "HIST RESET":
+        this.serial.sendCommand(command);
+        break;
+      // Per-scope CPU time; only a profiler build of the slave answers
+      case "PROFILE":
+      case "PROFILE RESET":
+        this.serial.sendCommand(command);
+        break;
+      // Longest control/comms passes and what they were doing
+      case "STALLS":
+      case "STALLS RESET":
+        this.serial.sendCommand(command);
+        break;
+      // Slave flight recorder: the run before the last reset, then this one
+      case "DUMP_TRACE":
+        this.serial.sendCommand(command);
+        break;
+      // Dry-cycle timing search on the slave; the line must be empty
+      case "CALIBRATE":
+      case "CALIBRATE ABORT":
+        this.serial.sendCommand(command);
+        break;
+      case "CALIBRATE SAVE":
+        this.serial.sendCommand('CALIBRATE {"persist":true}');
+        break;
       default:
         if (command.startsWith("SET ")) {
           this.handleSetCommand(command.slice(4));
@@ -174,6 +201,11 @@ Available Commands:
   ${chalk.yellow("SETTINGS")}    - Show current settings
   ${chalk.yellow("SET key=value")} - Update settings
   ${chalk.yellow("UPLOAD")}      - Upload code to slave
+  ${chalk.yellow("HIST [RESET]")} - Slave latency histograms
+  ${chalk.yellow("PROFILE [RESET]")} - Slave hot-path timings (profile build)
+  ${chalk.yellow("STALLS [RESET]")} - Longest slave loop stalls
+  ${chalk.yellow("DUMP_TRACE")} - Slave events leading up to the last reset
+  ${chalk.yellow("CALIBRATE [SAVE|ABORT]")} - Tune stroke timings (empty line)
   ${chalk.yellow("HELP")}        - Show this help message
   ${chalk.yellow("EXIT/QUIT")}   - Exit the program
     `)
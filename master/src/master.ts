@@ -11,6 +11,7 @@ import fs from "fs/promises";
 import chalk from "chalk";
 import { StatsManager } from "./stats/StatsManager.js";
 import { PlatformIOManager } from "./util/platformioManager.js";
+import { loadTraceDictionary } from "./util/frameProtocol.js";
 import { fileURLToPath } from "url";
 import { dirname } from "path";
 
@@ -38,6 +39,12 @@ export class Master {
   private cliHandler: CLIHandler;
   private statsManager: StatsManager;
   private options: MasterOptions;
+  private armedBoardId: number | null = null;
+  // Slave micros() of the camera strobe per board, to match frames to boards
+  private captureEdges = new Map<number, number>();
+  // Boards with a handler in flight; pipelined mode overlaps two of them,
+  // so isCapturing/isAnalyzing say whether any board is in that phase
+  private boardPhases = new Map<number, "CAPTURING" | "ANALYZING">();
 
   constructor(options: MasterOptions = {}) {
     this.serial = new SerialCommunication();
@@ -94,6 +101,18 @@ export class Master {
     await this.settingsManager.loadSettings();
     console.log(chalk.green("✓ Settings loaded successfully"));
 
+    // In binary mode DEBUG lines arrive as format IDs; the dictionary comes
+    // from "trace_tool dict src/*.cpp > trace.dict" in the slave directory
+    const dictionaryPath = path.join(__dirname, "../../slave/trace.dict");
+    try {
+      const count = loadTraceDictionary(
+        await fs.readFile(dictionaryPath, "utf8")
+      );
+      console.log(chalk.green(`✓ ${count} trace formats loaded`));
+    } catch {
+      console.log(chalk.yellow("Trace dictionary not found, IDs shown raw"));
+    }
+
     // Initialize WebSocket server with current settings
     const settings = this.settingsManager.getSettings();
     this.wss.broadcastSettings(settings);
@@ -178,8 +197,45 @@ export class Master {
 
     this.serial.onRawData((data: string) => {
       console.log(chalk.gray(`Raw data: ${data}`));
-      if (data.includes("SLAVE_REQUEST ANALYSIS_START")) {
-        this.handleAnalysisRequest();
+      const analysisArm = data.match(
+        /SLAVE_REQUEST ANALYSIS_ARM (\d+) (\d+)/
+      );
+      const analysisStart = data.match(
+        /SLAVE_REQUEST ANALYSIS_START (\d+)/
+      );
+      const captureEdge = data.match(/^CAPTURE_EDGE (\d+) (\d+)/);
+      if (data.startsWith("STALL ")) {
+        // A slave pass ran long; the line says which task and what it was
+        // doing, so surface it before it turns into a timeout
+        this.wss.broadcastWarning(data);
+        console.log(chalk.yellow(`Slave stall: ${data.slice(6)}`));
+      } else if (captureEdge) {
+        const boardId = Number(captureEdge[1]);
+        this.captureEdges.set(boardId, Number(captureEdge[2]));
+        // Only the last few boards can still be waiting for their frame
+        for (const id of this.captureEdges.keys()) {
+          if (id < boardId - 8) this.captureEdges.delete(id);
+        }
+      } else if (analysisArm) {
+        // Start the camera now so the capture overlaps the end of the
+        // riser stroke; ANALYSIS_START for this board is then only a marker
+        const boardId = Number(analysisArm[1]);
+        console.log(
+          chalk.cyan(
+            `📸 Capture armed for board ${boardId}, riser settles in ${analysisArm[2]} ms`
+          )
+        );
+        this.armedBoardId = boardId;
+        this.handleAnalysisRequest(boardId);
+      } else if (
+        analysisStart &&
+        Number(analysisStart[1]) === this.armedBoardId
+      ) {
+        console.log(chalk.gray(`Riser settled for board ${analysisStart[1]}`));
+      } else if (analysisStart) {
+        // The verdict must echo the board id: the slave drops one that
+        // names no board awaiting it, so a late answer cannot sort the next
+        this.handleAnalysisRequest(Number(analysisStart[1]));
       } else if (data.includes("SLAVE_REQUEST NON_ANALYSIS_CYCLE")) {
         this.handleNonAnalysisCycle();
       }
@@ -250,14 +306,34 @@ export class Master {
     throw new Error("Failed to reconnect to microcontroller");
   }
 
-  private async handleAnalysisRequest(): Promise<void> {
+  private sendAnalysisResult(eject: boolean, boardId: number): void {
+    const verdict = eject ? "TRUE" : "FALSE";
+    this.serial.sendCommand(`ANALYSIS_RESULT ${verdict} ${boardId}`);
+  }
+
+  private setBoardPhase(
+    boardId: number,
+    phase: "CAPTURING" | "ANALYZING" | null
+  ): void {
+    if (phase) {
+      this.boardPhases.set(boardId, phase);
+    } else {
+      this.boardPhases.delete(boardId);
+    }
+    const phases = [...this.boardPhases.values()];
+    this.currentState.isCapturing = phases.includes("CAPTURING");
+    this.currentState.isAnalyzing = phases.includes("ANALYZING");
+    this.wss.broadcastState(this.currentState);
+  }
+
+  private async handleAnalysisRequest(boardId: number): Promise<void> {
     console.log(chalk.cyan("📸 Analysis request received"));
     this.wss.broadcastLog("Starting image capture...", "info");
 
-    this.currentState.isCapturing = true;
-    this.currentState.isAnalyzing = false;
+    // Stats follow the board, not whichever cycle sensor 1 opened last
+    this.statsManager.claimCycle(boardId);
     this.currentState.status = "CAPTURING";
-    this.wss.broadcastState(this.currentState);
+    this.setBoardPhase(boardId, "CAPTURING");
 
     try {
       console.log(chalk.cyan("📁 Creating debug directory..."));
@@ -269,7 +345,7 @@ export class Master {
       if (!(await this.androidController.checkConnection())) {
         console.log(chalk.red("✗ Android device not connected"));
         this.wss.broadcastLog("Android device not connected", "error");
-        this.serial.sendCommand("ANALYSIS_RESULT FALSE");
+        this.sendAnalysisResult(false, boardId);
         return;
       }
 
@@ -277,21 +353,30 @@ export class Master {
       console.log(chalk.cyan("📸 Capturing photo..."));
       const captureStartTime = Date.now();
       const photoPath = await this.androidController.capturePhoto();
-      this.statsManager.recordCaptureTime(Date.now() - captureStartTime);
+      this.statsManager.recordCaptureTime(
+        Date.now() - captureStartTime,
+        boardId
+      );
 
-      this.currentState.isCapturing = false;
-      this.wss.broadcastState(this.currentState);
+      this.setBoardPhase(boardId, null);
 
       if (!photoPath) {
-        this.currentState.isAnalyzing = false; // Reset analyzing state on error
-        this.wss.broadcastState(this.currentState);
         console.log(chalk.red("✗ Failed to capture photo"));
         this.wss.broadcastLog("Failed to capture photo", "error");
-        this.serial.sendCommand("ANALYSIS_RESULT FALSE");
+        this.sendAnalysisResult(false, boardId);
         return;
       }
 
       console.log(chalk.green(`✓ Photo captured successfully: ${photoPath}`));
+      if (this.captureEdges.has(boardId)) {
+        console.log(
+          chalk.gray(
+            `Board ${boardId} strobed at slave t=${this.captureEdges.get(
+              boardId
+            )} us`
+          )
+        );
+      }
       this.wss.broadcastLog(`Photo captured at: ${photoPath}`, "info");
 
       // Convert and send image to frontend
@@ -316,10 +401,9 @@ export class Master {
       try {
         console.log(chalk.cyan("Starting analysis..."));
         this.wss.broadcastLog("Starting analysis...", "info");
-        this.currentState.isAnalyzing = true;
-        this.wss.broadcastState(this.currentState);
+        this.setBoardPhase(boardId, "ANALYZING");
 
-        this.statsManager.startAnalysis();
+        this.statsManager.startAnalysis(boardId);
         const analysisResult = await this.analysisService.analyzeImage(
           photoPath
         );
@@ -347,11 +431,13 @@ export class Master {
             (sum, pred) => sum + this.analysisService.calculateArea(pred.bbox),
             0
           ),
-          shouldEjectResult.reasons
+          shouldEjectResult.reasons,
+          boardId
         );
 
         // Broadcast current cycle stats immediately after recording results
-        const currentCycleStats = this.statsManager.getCurrentCycleStats();
+        const currentCycleStats =
+          this.statsManager.getCurrentCycleStats(boardId);
         if (currentCycleStats) {
           this.wss.broadcastCycleStats(currentCycleStats);
         }
@@ -370,9 +456,7 @@ export class Master {
           chalk.cyan("Sending analysis result to slave:"),
           shouldEjectResult.decision
         );
-        this.serial.sendCommand(
-          `ANALYSIS_RESULT ${shouldEjectResult.decision ? "TRUE" : "FALSE"}`
-        );
+        this.sendAnalysisResult(shouldEjectResult.decision, boardId);
         this.wss.broadcastLog(
           `Analysis complete. Ejection decision: ${
             shouldEjectResult.decision
@@ -395,16 +479,9 @@ export class Master {
           }`,
           "error"
         );
-        this.serial.sendCommand("ANALYSIS_RESULT FALSE");
-      } finally {
-        this.currentState.isAnalyzing = false; // Reset analyzing state after completion
-        this.wss.broadcastState(this.currentState);
+        this.sendAnalysisResult(false, boardId);
       }
     } catch (error) {
-      this.currentState.isCapturing = false;
-      this.currentState.isAnalyzing = false; // Reset analyzing state on error
-      this.wss.broadcastState(this.currentState);
-
       console.log(
         chalk.red(
           `✗ Analysis error: ${
@@ -418,10 +495,11 @@ export class Master {
         }`,
         "error"
       );
-      this.serial.sendCommand("ANALYSIS_RESULT FALSE");
+      this.sendAnalysisResult(false, boardId);
     } finally {
+      this.setBoardPhase(boardId, null);
       // End cycle and broadcast final stats
-      const stats = await this.statsManager.endCycle();
+      const stats = await this.statsManager.endCycle(boardId);
       if (stats) {
         this.wss.broadcastCycleStats(stats.cycleStats);
         this.wss.broadcastDailyStats(stats.dailyStats);
@@ -1,13 +1,18 @@
 import { SerialPort } from "serialport";
-import { ReadlineParser } from "@serialport/parser-readline";
 import { SlaveState, SlaveSettings, Command } from "./typings/types";
 import { detectMicrocontrollerPort } from "./util/portDetection.js";
+import {
+  FrameSplitter,
+  MessageType,
+  encodeFrame,
+  encodeSettings,
+} from "./util/frameProtocol.js";
 import chalk from "chalk";
 import { EventEmitter } from "events";
 
 export class SerialCommunication {
   private port: SerialPort | null;
-  private parser: ReadlineParser | null;
+  private parser: FrameSplitter | null;
   private lastHeartbeatTime: number;
   private bootCount: number;
   private debug: boolean;
@@ -19,6 +24,10 @@ export class SerialCommunication {
   private reconnectAttempt: number = 0;
   private baseReconnectDelay: number = 2000; // 2 seconds
   private lastKnownState: string = "";
+  // Ask the slave for COBS/CRC framing; it stays on text until it acks
+  private preferBinary: boolean = true;
+  private binaryMode: boolean = false;
+  private txSeq: number = 0;
 
   constructor() {
     this.port = null;
@@ -41,11 +50,12 @@ export class SerialCommunication {
 
     try {
       this.port = new SerialPort({ path: portPath, baudRate: 115200 });
-      this.parser = this.port.pipe(new ReadlineParser({ delimiter: "\r\n" }));
+      this.parser = this.port.pipe(new FrameSplitter());
       console.log(chalk.green(`✓ Connected to microcontroller on ${portPath}`));
 
       this.setupSerialListeners(); // Setup listeners before starting heartbeat monitoring
       this.startHeartbeatMonitoring();
+      this.negotiateProtocol();
       return true;
     } catch (error) {
       console.error(
@@ -110,6 +120,24 @@ export class SerialCommunication {
       console.log("Error occurred during state:", this.lastKnownState);
     });
 
+    // Keep asking until the slave acks; a text heartbeat after that means
+    // the slave rebooted and fell back to the text protocol
+    this.parser.on("textHeartbeat", () => {
+      if (this.preferBinary) {
+        this.negotiateProtocol();
+      }
+    });
+
+    // Track protocol negotiation acks
+    this.parser.on("data", (data: string) => {
+      if (data === "PROTOCOL BINARY") {
+        this.binaryMode = true;
+        console.log(chalk.green("✓ Binary protocol enabled"));
+      } else if (data === "PROTOCOL TEXT") {
+        this.binaryMode = false;
+      }
+    });
+
     // Track state changes
     this.parser.on("data", (data: string) => {
       if (data.includes("router_state")) {
@@ -147,6 +175,14 @@ export class SerialCommunication {
     this.parser = null;
     this.lastHeartbeatTime = 0;
     this.bootCount = 0;
+    this.binaryMode = false;
+  }
+
+  private negotiateProtocol(): void {
+    this.binaryMode = false;
+    if (this.preferBinary) {
+      this.sendCommand("PROTOCOL BINARY");
+    }
   }
 
   private checkConnection() {
@@ -157,6 +193,14 @@ export class SerialCommunication {
 
   sendCommand(command: Command): void {
     this.checkConnection();
+    if (this.binaryMode && command.startsWith("ANALYSIS_RESULT ")) {
+      const [, verdict, boardId] = command.split(" ");
+      const payload = Buffer.alloc(5);
+      payload[0] = verdict === "TRUE" ? 1 : 0;
+      payload.writeUInt32LE(Number(boardId) >>> 0, 1);
+      this.writeFrame(MessageType.ANALYSIS_RESULT, payload);
+      return;
+    }
     try {
       console.log(chalk.cyan(`📤 Sending command: ${command}`));
       this.port!.write(`${command}\n`, (err) => {
@@ -171,9 +215,21 @@ export class SerialCommunication {
 
   sendSettings(settings: SlaveSettings): void {
     this.checkConnection();
+    if (this.binaryMode) {
+      this.writeFrame(MessageType.SETTINGS, encodeSettings(settings));
+      return;
+    }
     this.port!.write(`SETTINGS ${JSON.stringify(settings)}\n`);
   }
 
+  private writeFrame(type: MessageType, payload: Buffer): void {
+    this.port!.write(encodeFrame(type, this.txSeq++, payload), (err) => {
+      if (err) {
+        console.error(chalk.red(`✗ Error sending frame: ${err.message}`));
+      }
+    });
+  }
+
   onStateUpdate(callback: (state: SlaveState) => void): void {
     this.checkConnection();
     this.parser!.on("data", (data: string) => {
@@ -323,8 +379,9 @@ export class SerialCommunication {
   }
 
   private setupParser(): void {
-    this.parser = this.port!.pipe(new ReadlineParser({ delimiter: "\n" }));
+    this.parser = this.port!.pipe(new FrameSplitter());
     this.setupSerialListeners();
+    this.negotiateProtocol();
   }
 
   private async detectPort(): Promise<string | null> {
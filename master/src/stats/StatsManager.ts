@@ -74,8 +74,16 @@ export interface DailyStats {
   cyclesByHour: number[];
 }
 
+interface BoardCycle {
+  cycle: Partial<CycleStats>;
+  sensor1TriggerTime: number;
+}
+
 export class StatsManager {
+  // The cycle started by sensor 1, until an analysis request claims it
   private currentCycle: Partial<CycleStats> | null = null;
+  // Claimed cycles by board id; in pipelined mode several are in flight
+  private boardCycles = new Map<number, BoardCycle>();
   private statsDir: string;
   private cycleStartTime: number = 0;
   private dailyStats: DailyStats | null = null;
@@ -146,15 +154,35 @@ export class StatsManager {
     };
   }
 
-  startAnalysis(): void {
-    if (this.currentCycle) {
-      this.currentCycle.analysisTime = Date.now();
+  // Ties the open cycle to the board the slave is asking about, so the
+  // next board's sensor 1 can start a cycle of its own
+  claimCycle(boardId: number): void {
+    if (!this.currentCycle) return;
+    this.boardCycles.set(boardId, {
+      cycle: this.currentCycle,
+      sensor1TriggerTime: this.sensor1TriggerTime,
+    });
+    this.currentCycle = null;
+    this.sensor1TriggerTime = 0;
+  }
+
+  // A board id picks a claimed cycle; without one, the open cycle
+  private cycleFor(boardId?: number): Partial<CycleStats> | null {
+    if (boardId === undefined) return this.currentCycle;
+    return this.boardCycles.get(boardId)?.cycle ?? null;
+  }
+
+  startAnalysis(boardId?: number): void {
+    const cycle = this.cycleFor(boardId);
+    if (cycle) {
+      cycle.analysisTime = Date.now();
     }
   }
 
-  recordCaptureTime(duration: number): void {
-    if (this.currentCycle) {
-      this.currentCycle.captureTime = duration;
+  recordCaptureTime(duration: number, boardId?: number): void {
+    const cycle = this.cycleFor(boardId);
+    if (cycle) {
+      cycle.captureTime = duration;
     }
   }
 
@@ -162,22 +190,24 @@ export class StatsManager {
     decision: boolean,
     predictions: Prediction[],
     totalArea: number,
-    ejectionReasons?: string[]
+    ejectionReasons?: string[],
+    boardId?: number
   ): void {
-    if (!this.currentCycle) return;
+    const cycle = this.cycleFor(boardId);
+    if (!cycle) return;
 
-    if (this.currentCycle.analysisTime) {
-      const analysisDuration = Date.now() - this.currentCycle.analysisTime;
-      this.currentCycle.analysisTime = analysisDuration;
+    if (cycle.analysisTime) {
+      const analysisDuration = Date.now() - cycle.analysisTime;
+      cycle.analysisTime = analysisDuration;
     }
 
-    this.currentCycle.ejectionDecision = decision;
-    this.currentCycle.ejectionReasons = ejectionReasons;
-    this.currentCycle.defectsFound = predictions.length;
-    this.currentCycle.totalDefectArea = totalArea;
-    this.currentCycle.defectStats = this.calculateDefectStats(predictions);
+    cycle.ejectionDecision = decision;
+    cycle.ejectionReasons = ejectionReasons;
+    cycle.defectsFound = predictions.length;
+    cycle.totalDefectArea = totalArea;
+    cycle.defectStats = this.calculateDefectStats(predictions);
 
-    this.currentCycle.predictions = predictions.map((pred) => ({
+    cycle.predictions = predictions.map((pred) => ({
       class_name: pred.class_name,
       confidence: pred.confidence,
       bbox: pred.bbox,
@@ -236,68 +266,80 @@ export class StatsManager {
     }
   }
 
-  getCurrentCycleStats(): Partial<CycleStats> | null {
-    return this.currentCycle;
+  getCurrentCycleStats(boardId?: number): Partial<CycleStats> | null {
+    return this.cycleFor(boardId);
   }
 
   getDailyStats(): DailyStats | null {
     return this.dailyStats;
   }
 
-  async endCycle(): Promise<{
+  async endCycle(boardId?: number): Promise<{
     cycleStats: CycleStats;
     dailyStats: DailyStats;
   } | null> {
-    if (!this.currentCycle || !this.dailyStats) return null;
+    if (!this.dailyStats) return null;
+    let cycle: Partial<CycleStats> | null;
+    let sensor1TriggerTime: number;
+    // Detached before the writes below, so a cycle started meanwhile is
+    // left alone
+    if (boardId === undefined) {
+      cycle = this.currentCycle;
+      sensor1TriggerTime = this.sensor1TriggerTime;
+      this.currentCycle = null;
+      this.sensor1TriggerTime = 0;
+    } else {
+      const claimed = this.boardCycles.get(boardId);
+      cycle = claimed ? claimed.cycle : null;
+      sensor1TriggerTime = claimed ? claimed.sensor1TriggerTime : 0;
+      this.boardCycles.delete(boardId);
+    }
+    if (!cycle) return null;
 
     const currentTime = Date.now();
     console.log(`[Stats] Ending cycle...
-      Sensor1 trigger time: ${this.sensor1TriggerTime}
+      Sensor1 trigger time: ${sensor1TriggerTime}
       Current time: ${currentTime}
-      Difference: ${currentTime - this.sensor1TriggerTime}ms
+      Difference: ${currentTime - sensor1TriggerTime}ms
     `);
 
-    if (this.sensor1TriggerTime > 0) {
-      this.currentCycle.duration = currentTime - this.sensor1TriggerTime;
+    if (sensor1TriggerTime > 0) {
+      cycle.duration = currentTime - sensor1TriggerTime;
       console.log(
-        `[Stats] Cycle duration calculated: ${this.currentCycle.duration}ms`
+        `[Stats] Cycle duration calculated: ${cycle.duration}ms`
       );
     } else {
       console.warn(
         "[Stats] Warning: Cycle ended without sensor1 trigger timestamp"
       );
-      this.currentCycle.duration = 0;
+      cycle.duration = 0;
     }
 
-    if (!this.currentCycle.defectsFound) {
-      this.currentCycle.defectsFound = 0;
+    if (!cycle.defectsFound) {
+      cycle.defectsFound = 0;
     }
-    if (!this.currentCycle.totalDefectArea) {
-      this.currentCycle.totalDefectArea = 0;
+    if (!cycle.totalDefectArea) {
+      cycle.totalDefectArea = 0;
     }
-    if (!this.currentCycle.defectStats) {
-      this.currentCycle.defectStats = {};
+    if (!cycle.defectStats) {
+      cycle.defectStats = {};
     }
-    if (!this.currentCycle.predictions) {
-      this.currentCycle.predictions = [];
+    if (!cycle.predictions) {
+      cycle.predictions = [];
     }
-    if (!this.currentCycle.ejectionDecision) {
-      this.currentCycle.ejectionDecision = false;
+    if (!cycle.ejectionDecision) {
+      cycle.ejectionDecision = false;
     }
-    if (!this.currentCycle.ejectionReasons) {
-      this.currentCycle.ejectionReasons = ["Non-analysis cycle"];
+    if (!cycle.ejectionReasons) {
+      cycle.ejectionReasons = ["Non-analysis cycle"];
     }
 
-    await this.saveCycleStats(this.currentCycle as CycleStats);
-    await this.updateDailyStats(this.currentCycle as CycleStats);
+    await this.saveCycleStats(cycle as CycleStats);
+    await this.updateDailyStats(cycle as CycleStats);
 
-    const completedCycle = this.currentCycle;
+    const completedCycle = cycle;
     const currentDailyStats = this.dailyStats;
 
-    console.log(`[Stats] Resetting cycle state`);
-    this.currentCycle = null;
-    this.sensor1TriggerTime = 0;
-
     return {
       cycleStats: completedCycle as CycleStats,
       dailyStats: currentDailyStats,
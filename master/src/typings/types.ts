@@ -20,6 +20,7 @@ export enum RouterState {
   WAITING_FOR_ANALYSIS,
   EJECTING,
   LOWERING,
+  CAPTURING,
   ERROR,
 }
 
@@ -29,9 +30,20 @@ export type SettingsKeys = "sensorThreshold";
 
 export type Command =
   | "STATUS"
-  | "ANALYSIS_RESULT TRUE"
-  | "ANALYSIS_RESULT FALSE"
-  | "ABORT_ANALYSIS";
+  | `ANALYSIS_RESULT ${"TRUE" | "FALSE"} ${number}`
+  | "ABORT_ANALYSIS"
+  | "PROTOCOL BINARY"
+  | "PROTOCOL TEXT"
+  | "HIST"
+  | "HIST RESET"
+  | "PROFILE"
+  | "PROFILE RESET"
+  | "STALLS"
+  | "STALLS RESET"
+  | "DUMP_TRACE"
+  | "CALIBRATE"
+  | "CALIBRATE ABORT"
+  | `CALIBRATE {${string}}`;
 
 export interface AnalysisImage {
   timestamp: string;
@@ -125,6 +137,28 @@ export type SlaveSettings = {
   riserTime: number;
   ejectionTime: number;
   analysisMode: boolean;
+  // Overlap the next push with analysis; needs the downstream ejector
+  pipelined?: boolean;
+  captureTime?: number;
+  // Lead of the ANALYSIS_ARM pre-trigger ahead of the riser settling
+  triggerLead?: number;
+  // Never switch two valves inside one EMI quiet window
+  staggerSolenoids?: boolean;
+  // Time a sensor level must hold before the router acts on it (us)
+  sensorConfirmUs?: number;
+  // Start the riser this long before the push retracts (ms)
+  riserOverlap?: number;
+  // Pipelined: fire the ejector this long before the riser settles (ms)
+  ejectOverlap?: number;
+  // Push a board already waiting as soon as the riser is down
+  continuousFeed?: boolean;
+  // End-of-stroke reed switches fitted: 1 push, 2 riser, 4 ejection
+  strokeSensors?: number;
+  // Highest slave log priority sent: 0 critical, 1 normal, 2 debug
+  logLevel?: number;
+  // A board with no verdict this long after ANALYSIS_START passes unsorted
+  // and its verdict is dropped if it still comes (ms)
+  analysisTimeout?: number;
 };
 
 export type Settings = {
@@ -0,0 +1,488 @@
+import { Transform, TransformCallback } from "stream";
+
+// Mirrors slave/src/Protocol.h. Frames are COBS encoded and wrapped in 0x00
+// delimiters: [type][seq][payload...][crc16 lo][crc16 hi]
+
+export enum MessageType {
+  STATE = 0x01,
+  HEARTBEAT = 0x02,
+  SETTINGS = 0x03,
+  ANALYSIS_START = 0x04,
+  ANALYSIS_RESULT = 0x05,
+  NON_ANALYSIS_CYCLE = 0x06,
+  ANALYSIS_ARM = 0x07,
+  CAPTURE_EDGE = 0x08,
+  CALIBRATE = 0x09,
+  CALIBRATION = 0x0a,
+  HIST = 0x0b,
+  HISTOGRAM = 0x0c,
+  STALL = 0x0d,
+  TRACE = 0x0e,
+  FLIGHT = 0x0f,
+}
+
+export enum SettingKey {
+  PUSH_TIME = 0x01,
+  RISER_TIME = 0x02,
+  EJECTION_TIME = 0x03,
+  ANALYSIS_MODE = 0x04,
+  PIPELINED = 0x05,
+  CAPTURE_TIME = 0x06,
+  TRIGGER_LEAD = 0x07,
+  STAGGER_SOLENOIDS = 0x08,
+  SENSOR_CONFIRM_US = 0x09,
+  RISER_OVERLAP = 0x0A,
+  EJECT_OVERLAP = 0x0B,
+  CONTINUOUS_FEED = 0x0C,
+  STROKE_SENSORS = 0x0D,
+  LOG_LEVEL = 0x0E,
+  ANALYSIS_TIMEOUT = 0x0F,
+}
+
+const STATE_FLAG_PUSH = 0x01;
+const STATE_FLAG_RISER = 0x02;
+const STATE_FLAG_EJECTION = 0x04;
+const STATE_FLAG_SENSOR1 = 0x08;
+
+const STATUS_NAMES = ["IDLE", "BUSY", "ERROR"];
+const CALIBRATION_STATUS_NAMES = ["TUNED", "NO_FEEDBACK", "FAILED", "ABORTED"];
+const STROKE_NAMES = ["push", "riser", "ejection"];
+const ROUTER_STATE_NAMES = [
+  "IDLE",
+  "WAITING_FOR_PUSH",
+  "PUSHING",
+  "RAISING",
+  "WAITING_FOR_ANALYSIS",
+  "EJECTING",
+  "LOWERING",
+  "CAPTURING",
+  "ERROR",
+];
+// HISTOGRAM ids: one per router state, then these
+const HISTOGRAM_NAMES = [
+  ...ROUTER_STATE_NAMES,
+  "ANALYSIS_ROUND_TRIP",
+  "SENSOR_TO_PUSH",
+  "WAKE_LATENCY",
+  "CONTROL_PASS",
+  "COMMS_PASS",
+  "LATE_VERDICT",
+];
+const STALL_TASK_NAMES = ["control", "comms"];
+const STALL_ACTIVITY_NAMES = [
+  "ROUTER",
+  "COMMAND",
+  "UART_READ",
+  "SERIALIZE",
+  "UART_WRITE",
+  "EVENTS",
+  "HEARTBEAT",
+  "HEAP_REPORT",
+  "SERIAL_LINK",
+];
+const FLIGHT_KIND_NAMES = ["BOOT", "STATE", "VALVE", "COMMAND", "STALL"];
+const COMMAND_NAMES = [
+  "ANALYSIS_RESULT",
+  "ABORT_ANALYSIS",
+  "SETTING",
+  "CALIBRATE",
+  "ABORT_CALIBRATION",
+  "RESET_HISTOGRAMS",
+  "RESET_PROFILE",
+];
+
+// The fields the slave's FLIGHT line has for each event kind
+function flightFields(
+  kind: number,
+  a: number,
+  b: number,
+  value: number
+): Record<string, string | number> {
+  switch (FLIGHT_KIND_NAMES[kind]) {
+    case "BOOT":
+      return { reset_reason: a, boot: value };
+    case "STATE":
+      return {
+        to: ROUTER_STATE_NAMES[a] ?? "UNKNOWN",
+        from: ROUTER_STATE_NAMES[b] ?? "UNKNOWN",
+      };
+    case "VALVE":
+      return { pin: a, level: b };
+    case "COMMAND":
+      return { command: COMMAND_NAMES[a] ?? "UNKNOWN", arg: b, value };
+    case "STALL":
+      return {
+        task: STALL_TASK_NAMES[a] ?? "UNKNOWN",
+        activity: STALL_ACTIVITY_NAMES[b] ?? "UNKNOWN",
+        pass_us: value,
+      };
+    default:
+      return {};
+  }
+}
+
+// TRACE format strings by ID, from the slave's trace.dict: one
+// `<hex id> "<C string>"` per line. C escapes are valid JSON.
+const traceFormats = new Map<number, string>();
+
+export function loadTraceDictionary(text: string): number {
+  traceFormats.clear();
+  for (const line of text.split("\n")) {
+    const match = line.match(/^([0-9a-f]{8}) (".*")$/);
+    if (match) traceFormats.set(parseInt(match[1], 16), JSON.parse(match[2]));
+  }
+  return traceFormats.size;
+}
+
+// Mirrors trace::format in slave/src/Trace.cpp: integers are u32, strings
+// [length u8][bytes]
+export function formatTrace(format: string, args: Buffer): string {
+  let offset = 0;
+  return format.replace(
+    /%([-+ #0]*)(\d*)(?:\.\d+)?(?:hh?|ll?)?([diuxXcs%])/g,
+    (_, flags: string, width: string, type: string) => {
+      let text: string;
+      if (type === "%") return "%";
+      if (type === "s") {
+        const length = offset < args.length ? args[offset] : 0;
+        text = args.toString("latin1", offset + 1, offset + 1 + length);
+        offset += 1 + length;
+      } else {
+        const value = offset + 4 <= args.length ? args.readUInt32LE(offset) : 0;
+        offset += 4;
+        if (type === "d" || type === "i") text = String(value | 0);
+        else if (type === "x") text = value.toString(16);
+        else if (type === "X") text = value.toString(16).toUpperCase();
+        else if (type === "c") text = String.fromCharCode(value & 0xff);
+        else text = String(value);
+      }
+      const size = Number(width || 0);
+      if (flags.includes("-")) return text.padEnd(size);
+      const pad = flags.includes("0") && type !== "s" ? "0" : " ";
+      return text.padStart(size, pad);
+    }
+  );
+}
+
+export interface Frame {
+  type: MessageType;
+  seq: number;
+  payload: Buffer;
+}
+
+export function crc16(data: Buffer): number {
+  let crc = 0xffff;
+  for (const byte of data) {
+    crc ^= byte << 8;
+    for (let bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? ((crc << 1) ^ 0x1021) & 0xffff : (crc << 1) & 0xffff;
+    }
+  }
+  return crc;
+}
+
+export function cobsEncode(input: Buffer): Buffer {
+  const out: number[] = [0];
+  let codeIndex = 0;
+  let code = 1;
+  for (const byte of input) {
+    if (byte === 0) {
+      out[codeIndex] = code;
+      codeIndex = out.length;
+      out.push(0);
+      code = 1;
+      continue;
+    }
+    out.push(byte);
+    if (++code === 0xff) {
+      out[codeIndex] = code;
+      codeIndex = out.length;
+      out.push(0);
+      code = 1;
+    }
+  }
+  out[codeIndex] = code;
+  return Buffer.from(out);
+}
+
+export function cobsDecode(input: Buffer): Buffer | null {
+  const out: number[] = [];
+  let index = 0;
+  while (index < input.length) {
+    const code = input[index++];
+    if (code === 0 || index + code - 1 > input.length) {
+      return null;
+    }
+    for (let i = 1; i < code; i++) {
+      out.push(input[index++]);
+    }
+    if (code !== 0xff && index < input.length) {
+      out.push(0);
+    }
+  }
+  return Buffer.from(out);
+}
+
+export function encodeFrame(
+  type: MessageType,
+  seq: number,
+  payload: Buffer = Buffer.alloc(0)
+): Buffer {
+  const raw = Buffer.alloc(payload.length + 4);
+  raw[0] = type;
+  raw[1] = seq & 0xff;
+  payload.copy(raw, 2);
+  raw.writeUInt16LE(crc16(raw.subarray(0, payload.length + 2)), payload.length + 2);
+  return Buffer.concat([Buffer.from([0]), cobsEncode(raw), Buffer.from([0])]);
+}
+
+export function decodeFrame(block: Buffer): Frame | null {
+  const raw = cobsDecode(block);
+  if (!raw || raw.length < 4) {
+    return null;
+  }
+  const expected = raw.readUInt16LE(raw.length - 2);
+  if (crc16(raw.subarray(0, raw.length - 2)) !== expected) {
+    return null;
+  }
+  return {
+    type: raw[0],
+    seq: raw[1],
+    payload: raw.subarray(2, raw.length - 2),
+  };
+}
+
+export function encodeSettings(settings: Record<string, number | boolean>): Buffer {
+  const keys: Record<string, SettingKey> = {
+    pushTime: SettingKey.PUSH_TIME,
+    riserTime: SettingKey.RISER_TIME,
+    ejectionTime: SettingKey.EJECTION_TIME,
+    analysisMode: SettingKey.ANALYSIS_MODE,
+    pipelined: SettingKey.PIPELINED,
+    captureTime: SettingKey.CAPTURE_TIME,
+    triggerLead: SettingKey.TRIGGER_LEAD,
+    staggerSolenoids: SettingKey.STAGGER_SOLENOIDS,
+    sensorConfirmUs: SettingKey.SENSOR_CONFIRM_US,
+    riserOverlap: SettingKey.RISER_OVERLAP,
+    ejectOverlap: SettingKey.EJECT_OVERLAP,
+    continuousFeed: SettingKey.CONTINUOUS_FEED,
+    strokeSensors: SettingKey.STROKE_SENSORS,
+    logLevel: SettingKey.LOG_LEVEL,
+    analysisTimeout: SettingKey.ANALYSIS_TIMEOUT,
+  };
+  const parts: Buffer[] = [];
+  for (const [name, value] of Object.entries(settings)) {
+    if (!(name in keys)) continue;
+    const entry = Buffer.alloc(5);
+    entry[0] = keys[name];
+    entry.writeUInt32LE(Number(value) >>> 0, 1);
+    parts.push(entry);
+  }
+  return Buffer.concat(parts);
+}
+
+const onOff = (flags: number, bit: number) => (flags & bit ? "ON" : "OFF");
+
+// Translates a slave frame into the equivalent text-protocol line so the rest
+// of the master can stay protocol agnostic.
+export function frameToLine(frame: Frame): string | null {
+  const p = frame.payload;
+  switch (frame.type) {
+    case MessageType.STATE:
+      if (p.length < 3) return null;
+      return `STATE ${JSON.stringify({
+        status: STATUS_NAMES[p[0]] ?? "UNKNOWN",
+        router_state: ROUTER_STATE_NAMES[p[1]] ?? "UNKNOWN",
+        push_cylinder: onOff(p[2], STATE_FLAG_PUSH),
+        riser_cylinder: onOff(p[2], STATE_FLAG_RISER),
+        ejection_cylinder: onOff(p[2], STATE_FLAG_EJECTION),
+        sensor1: onOff(p[2], STATE_FLAG_SENSOR1),
+      })}`;
+    case MessageType.HEARTBEAT:
+      if (p.length < 42) return null;
+      return `HEARTBEAT ${JSON.stringify({
+        type: "heartbeat",
+        uptime: p.readUInt32LE(0),
+        boot_count: p.readUInt32LE(4),
+        free_heap: p.readUInt32LE(8),
+        router_state: ROUTER_STATE_NAMES[p[12]] ?? "UNKNOWN",
+        last_error: p[13],
+        cycle_count: p.readUInt32LE(14),
+        last_cycle_time: p.readUInt32LE(18),
+        rx_overruns: p.readUInt32LE(22),
+        rx_overlong: p.readUInt32LE(26),
+        tx_drops_normal: p.readUInt32LE(30),
+        tx_drops_debug: p.readUInt32LE(34),
+        tx_critical_stalls: p.readUInt32LE(38),
+        ...(p.length >= 46 && { link_drops: p.readUInt32LE(42) }),
+        ...(p.length >= 54 && {
+          sensor_latency_us: p.readUInt32LE(46),
+          sensor_latency_max_us: p.readUInt32LE(50),
+        }),
+        ...(p.length >= 66 && {
+          wake_p50_us: p.readUInt32LE(54),
+          wake_p99_us: p.readUInt32LE(58),
+          wake_max_us: p.readUInt32LE(62),
+        }),
+        ...(p.length >= 70 && { idle_skipped_ms: p.readUInt32LE(66) }),
+        // Push, riser, ejection
+        ...(p.length >= 94 && {
+          stroke_ms: [70, 74, 78].map((o) => p.readUInt32LE(o)),
+          stroke_max_ms: [82, 86, 90].map((o) => p.readUInt32LE(o)),
+        }),
+        ...(p.length >= 98 && { stalls: p.readUInt32LE(94) }),
+        ...(p.length >= 110 && {
+          late_verdicts: p.readUInt32LE(98),
+          duplicate_verdicts: p.readUInt32LE(102),
+          unmatched_verdicts: p.readUInt32LE(106),
+        }),
+        ...(p.length >= 114 && { oversized_frames: p.readUInt32LE(110) }),
+        ...(p.length >= 118 && { tx_oversized: p.readUInt32LE(114) }),
+      })}`;
+    case MessageType.ANALYSIS_ARM: {
+      if (p.length < 12) return null;
+      const [boardId, etaMs, uptime] = [0, 4, 8].map((o) => p.readUInt32LE(o));
+      return `SLAVE_REQUEST ANALYSIS_ARM ${boardId} ${etaMs} ${uptime}`;
+    }
+    case MessageType.ANALYSIS_START: {
+      const fields = [0, 4]
+        .filter((o) => p.length >= o + 4)
+        .map((o) => p.readUInt32LE(o));
+      return ["SLAVE_REQUEST ANALYSIS_START", ...fields].join(" ");
+    }
+    case MessageType.CAPTURE_EDGE:
+      if (p.length < 8) return null;
+      return `CAPTURE_EDGE ${p.readUInt32LE(0)} ${p.readUInt32LE(4)}`;
+    case MessageType.NON_ANALYSIS_CYCLE:
+      return "SLAVE_REQUEST NON_ANALYSIS_CYCLE";
+    case MessageType.HISTOGRAM: {
+      if (p.length < 25) return null;
+      const [samples, p50, p90, p99, p999, max] = [1, 5, 9, 13, 17, 21].map(
+        (o) => p.readUInt32LE(o)
+      );
+      return `HIST ${JSON.stringify({
+        name: HISTOGRAM_NAMES[p[0]] ?? "UNKNOWN",
+        samples,
+        p50_us: p50,
+        p90_us: p90,
+        p99_us: p99,
+        p999_us: p999,
+        max_us: max,
+      })}`;
+    }
+    case MessageType.STALL:
+      // [task u8][activity u8][us u32][activity us u32][at ms u32]
+      if (p.length < 14) return null;
+      return `STALL ${JSON.stringify({
+        task: STALL_TASK_NAMES[p[0]] ?? "UNKNOWN",
+        activity: STALL_ACTIVITY_NAMES[p[1]] ?? "UNKNOWN",
+        us: p.readUInt32LE(2),
+        activity_us: p.readUInt32LE(6),
+        at_ms: p.readUInt32LE(10),
+      })}`;
+    case MessageType.FLIGHT:
+      // [previous u16][current u16] ends a DUMP_TRACE
+      if (p.length === 4) {
+        return `FLIGHT_END ${JSON.stringify({
+          previous: p.readUInt16LE(0),
+          current: p.readUInt16LE(2),
+        })}`;
+      }
+      // [run u8][us u32][kind u8][a u8][b u16][value u32]
+      if (p.length < 13) return null;
+      return `FLIGHT ${JSON.stringify({
+        run: p[0] === 0 ? "previous" : "current",
+        us: p.readUInt32LE(1),
+        event: FLIGHT_KIND_NAMES[p[5]] ?? "UNKNOWN",
+        ...flightFields(p[5], p[6], p.readUInt16LE(7), p.readUInt32LE(9)),
+      })}`;
+    case MessageType.TRACE: {
+      // [format id u32][micros u32][packed arguments]
+      if (p.length < 8) return null;
+      const id = p.readUInt32LE(0);
+      const format = traceFormats.get(id);
+      if (format === undefined) {
+        return `DEBUG: trace ${id.toString(16).padStart(8, "0")} ${p
+          .subarray(8)
+          .toString("hex")}`;
+      }
+      return formatTrace(format, p.subarray(8)).replace(/\r?\n$/, "");
+    }
+    case MessageType.CALIBRATION: {
+      // [persisted u8] then per stroke [status u8][min u32][recommended u32]
+      if (p.length < 1 + 9 * STROKE_NAMES.length) return null;
+      const report: Record<string, string | number | boolean> = {
+        persisted: p[0] !== 0,
+      };
+      STROKE_NAMES.forEach((name, i) => {
+        const o = 1 + 9 * i;
+        report[`${name}_status`] = CALIBRATION_STATUS_NAMES[p[o]] ?? "UNKNOWN";
+        report[`${name}_min_ms`] = p.readUInt32LE(o + 1);
+        report[`${name}_ms`] = p.readUInt32LE(o + 5);
+      });
+      return `CALIBRATION ${JSON.stringify(report)}`;
+    }
+    default:
+      return null;
+  }
+}
+
+// Splits the slave byte stream into text lines and 0x00-delimited frames.
+// Frames are decoded and pushed downstream as text lines; frames that fail
+// their CRC are counted and dropped.
+export class FrameSplitter extends Transform {
+  private text: number[] = [];
+  private block: number[] = [];
+  private inFrame = false;
+  private lastSeq = -1;
+  corruptFrames = 0;
+  missedFrames = 0;
+
+  constructor() {
+    super({ readableObjectMode: true });
+  }
+
+  _transform(chunk: Buffer, _encoding: string, callback: TransformCallback) {
+    for (const byte of chunk) {
+      if (byte === 0) {
+        if (this.inFrame && this.block.length > 0) {
+          this.handleBlock(Buffer.from(this.block));
+          this.block = [];
+          this.inFrame = false;
+        } else {
+          this.inFrame = true;
+        }
+      } else if (this.inFrame) {
+        this.block.push(byte);
+      } else if (byte === 0x0a) {
+        const line = Buffer.from(this.text).toString("utf8").replace(/\r$/, "");
+        this.text = [];
+        if (line.startsWith("HEARTBEAT ")) {
+          // Lets the link notice a slave that rebooted back into text mode
+          this.emit("textHeartbeat");
+        }
+        this.push(line);
+      } else {
+        this.text.push(byte);
+      }
+    }
+    callback();
+  }
+
+  private handleBlock(block: Buffer): void {
+    const frame = decodeFrame(block);
+    if (!frame) {
+      this.corruptFrames++;
+      return;
+    }
+    if (this.lastSeq >= 0 && frame.seq !== ((this.lastSeq + 1) & 0xff)) {
+      this.missedFrames += (frame.seq - this.lastSeq - 1 + 256) & 0xff;
+    }
+    this.lastSeq = frame.seq;
+
+    const line = frameToLine(frame);
+    if (line) {
+      this.push(line);
+    }
+  }
+}
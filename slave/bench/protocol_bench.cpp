@@ -0,0 +1,163 @@
+// Host benchmark comparing the text and binary serial protocols.
+//
+//   pio run -e bench_protocol && .pio/build/bench_protocol/program
+//
+// Bytes per cycle are counted for a typical analysis cycle; encode/decode
+// times are averaged over many iterations of the same messages.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../src/Protocol.h"
+
+namespace {
+
+// Message mix of one analysis cycle as seen on the wire: every
+// broadcastState() produces a STATE message, one heartbeat per second of
+// cycle time, one ANALYSIS_START out and one ANALYSIS_RESULT in.
+constexpr int STATES_PER_CYCLE = 14;
+constexpr int HEARTBEATS_PER_CYCLE = 8;
+constexpr int ITERATIONS = 1000000;
+
+const char* const ROUTER_STATES[] = {
+    "IDLE",
+    "WAITING_FOR_PUSH",
+    "PUSHING",
+    "RAISING",
+    "WAITING_FOR_ANALYSIS",
+    "EJECTING",
+    "LOWERING",
+    "ERROR",
+};
+
+volatile size_t sink;
+
+// Produces the same bytes ArduinoJson emits for SlaveController::sendState
+size_t textState(char* out, size_t size, int state, uint8_t flags) {
+  return snprintf(
+      out, size,
+      "STATE {\"status\":\"IDLE\",\"router_state\":\"%s\","
+      "\"push_cylinder\":\"%s\",\"riser_cylinder\":\"%s\","
+      "\"ejection_cylinder\":\"%s\",\"sensor1\":\"%s\"}\r\n",
+      ROUTER_STATES[state], flags & 1 ? "ON" : "OFF",
+      flags & 2 ? "ON" : "OFF", flags & 4 ? "ON" : "OFF",
+      flags & 8 ? "ON" : "OFF");
+}
+
+size_t textHeartbeat(char* out, size_t size, uint32_t uptime) {
+  return snprintf(out, size,
+                  "HEARTBEAT {\"type\":\"heartbeat\",\"uptime\":%lu,"
+                  "\"boot_count\":42,\"free_heap\":%lu,"
+                  "\"router_state\":\"WAITING_FOR_ANALYSIS\","
+                  "\"last_error\":1,\"cycle_count\":%lu,"
+                  "\"last_cycle_time\":%lu}\r\n",
+                  (unsigned long)uptime, 281344UL, 1234UL, 6843UL);
+}
+
+// Equivalent of what the master has to do with a text state line: find the
+// router_state value and the four ON/OFF fields.
+int textParseState(const char* line) {
+  static const char* const keys[] = {
+      "\"router_state\":\"",      "\"push_cylinder\":\"",
+      "\"riser_cylinder\":\"",    "\"ejection_cylinder\":\"",
+      "\"sensor1\":\""};
+  int result = 0;
+  for (const char* key : keys) {
+    const char* found = strstr(line, key);
+    if (!found) return -1;
+    result += found[strlen(key)];
+  }
+  return result;
+}
+
+size_t binaryState(uint8_t* out, uint8_t seq, int state, uint8_t flags) {
+  protocol::PayloadWriter payload;
+  payload.u8(0);
+  payload.u8(uint8_t(state));
+  payload.u8(flags);
+  return protocol::encodeFrame(protocol::MessageType::STATE, seq,
+                               payload.data(), payload.size(), out);
+}
+
+size_t binaryHeartbeat(uint8_t* out, uint8_t seq, uint32_t uptime) {
+  protocol::PayloadWriter payload;
+  payload.u32(uptime);
+  payload.u32(42);
+  payload.u32(281344);
+  payload.u8(4);
+  payload.u8(1);
+  payload.u32(1234);
+  payload.u32(6843);
+  return protocol::encodeFrame(protocol::MessageType::HEARTBEAT, seq,
+                               payload.data(), payload.size(), out);
+}
+
+int binaryParse(const uint8_t* wire, size_t length) {
+  uint8_t block[protocol::MAX_ENCODED];
+  // Strip the two delimiters like the receiving splitter does
+  memcpy(block, wire + 1, length - 2);
+  protocol::Frame frame;
+  if (!protocol::decodeFrame(block, length - 2, frame)) return -1;
+  return frame.payload[1] + frame.payload[2];
+}
+
+template <typename Fn>
+double nsPerCall(Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ITERATIONS; i++) fn(i);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() /
+         ITERATIONS;
+}
+
+}  // namespace
+
+int main() {
+  char text[256];
+  uint8_t wire[protocol::MAX_ENCODED];
+
+  size_t textBytes = 0;
+  size_t binaryBytes = 0;
+  for (int i = 0; i < STATES_PER_CYCLE; i++) {
+    textBytes += textState(text, sizeof(text), i % 7, uint8_t(i));
+    binaryBytes += binaryState(wire, uint8_t(i), i % 7, uint8_t(i));
+  }
+  for (int i = 0; i < HEARTBEATS_PER_CYCLE; i++) {
+    textBytes += textHeartbeat(text, sizeof(text), 1000000 + i * 1000);
+    binaryBytes += binaryHeartbeat(wire, uint8_t(i), 1000000 + i * 1000);
+  }
+  textBytes += strlen("SLAVE_REQUEST ANALYSIS_START\r\n");
+  textBytes += strlen("ANALYSIS_RESULT TRUE\n");
+  binaryBytes += protocol::encodeFrame(protocol::MessageType::ANALYSIS_START,
+                                       0, nullptr, 0, wire);
+  uint8_t eject = 1;
+  binaryBytes += protocol::encodeFrame(protocol::MessageType::ANALYSIS_RESULT,
+                                       0, &eject, 1, wire);
+
+  // 10 bits per byte on an 8N1 UART
+  const double baud = 115200.0;
+  printf(
+      "bytes per cycle:  text %zu (%.1f ms wire)  binary %zu (%.1f ms wire)\n",
+      textBytes, textBytes * 10000.0 / baud, binaryBytes,
+      binaryBytes * 10000.0 / baud);
+
+  double textEncode = nsPerCall(
+      [&](int i) { sink = textState(text, sizeof(text), i & 7, uint8_t(i)); });
+  double binaryEncode = nsPerCall([&](int i) {
+    sink = binaryState(wire, uint8_t(i), i & 7, uint8_t(i));
+  });
+
+  textState(text, sizeof(text), 4, 0x0B);
+  size_t wireLength = binaryState(wire, 7, 4, 0x0B);
+  double textDecode = nsPerCall([&](int) { sink = textParseState(text); });
+  double binaryDecode =
+      nsPerCall([&](int) { sink = binaryParse(wire, wireLength); });
+
+  printf("state encode:     text %.1f ns  binary %.1f ns\n", textEncode,
+         binaryEncode);
+  printf("state decode:     text %.1f ns  binary %.1f ns\n", textDecode,
+         binaryDecode);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,165 @@
+// Host benchmark comparing the old switch-based router cycle with table
+// dispatch through StateTable.
+//
+//   pio run -e bench_state_machine && .pio/build/bench_state_machine/program
+//
+// Both machines drive the same mock cycle (push, raise, wait for a verdict,
+// eject or pass, lower) against a fake millisecond clock. A pass is one
+// loop() call; most passes find nothing due, which is the common case on
+// the controller.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../src/StateMachine.h"
+
+namespace {
+
+constexpr int PASSES = 10000000;
+
+enum class Phase {
+  IDLE,
+  PUSHING,
+  RAISING,
+  WAITING,
+  EJECTING,
+  LOWERING,
+};
+constexpr size_t PHASE_COUNT = static_cast<size_t>(Phase::LOWERING) + 1;
+
+// Stand-in for RouterController: outputs are counters, inputs are derived
+// from the clock so both machines see the same world
+struct Cycle {
+  Phase phase = Phase::IDLE;
+  unsigned long nowMs = 0;
+  unsigned long enteredAt = 0;
+  unsigned long cycles = 0;
+  unsigned long ejected = 0;
+  bool verdict = false;
+
+  bool boardPresent() const { return nowMs % 4000 < 2000; }
+  bool verdictIn() const { return verdict; }
+  bool shouldEject() const { return cycles % 5 == 0; }
+
+  void push() {}
+  void raise() {}
+  void request() { verdict = false; }
+  void eject() { ejected++; }
+  void lower() {}
+  void complete() { cycles++; }
+
+  // Today's shape: one case per state, timers checked inline
+  void switchPass() {
+    unsigned long elapsed = nowMs - enteredAt;
+    switch (phase) {
+      case Phase::IDLE:
+        if (boardPresent()) enter(Phase::PUSHING);
+        break;
+      case Phase::PUSHING:
+        if (elapsed >= 500 && !boardPresent()) {
+          raise();
+          enter(Phase::RAISING);
+        }
+        break;
+      case Phase::RAISING:
+        if (elapsed >= 500) {
+          request();
+          enter(Phase::WAITING);
+        }
+        break;
+      case Phase::WAITING:
+        if (verdictIn() && shouldEject()) {
+          eject();
+          enter(Phase::EJECTING);
+        } else if (verdictIn() || elapsed >= 5000) {
+          lower();
+          enter(Phase::LOWERING);
+        }
+        break;
+      case Phase::EJECTING:
+        if (elapsed >= 200) {
+          lower();
+          enter(Phase::LOWERING);
+        }
+        break;
+      case Phase::LOWERING:
+        if (elapsed >= 1000) {
+          complete();
+          enter(Phase::IDLE);
+        }
+        break;
+    }
+  }
+
+  void enter(Phase next) {
+    phase = next;
+    enteredAt = nowMs;
+  }
+};
+
+using Machine = StateTable<Cycle, Phase, PHASE_COUNT>;
+
+constexpr Machine::Transition ROWS[] = {
+    {Phase::IDLE, Machine::when<&Cycle::boardPresent>,
+     Machine::run<&Cycle::push>, nullptr, Phase::PUSHING},
+    {Phase::PUSHING, [](const Cycle& c) { return !c.boardPresent(); },
+     Machine::run<&Cycle::raise>, Machine::afterMs<500>, Phase::RAISING},
+    {Phase::RAISING, nullptr, Machine::run<&Cycle::request>,
+     Machine::afterMs<500>, Phase::WAITING},
+    {Phase::WAITING,
+     [](const Cycle& c) { return c.verdictIn() && c.shouldEject(); },
+     Machine::run<&Cycle::eject>, nullptr, Phase::EJECTING},
+    {Phase::WAITING, Machine::when<&Cycle::verdictIn>,
+     Machine::run<&Cycle::lower>, nullptr, Phase::LOWERING},
+    {Phase::WAITING, nullptr, Machine::run<&Cycle::lower>,
+     Machine::afterMs<5000>, Phase::LOWERING},
+    {Phase::EJECTING, nullptr, Machine::run<&Cycle::lower>,
+     Machine::afterMs<200>, Phase::LOWERING},
+    {Phase::LOWERING, nullptr, Machine::run<&Cycle::complete>,
+     Machine::afterMs<1000>, Phase::IDLE},
+};
+constexpr Machine::Index INDEX = Machine::index(ROWS);
+
+constexpr Phase ROOTS[] = {Phase::IDLE};
+static_assert(Machine::allReachable(ROWS, ROOTS), "unreachable phase");
+static_assert(Machine::timedStatesExit(ROWS), "timed phase without exit");
+static_assert(Machine::noShadowedRows(ROWS), "shadowed row");
+
+// The master answers 300 ms into the wait; passes are 100 us apart
+template <typename Fn>
+double nsPerPass(Cycle& cycle, Fn pass) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < PASSES; i++) {
+    cycle.nowMs = i / 10;
+    if (cycle.phase == Phase::WAITING &&
+        cycle.nowMs - cycle.enteredAt >= 300) {
+      cycle.verdict = true;
+    }
+    pass(cycle);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / PASSES;
+}
+
+}  // namespace
+
+int main() {
+  Cycle switched;
+  double switchNs = nsPerPass(switched, [](Cycle& c) { c.switchPass(); });
+
+  Cycle tabled;
+  double tableNs = nsPerPass(tabled, [](Cycle& c) {
+    Machine::dispatch(ROWS, INDEX, c, c.phase, c.enteredAt, c.nowMs);
+  });
+
+  printf("switch:  %.2f ns/pass  (%lu cycles, %lu ejected)\n", switchNs,
+         switched.cycles, switched.ejected);
+  printf("table:   %.2f ns/pass  (%lu cycles, %lu ejected)\n", tableNs,
+         tabled.cycles, tabled.ejected);
+  if (switched.cycles != tabled.cycles || switched.ejected != tabled.ejected) {
+    printf("MISMATCH: the two machines diverged\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,64 @@
+#include "AllocCounter.h"
+
+#include <stdlib.h>
+
+#include <new>
+
+namespace {
+bool armed = false;
+uint64_t allocations = 0;
+
+void note() {
+  if (armed) allocations++;
+}
+}  // namespace
+
+namespace allocs {
+
+void arm() { armed = true; }
+void disarm() { armed = false; }
+uint64_t count() { return allocations; }
+
+}  // namespace allocs
+
+// operator new is replaceable everywhere, so C++ allocations are always
+// counted (through malloc on glibc, directly elsewhere)
+void* operator new(size_t size) {
+#ifndef __GLIBC__
+  note();
+#endif
+  void* ptr = malloc(size ? size : 1);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+
+#ifdef __GLIBC__
+// glibc lets the executable interpose malloc itself, which also catches C
+// allocations made from inside libc (e.g. by printf)
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+  note();
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  note();
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  note();
+  return __libc_realloc(ptr, size);
+}
+}
+#endif
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+// Counts heap allocations made while armed. Used by the simulator to prove
+// the firmware's steady state never touches the heap.
+namespace allocs {
+
+void arm();
+void disarm();
+uint64_t count();
+
+}  // namespace allocs
@@ -0,0 +1,309 @@
+#include <string.h>
+
+#include <chrono>
+
+#include "../src/Hal.h"
+#include "../src/SpscQueue.h"
+#include "../src/config.h"
+#include "Sim.h"
+
+namespace {
+
+template <size_t N>
+struct ByteRing {
+  uint8_t buffer[N];
+  size_t head = 0;
+  size_t used = 0;
+
+  size_t space(size_t capacity) const { return capacity - used; }
+
+  void push(uint8_t byte) {
+    buffer[(head + used) % N] = byte;
+    used++;
+  }
+
+  uint8_t pop() {
+    uint8_t byte = buffer[head];
+    head = (head + 1) % N;
+    used--;
+    return byte;
+  }
+};
+
+uint64_t now = 0;
+uint64_t blocked = 0;
+uint32_t heapWalkUs = 0;
+int levels[sim::PIN_COUNT];
+bool levelsInitialized = false;
+
+unsigned long baudRate = 115200;
+size_t driverCapacity = 0;
+ByteRing<8192> driver;     // UART driver TX buffer
+ByteRing<65536> wire;      // Bytes already on the wire, waiting for the host
+ByteRing<4096> received;   // Bytes from the host, waiting for the firmware
+bool wakeRequested = false;
+uint64_t wireCredit = 0;   // Bit-time carry between advances
+uint64_t txTotal = 0;
+
+// Camera strobe timer; fires at its exact virtual time inside advanceUs()
+struct Strobe {
+  uint8_t pin = 0;
+  uint32_t widthUs = 0;
+  uint64_t riseAt = 0;  // 0 = not pending
+  uint64_t fallAt = 0;
+  bool edgeReady = false;
+  uint32_t edgeUs = 0;
+} strobe;
+
+// Edge capture: setInput() on an attached pin queues a timestamped edge,
+// as the GPIO interrupt does on the board
+bool captured[sim::PIN_COUNT];
+SpscQueue<hal::InputEdge, INPUT_EDGE_QUEUE_DEPTH> inputEdges;
+
+sim::InputTap inputTap = nullptr;
+sim::RxTap rxTap = nullptr;
+
+void initLevels() {
+  if (levelsInitialized) return;
+  // Inputs idle high (sensor 1 is active low)
+  for (int i = 0; i < sim::PIN_COUNT; i++) levels[i] = HIGH;
+  levelsInitialized = true;
+}
+
+// 8N1: ten bit times per byte
+void clockOutBytes(uint64_t elapsedUs) {
+  wireCredit += elapsedUs * baudRate;
+  while (wireCredit >= 10000000ULL && driver.used > 0) {
+    wireCredit -= 10000000ULL;
+    uint8_t byte = driver.pop();
+    if (wire.used < sizeof(wire.buffer)) wire.push(byte);
+    txTotal++;
+  }
+  if (driver.used == 0) wireCredit = 0;
+}
+
+// Advances to `at` and runs whichever strobe edge is due there
+void runStrobe(uint64_t at) {
+  clockOutBytes(at - now);
+  now = at;
+  if (strobe.riseAt && now >= strobe.riseAt) {
+    levels[strobe.pin] = HIGH;
+    strobe.edgeUs = static_cast<uint32_t>(now);
+    strobe.edgeReady = true;
+    wakeRequested = true;
+    strobe.fallAt = now + strobe.widthUs;
+    strobe.riseAt = 0;
+  } else if (strobe.fallAt && now >= strobe.fallAt) {
+    levels[strobe.pin] = LOW;
+    strobe.fallAt = 0;
+  }
+}
+
+uint64_t nextStrobeEvent() {
+  return strobe.riseAt ? strobe.riseAt : strobe.fallAt;
+}
+
+void block(uint64_t us) {
+  blocked += us;
+  sim::advanceUs(us);
+}
+
+}  // namespace
+
+namespace sim {
+
+uint64_t nowUs() { return now; }
+
+void advanceUs(uint64_t us) {
+  uint64_t target = now + us;
+  while (nextStrobeEvent() && nextStrobeEvent() <= target) {
+    runStrobe(nextStrobeEvent());
+  }
+  clockOutBytes(target - now);
+  now = target;
+}
+
+uint64_t nextEventUs() {
+  uint64_t next = UINT64_MAX;
+  if (nextStrobeEvent()) next = nextStrobeEvent();
+  if (driver.used > 0) {
+    // The master reads whole lines; step through the backlog like a 1 ms
+    // polling loop would so it sees them on time
+    uint64_t drainUs = driver.used * 10000000ULL / baudRate;
+    uint64_t at = now + (drainUs < 1000 ? drainUs + 1 : 1000);
+    if (at < next) next = at;
+  }
+  return next;
+}
+
+bool takeWakeRequest() {
+  bool requested = wakeRequested;
+  wakeRequested = false;
+  return requested;
+}
+
+void setInput(uint8_t pin, int level) {
+  initLevels();
+  if (pin >= PIN_COUNT) return;
+  if (inputTap && levels[pin] != level) inputTap(pin, level);
+  if (captured[pin] && levels[pin] != level) {
+    hal::InputEdge edge;
+    edge.pin = pin;
+    edge.level = static_cast<uint8_t>(level);
+    edge.us = static_cast<uint32_t>(now);
+    inputEdges.push(edge);
+    wakeRequested = true;
+  }
+  levels[pin] = level;
+}
+
+int pinLevel(uint8_t pin) {
+  initLevels();
+  return pin < PIN_COUNT ? levels[pin] : LOW;
+}
+
+size_t takeTx(uint8_t* out, size_t max) {
+  size_t count = 0;
+  while (count < max && wire.used > 0) out[count++] = wire.pop();
+  return count;
+}
+
+void injectRx(const uint8_t* data, size_t length) {
+  if (rxTap) rxTap(data, length);
+  for (size_t i = 0; i < length && received.used < sizeof(received.buffer);
+       i++) {
+    received.push(data[i]);
+  }
+}
+
+void injectRx(const char* text) {
+  injectRx(reinterpret_cast<const uint8_t*>(text), strlen(text));
+}
+
+void setTaps(InputTap input, RxTap rx) {
+  inputTap = input;
+  rxTap = rx;
+}
+
+uint64_t txBytesTotal() { return txTotal; }
+uint64_t blockedUs() { return blocked; }
+void setHeapWalkUs(uint32_t us) { heapWalkUs = us; }
+
+}  // namespace sim
+
+namespace hal {
+
+uint32_t millis() { return static_cast<uint32_t>(now / 1000); }
+uint32_t micros() { return static_cast<uint32_t>(now); }
+void delay(uint32_t ms) { block(uint64_t(ms) * 1000); }
+void delayMicroseconds(uint32_t us) { block(us); }
+
+void pinMode(uint8_t, uint8_t) { initLevels(); }
+
+void digitalWrite(uint8_t pin, uint8_t level) { sim::setInput(pin, level); }
+
+int digitalRead(uint8_t pin) { return sim::pinLevel(pin); }
+
+void disableInterrupts() {}
+void enableInterrupts() {}
+
+// The simulation loop advances the clock to the next deadline itself
+void bindWakeTarget(WakeTarget) {}
+void wake(WakeTarget) { wakeRequested = true; }
+uint32_t waitForWake(WakeTarget, uint32_t) { return micros(); }
+
+void attachEdgeCapture(uint8_t pin) {
+  if (pin < sim::PIN_COUNT) captured[pin] = true;
+}
+
+bool takeInputEdge(InputEdge& edge) { return inputEdges.pop(edge); }
+unsigned long inputEdgeDrops() { return inputEdges.getDrops(); }
+
+void scheduleStrobe(uint8_t pin, uint32_t delayUs, uint32_t widthUs) {
+  cancelStrobe();
+  initLevels();
+  strobe.pin = pin < sim::PIN_COUNT ? pin : 0;
+  strobe.widthUs = widthUs;
+  strobe.riseAt = now + (delayUs ? delayUs : 1);
+}
+
+void cancelStrobe() {
+  if (strobe.fallAt) levels[strobe.pin] = LOW;
+  strobe.riseAt = strobe.fallAt = 0;
+}
+
+bool takeStrobeEdge(uint32_t& edgeUs) {
+  bool ready = strobe.edgeReady;
+  edgeUs = strobe.edgeUs;
+  strobe.edgeReady = false;
+  return ready;
+}
+
+void serialBegin(unsigned long baud, size_t txBufferSize) {
+  baudRate = baud;
+  driverCapacity = txBufferSize < sizeof(driver.buffer)
+                       ? txBufferSize
+                       : sizeof(driver.buffer);
+}
+
+void serialEnd() {}
+bool serialConnected() { return true; }
+
+size_t serialWritable() { return driver.space(driverCapacity); }
+
+size_t serialWrite(const uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (driver.space(driverCapacity) == 0) {
+      // Like the real driver, wait for the wire to free one byte
+      block(10000000ULL / baudRate + 1);
+    }
+    driver.push(data[i]);
+  }
+  return length;
+}
+
+int serialRead() { return received.used > 0 ? received.pop() : -1; }
+
+// Host time, not the virtual clock: the profiler measures real code cost.
+// One "cycle" per nanosecond.
+uint32_t cycleCount() {
+  return static_cast<uint32_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+uint32_t cyclesPerUs() { return 1000; }
+
+uint32_t freeHeap() { return 200000; }
+uint32_t maxAllocHeap() {
+  sim::advanceUs(heapWalkUs);
+  return 110000;
+}
+int resetReason() { return 1; }  // ESP_RST_POWERON
+uint8_t incrementBootCount() { return 1; }
+
+// Nothing survives a simulated power-on
+void* retainedMemory() {
+  static uint32_t memory[RETAINED_MEMORY_SIZE / 4];
+  return memory;
+}
+
+// Calibrated timings last for the process, like a fresh EEPROM
+namespace {
+uint32_t savedTimings[8];
+size_t savedCount = 0;
+}  // namespace
+
+bool loadTimings(uint32_t* timingsMs, size_t count) {
+  if (savedCount != count) return false;
+  memcpy(timingsMs, savedTimings, count * sizeof(uint32_t));
+  return true;
+}
+
+void saveTimings(const uint32_t* timingsMs, size_t count) {
+  if (count > sizeof(savedTimings) / sizeof(savedTimings[0])) return;
+  memcpy(savedTimings, timingsMs, count * sizeof(uint32_t));
+  savedCount = count;
+}
+
+}  // namespace hal
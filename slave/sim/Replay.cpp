@@ -0,0 +1,187 @@
+#include "Replay.h"
+
+#include <string.h>
+
+namespace replay {
+
+namespace {
+
+const char MAGIC[4] = {'S', 'L', 'R', 'P'};
+constexpr uint8_t VERSION = 1;
+
+constexpr uint8_t AFTER_LOOP = 0x80;
+constexpr uint8_t TAG_RX = 0x7E;
+constexpr uint8_t TAG_END = 0x7F;
+
+void writeU32(FILE* file, uint32_t value) {
+  for (int i = 0; i < 4; i++) fputc((value >> (8 * i)) & 0xFF, file);
+}
+
+class Input {
+ public:
+  explicit Input(const std::vector<uint8_t>& bytes) : bytes(bytes) {}
+
+  bool done() const { return pos >= bytes.size(); }
+  bool ok() const { return !failed; }
+
+  uint8_t u8() {
+    if (pos >= bytes.size()) {
+      failed = true;
+      return 0;
+    }
+    return bytes[pos++];
+  }
+
+  uint64_t uint(int size) {
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++) value |= uint64_t(u8()) << (8 * i);
+    return value;
+  }
+
+  uint64_t varint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t byte = u8();
+      value |= uint64_t(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) return value;
+    }
+    failed = true;
+    return 0;
+  }
+
+  const uint8_t* take(size_t length) {
+    if (bytes.size() - pos < length) {
+      failed = true;
+      return nullptr;
+    }
+    pos += length;
+    return bytes.data() + pos - length;
+  }
+
+ private:
+  const std::vector<uint8_t>& bytes;
+  size_t pos = 0;
+  bool failed = false;
+};
+
+}  // namespace
+
+uint32_t hash(uint32_t seed, const uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    seed ^= data[i];
+    seed *= 16777619u;
+  }
+  return seed;
+}
+
+bool Recorder::open(const char* path, const Header& header) {
+  file = fopen(path, "wb");
+  if (!file) return false;
+  fwrite(MAGIC, 1, sizeof(MAGIC), file);
+  fputc(VERSION, file);
+  writeU32(file, header.tickUs);
+  writeU32(file, header.heapWalkUs);
+  lastUs = 0;
+  return true;
+}
+
+void Recorder::input(uint64_t atUs, bool afterLoop, uint8_t pin, int level) {
+  if (!file) return;
+  stamp(atUs);
+  fputc((afterLoop ? AFTER_LOOP : 0) | (pin * 2 + (level ? 1 : 0)), file);
+}
+
+void Recorder::rx(uint64_t atUs, bool afterLoop, const uint8_t* data,
+                  size_t length) {
+  if (!file || length == 0) return;
+  stamp(atUs);
+  fputc((afterLoop ? AFTER_LOOP : 0) | TAG_RX, file);
+  varint(length);
+  fwrite(data, 1, length, file);
+}
+
+bool Recorder::close(const Trailer& trailer) {
+  if (!file) return false;
+  stamp(trailer.endUs);
+  fputc(TAG_END, file);
+  writeU32(file, static_cast<uint32_t>(trailer.txBytes));
+  writeU32(file, static_cast<uint32_t>(trailer.txBytes >> 32));
+  writeU32(file, trailer.txHash);
+  varint(trailer.passes);
+  bool ok = !ferror(file);
+  fclose(file);
+  file = nullptr;
+  return ok;
+}
+
+void Recorder::stamp(uint64_t atUs) {
+  varint(atUs - lastUs);
+  lastUs = atUs;
+}
+
+void Recorder::varint(uint64_t value) {
+  while (value >= 0x80) {
+    fputc(static_cast<uint8_t>(value) | 0x80, file);
+    value >>= 7;
+  }
+  fputc(static_cast<uint8_t>(value), file);
+}
+
+bool load(const char* path, Recording& out) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+  std::vector<uint8_t> bytes;
+  uint8_t chunk[65536];
+  size_t count;
+  while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    bytes.insert(bytes.end(), chunk, chunk + count);
+  }
+  fclose(file);
+
+  Input in(bytes);
+  const uint8_t* magic = in.take(sizeof(MAGIC));
+  if (!magic || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      in.u8() != VERSION) {
+    fprintf(stderr, "%s is not a version %u recording\n", path, VERSION);
+    return false;
+  }
+  out.header.tickUs = static_cast<uint32_t>(in.uint(4));
+  out.header.heapWalkUs = static_cast<uint32_t>(in.uint(4));
+
+  uint64_t atUs = 0;
+  while (in.ok() && !in.done()) {
+    atUs += in.varint();
+    uint8_t tag = in.u8();
+    if (tag == TAG_END) {
+      out.trailer.endUs = atUs;
+      out.trailer.txBytes = in.uint(8);
+      out.trailer.txHash = static_cast<uint32_t>(in.uint(4));
+      out.trailer.passes = in.varint();
+      if (in.ok()) return true;
+      break;
+    }
+    Event event = {};
+    event.atUs = atUs;
+    event.afterLoop = tag & AFTER_LOOP;
+    tag &= ~AFTER_LOOP;
+    if (tag == TAG_RX) {
+      event.rx = true;
+      event.length = in.varint();
+      const uint8_t* data = in.take(event.length);
+      if (!data) break;
+      event.offset = out.rx.size();
+      out.rx.insert(out.rx.end(), data, data + event.length);
+    } else {
+      event.pin = tag / 2;
+      event.level = tag & 1;
+    }
+    out.events.push_back(event);
+  }
+  fprintf(stderr, "%s is truncated\n", path);
+  return false;
+}
+
+}  // namespace replay
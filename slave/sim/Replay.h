@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+// Recorded simulation inputs: every byte the master sent and every input pin
+// edge, stamped to the microsecond, so a run can be replayed without the
+// line and master models and checked byte for byte against what the
+// firmware sent the first time.
+//
+// File: "SLRP", version, tick and heap walk us (u32 each), then records of
+//   [time since the previous record, varint][tag][...]
+// where tag bit 7 marks an input applied after that time's loop pass and
+// the rest is
+//   pin * 2 + level   an input edge
+//   RX                varint length, then the bytes
+//   END               the run's end; tx bytes u64, tx hash u32 and loop
+//                     passes varint
+// Little endian throughout.
+namespace replay {
+
+struct Header {
+  uint32_t tickUs = 0;
+  uint32_t heapWalkUs = 0;
+};
+
+struct Event {
+  uint64_t atUs;
+  bool afterLoop;
+  bool rx;
+  uint8_t pin;
+  uint8_t level;
+  size_t offset;  // RX bytes in Recording::rx
+  size_t length;
+};
+
+struct Trailer {
+  uint64_t endUs = 0;
+  uint64_t txBytes = 0;
+  uint32_t txHash = 0;
+  uint64_t passes = 0;  // Loop passes of the recorded run
+};
+
+struct Recording {
+  Header header;
+  std::vector<Event> events;
+  std::vector<uint8_t> rx;
+  Trailer trailer;
+};
+
+// FNV-1a, seeded with HASH_SEED, over the firmware's serial output
+constexpr uint32_t HASH_SEED = 2166136261u;
+uint32_t hash(uint32_t seed, const uint8_t* data, size_t length);
+
+class Recorder {
+ public:
+  bool open(const char* path, const Header& header);
+  bool isOpen() const { return file != nullptr; }
+  void input(uint64_t atUs, bool afterLoop, uint8_t pin, int level);
+  void rx(uint64_t atUs, bool afterLoop, const uint8_t* data, size_t length);
+  // Writes the trailer and closes the file
+  bool close(const Trailer& trailer);
+
+ private:
+  void stamp(uint64_t atUs);
+  void varint(uint64_t value);
+
+  FILE* file = nullptr;
+  uint64_t lastUs = 0;
+};
+
+bool load(const char* path, Recording& out);
+
+}  // namespace replay
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Virtual hardware behind HalSim.cpp. Time only moves when the simulation
+// advances it, or when firmware code blocks in delay() or on a full UART
+// TX buffer (which is exactly the cost we want to see).
+namespace sim {
+
+constexpr int PIN_COUNT = 40;
+
+uint64_t nowUs();
+void advanceUs(uint64_t us);
+// Next strobe edge, or the next byte boundary while the UART driver is still
+// sending; UINT64_MAX when the hardware is idle
+uint64_t nextEventUs();
+// True once after an interrupt or hal::wake() asked the firmware to run,
+// the notification a sleeping task would get on the board
+bool takeWakeRequest();
+
+// Inputs are driven by the scenario, outputs by the firmware
+void setInput(uint8_t pin, int level);
+int pinLevel(uint8_t pin);
+
+// Bytes the firmware sent that have finished crossing the simulated wire
+size_t takeTx(uint8_t* out, size_t max);
+// Queues bytes for the firmware to read
+void injectRx(const uint8_t* data, size_t length);
+void injectRx(const char* text);
+
+// Called with each input level change and each injectRx(), so a run can be
+// recorded; nullptr to stop
+using InputTap = void (*)(uint8_t pin, int level);
+using RxTap = void (*)(const uint8_t* data, size_t length);
+void setTaps(InputTap input, RxTap rx);
+
+uint64_t txBytesTotal();
+// Virtual time the firmware spent blocked in delay() or serialWrite()
+uint64_t blockedUs();
+// How long hal::maxAllocHeap() takes, for the heap walk it does on the board
+void setHeapWalkUs(uint32_t us);
+
+}  // namespace sim
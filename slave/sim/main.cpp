@@ -0,0 +1,1470 @@
+// Host simulation of the slave firmware against a virtual clock.
+//
+//   pio run -e native && .pio/build/native/program [options]
+//
+// A line model feeds boards onto sensor 1 and takes them away when the push
+// cylinder fires; a simulated master answers ANALYSIS_START after the capture
+// and analysis latencies. Cycle times are measured from the STATE traffic
+// exactly as the master sees it. A scripted timeline can replace the line
+// model for reproducing specific sequences.
+//
+// Pipelining comparison (same line, same master latencies):
+//
+//   program --hours 1              # one board at a time
+//   program --hours 1 --pipelined  # next push overlaps the analysis
+//
+// Overlap comparison: the cycle time line shows what each setting saves, and
+// the interlock line must stay at zero:
+//
+//   program --riser-overlap-ms 400
+//   program --pipelined --riser-overlap-ms 400 --eject-overlap-ms 800
+//   program --continuous-feed      # queued boards skip IDLE entirely
+//   program --stroke-sensors 7     # reed switches end push/riser/ejection
+//
+// Calibration: dry strokes on an empty line search each timing down to the
+// modelled stroke time before boards start to flow:
+//
+//   program --stroke-sensors 7 --calibrate
+//
+// Latency tails: --hist asks for HIST at the end of the run and prints the
+// per-state dwell, analysis round trip and sensor-to-push percentiles.
+// --profile does the same with PROFILE, for a build with -DPROFILER_ENABLED
+// (pio run -e native_profile).
+//
+// Stalls: every STALL report is counted and the longest printed; a slow
+// heap walk behind the periodic heap report can be modelled with
+// --heap-walk-us N.
+//
+// Stale verdicts: --late-every N holds every Nth analysis reply until half
+// a second after the firmware's "No verdict for board" warning, which in a
+// pipelined cycle comes only when the board reaches the ejector. The
+// verdicts line counts what the firmware dropped; a run with none fails,
+// misrouted must stay at zero, and HIST shows the lateness as LATE_VERDICT.
+// --analysis-timeout-ms N tries a tighter timeout:
+//
+//   program --pipelined --late-every 7 --hist --analysis-timeout-ms 3200
+//
+// --block-comms-ms N holds the comms task off for N ms after each verdict,
+// as a long CRITICAL drain would, while the control task runs on and its
+// DEBUG traces pile up. Every board's analysis request must still reach the
+// master; a lost one fails the run:
+//
+//   program --cycles 20 --block-comms-ms 7500
+//
+// --dump-trace sends DUMP_TRACE at the end and prints how many flight
+// recorder events came back, with the last few.
+//
+// --capture FILE writes the slave's raw serial output to FILE, frames and
+// all, for tools/trace_tool.cpp and tools/chrome_trace.cpp.
+//
+// --record FILE keeps every byte the master sent and every input edge, with
+// the output's length and hash; --replay FILE drives the firmware from that
+// file alone, faster than real time, and fails unless it sends exactly the
+// same bytes. A recording makes a regression fixture: replay it after a
+// change to prove the behaviour held and compare the loop passes and wall
+// time.
+//
+//   program --cycles 500 --record fixture.rec
+//   program --replay fixture.rec
+//
+// The firmware sleeps until its next deadline or wake-up, and the clock
+// jumps straight there; --tick-us N polls every N us instead, for comparing
+// how many loop passes each approach costs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../src/Protocol.h"
+#include "../src/SerialOutput.h"
+#include "../src/SlaveController.h"
+#include "AllocCounter.h"
+#include "Replay.h"
+#include "Sim.h"
+
+namespace {
+
+struct Options {
+  double hours = 8.0;
+  unsigned long cycles = 0;  // Stop after this many cycles (0 = use hours)
+  uint32_t tickUs = 0;  // Fixed loop() period; 0 sleeps to the next deadline
+  bool binary = false;
+  bool allocCheck = false;
+  bool hist = false;
+  bool profile = false;
+  bool dumpTrace = false;
+  uint32_t heapWalkUs = 0;
+  const char* script = nullptr;
+  const char* capture = nullptr;  // Raw copy of the slave's serial output
+  const char* record = nullptr;   // Inputs and output hash, for --replay
+  const char* replay = nullptr;
+
+  // Line and master timing (defaults from the production stats)
+  uint32_t feedGapMs = 500;     // Next board reaches sensor 1 after the last
+  uint32_t pushClearMs = 400;   // Board leaves sensor 1 after push starts
+  uint32_t captureMs = 1600;
+  uint32_t analysisMs = 1200;
+  unsigned ejectEvery = 5;      // Every Nth analysed board is ejected
+  unsigned lateEvery = 0;       // Every Nth verdict misses the timeout
+  uint32_t blockCommsMs = 0;    // Comms held off after each verdict
+
+  // Firmware settings; 0 keeps the firmware default
+  uint32_t pushMs = 0;
+  uint32_t riserMs = 0;
+  uint32_t ejectMs = 0;
+  uint32_t captureHoldMs = 0;
+  uint32_t triggerLeadMs = 0;
+  uint32_t sensorConfirmUs = 0;
+  uint32_t riserOverlapMs = 0;
+  uint32_t ejectOverlapMs = 0;
+  bool continuousFeed = false;
+  uint32_t analysisTimeoutMs = 0;
+  // Reed switches: fitted mask for the firmware and modelled stroke times
+  uint32_t strokeSensors = 0;
+  uint32_t pushStrokeMs = 600;
+  uint32_t riserStrokeMs = 700;
+  uint32_t ejectStrokeMs = 300;
+  // Dry-cycle calibration before the line starts; 0 keeps the defaults
+  bool calibrate = false;
+  uint32_t calibrateCycles = 0;
+  uint32_t calibrateStepMs = 0;
+  uint32_t calibrateMarginPercent = 0;
+  int analysisMode = -1;
+  bool pipelined = false;
+  bool noStagger = false;
+};
+
+struct ScriptEvent {
+  uint64_t atUs;
+  bool send;
+  uint8_t pin;
+  int level;
+  char text[COMMAND_MAX_LENGTH];
+};
+
+// Feeds boards onto sensor 1 (active low) and clears them once pushed
+class LineModel {
+ public:
+  explicit LineModel(const Options& options) : options(options) {}
+
+  void start() {
+    sim::setInput(SENSOR1_PIN, HIGH);
+    arriveAt = sim::nowUs() + options.feedGapMs * 1000ULL;
+  }
+
+  void step() {
+    uint64_t now = sim::nowUs();
+    if (!boardPresent && arriveAt && now >= arriveAt) {
+      boardPresent = true;
+      arriveAt = 0;
+      arrivedUs = now;
+      sim::setInput(SENSOR1_PIN, LOW);
+    }
+    if (boardPresent && !clearAt && sim::pinLevel(PUSH_CYLINDER_PIN) == HIGH) {
+      clearAt = now + options.pushClearMs * 1000ULL;
+    }
+    if (clearAt && now >= clearAt) {
+      boardPresent = false;
+      clearAt = 0;
+      sim::setInput(SENSOR1_PIN, HIGH);
+      arriveAt = now + options.feedGapMs * 1000ULL;
+    }
+  }
+
+  uint64_t nextEventUs() const {
+    uint64_t next = UINT64_MAX;
+    if (arriveAt && arriveAt < next) next = arriveAt;
+    if (clearAt && clearAt < next) next = clearAt;
+    return next;
+  }
+
+  // Arrival time of a board not yet reported; 0 if none
+  uint64_t takeArrival() {
+    uint64_t at = arrivedUs;
+    arrivedUs = 0;
+    return at;
+  }
+
+ private:
+  const Options& options;
+  bool boardPresent = false;
+  uint64_t arrivedUs = 0;
+  uint64_t arriveAt = 0;
+  uint64_t clearAt = 0;
+};
+
+// End-of-stroke reed switches: each closes (active low) a fixed stroke
+// time after its valve opens and releases as soon as the valve closes
+class StrokeModel {
+ public:
+  explicit StrokeModel(const Options& options)
+      : strokeUs{options.pushStrokeMs * 1000ULL,
+                 options.riserStrokeMs * 1000ULL,
+                 options.ejectStrokeMs * 1000ULL} {}
+
+  void step() {
+    uint64_t now = sim::nowUs();
+    for (size_t i = 0; i < STROKE_COUNT; i++) {
+      int valve = sim::pinLevel(VALVES[i]);
+      if (valve == HIGH && !closeAt[i] && sim::pinLevel(REEDS[i]) == HIGH) {
+        closeAt[i] = now + strokeUs[i];
+      }
+      if (valve == LOW) {
+        closeAt[i] = 0;
+        sim::setInput(REEDS[i], HIGH);
+      }
+      if (closeAt[i] && now >= closeAt[i]) {
+        sim::setInput(REEDS[i], LOW);
+        closeAt[i] = 0;
+      }
+    }
+  }
+
+  uint64_t nextEventUs() const {
+    uint64_t next = UINT64_MAX;
+    for (uint64_t at : closeAt) {
+      if (at && at < next) next = at;
+    }
+    return next;
+  }
+
+ private:
+  static constexpr uint8_t VALVES[STROKE_COUNT] = {
+      PUSH_CYLINDER_PIN, RISER_CYLINDER_PIN, EJECTION_CYLINDER_PIN};
+  static constexpr uint8_t REEDS[STROKE_COUNT] = {
+      PUSH_STROKE_PIN, RISER_STROKE_PIN, EJECTION_STROKE_PIN};
+  uint64_t strokeUs[STROKE_COUNT];
+  uint64_t closeAt[STROKE_COUNT] = {};
+};
+
+// A text HEARTBEAT must carry exactly HEARTBEAT_TEXT_KEYS, in order, so a
+// key added without updating the list (and its bound) fails the run
+bool heartbeatKeysMatch(const char* line) {
+  const char* json = strchr(line, '{');
+  // The line still ends in \r; only \n splits them
+  if (!json || strlen(line) + 1 > heartbeatTextMax()) return false;
+  size_t next = 0;
+  int depth = 0;
+  for (const char* c = json; *c; c++) {
+    if (*c == '{' || *c == '[') depth++;
+    if (*c == '}' || *c == ']') depth--;
+    if (*c != '"') continue;
+    const char* end = strchr(c + 1, '"');
+    if (!end) return false;
+    if (depth == 1 && end[1] == ':') {
+      const size_t count =
+          sizeof(HEARTBEAT_TEXT_KEYS) / sizeof(HEARTBEAT_TEXT_KEYS[0]);
+      const char* name = next < count ? HEARTBEAT_TEXT_KEYS[next].name : "";
+      if (strlen(name) != size_t(end - c - 1) ||
+          strncmp(name, c + 1, end - c - 1) != 0) {
+        return false;
+      }
+      next++;
+    }
+    c = end;
+  }
+  return next == sizeof(HEARTBEAT_TEXT_KEYS) / sizeof(HEARTBEAT_TEXT_KEYS[0]);
+}
+
+// Plays the master's side of the serial protocol
+class SimMaster {
+ public:
+  struct Stats {
+    unsigned long cycles = 0;
+    uint64_t totalCycleUs = 0;
+    uint64_t minCycleUs = UINT64_MAX;
+    uint64_t maxCycleUs = 0;
+    unsigned long analysisRequests = 0;
+    unsigned long lostRequests = 0;  // Board ids skipped on the wire
+    unsigned long armed = 0;  // Requests whose capture began at ANALYSIS_ARM
+    unsigned long ejects = 0;
+    unsigned long stateMessages = 0;
+    unsigned long corruptFrames = 0;
+    unsigned long badHeartbeats = 0;  // Off their declared size or keys
+    unsigned long strobes = 0;
+    // ANALYSIS_START arrival after the camera strobe: the serial latency
+    // the hardware trigger takes out of the capture path
+    uint64_t totalStartLagUs = 0;
+    uint64_t maxStartLagUs = 0;
+    unsigned long ejectorFires = 0;
+    unsigned long misrouted = 0;  // Ejector fired on a board that passed
+    unsigned long backToBack = 0;  // Continuous feed: LOWERING -> PUSHING
+    // Board reaching an idle sensor 1 to WAITING_FOR_PUSH on the wire
+    unsigned long detections = 0;
+    uint64_t totalDetectUs = 0;
+    uint64_t maxDetectUs = 0;
+    uint32_t firmwareLatencyMaxUs = 0;  // From the heartbeat
+    uint32_t strokeMaxMs[STROKE_COUNT] = {};  // From the heartbeat
+    // CALIBRATION report: status, minimum and applied timing per stroke
+    uint64_t calibratedUs = 0;  // 0 until the report arrives
+    char calibrationStatus[STROKE_COUNT][16] = {};
+    uint32_t calibrationMinMs[STROKE_COUNT] = {};
+    uint32_t calibrationMs[STROKE_COUNT] = {};
+    std::vector<std::string> histograms;  // HIST lines, as received
+    std::vector<std::string> profile;     // PROFILE lines, as received
+    unsigned long stalls = 0;
+    uint32_t longestStallUs = 0;
+    std::string longestStall;  // Its STALL line
+    // Verdicts the firmware dropped: late, duplicate, unmatched
+    uint32_t droppedVerdicts[3] = {};
+    std::vector<std::string> flight;  // FLIGHT lines, or frame summaries
+    std::string flightEnd;            // Empty until the dump completes
+  };
+
+  explicit SimMaster(const Options& options) : options(options) {}
+
+  void feed(const uint8_t* data, size_t length) {
+    if (capture) fwrite(data, 1, length, capture);
+    for (size_t i = 0; i < length; i++) feedByte(data[i]);
+  }
+
+  void setCapture(FILE* file) { capture = file; }
+
+  // Sends any analysis results that have become due; true if one went
+  bool step() {
+    bool sent = false;
+    for (Reply& reply : replies) {
+      if (!reply.pending || sim::nowUs() < reply.atUs) continue;
+      reply.pending = false;
+      sendResult(reply.eject, reply.boardId);
+      sent = true;
+    }
+    return sent;
+  }
+
+  const Stats& getStats() const { return stats; }
+
+  uint64_t nextEventUs() const {
+    uint64_t next = UINT64_MAX;
+    for (const Reply& reply : replies) {
+      if (reply.pending && reply.atUs < next) next = reply.atUs;
+    }
+    return next;
+  }
+
+  // Only a board that finds the router idle measures detection latency
+  void noteArrival(uint64_t atUs) {
+    if (lastState == RouterState::IDLE) arrivalUs = atUs;
+  }
+
+  // Called when the ejector fires on the boardId-th board pushed
+  void onEjection(uint32_t boardId) {
+    stats.ejectorFires++;
+    if (boardId == 0 || boardId > verdicts.size() || !verdicts[boardId - 1]) {
+      stats.misrouted++;
+    }
+  }
+
+ private:
+  struct Reply {
+    bool pending = false;
+    uint64_t atUs = 0;
+    bool eject = false;
+    uint32_t boardId = 0;
+  };
+
+  void feedByte(uint8_t byte) {
+    if (byte == protocol::FRAME_DELIMITER) {
+      if (inFrame && length > 0) {
+        protocol::Frame frame;
+        if (protocol::decodeFrame(buffer, length, frame)) {
+          onFrame(frame);
+        } else {
+          stats.corruptFrames++;
+        }
+        inFrame = false;
+      } else {
+        inFrame = true;
+      }
+      length = 0;
+      return;
+    }
+    if (!inFrame && byte == '\n') {
+      buffer[length] = '\0';
+      onLine(reinterpret_cast<char*>(buffer));
+      length = 0;
+      return;
+    }
+    if (length < sizeof(buffer) - 1) buffer[length++] = byte;
+  }
+
+  void onLine(const char* line) {
+    if (strncmp(line, "STATE ", 6) == 0) {
+      const char* key = "\"router_state\":\"";
+      const char* found = strstr(line, key);
+      if (!found) return;
+      found += strlen(key);
+      for (size_t i = 0; i <= static_cast<size_t>(RouterState::ERROR); i++) {
+        size_t nameLength = strlen(ROUTER_STATE_NAMES[i]);
+        if (strncmp(found, ROUTER_STATE_NAMES[i], nameLength) == 0 &&
+            found[nameLength] == '"') {
+          onState(static_cast<RouterState>(i));
+          return;
+        }
+      }
+    } else if (strncmp(line, "HEARTBEAT ", 10) == 0) {
+      if (!heartbeatKeysMatch(line)) stats.badHeartbeats++;
+      const char* key = "\"sensor_latency_max_us\":";
+      const char* found = strstr(line, key);
+      if (found) {
+        stats.firmwareLatencyMaxUs = strtoul(found + strlen(key), nullptr, 10);
+      }
+      const char* strokeKey = "\"stroke_max_ms\":[";
+      found = strstr(line, strokeKey);
+      if (found) {
+        char* next = const_cast<char*>(found + strlen(strokeKey));
+        for (size_t i = 0; i < STROKE_COUNT; i++) {
+          stats.strokeMaxMs[i] = strtoul(next, &next, 10);
+          if (*next == ',') next++;
+        }
+      }
+      static constexpr const char* DROPPED_KEYS[] = {
+          "\"late_verdicts\":", "\"duplicate_verdicts\":",
+          "\"unmatched_verdicts\":"};
+      for (size_t i = 0; i < 3; i++) {
+        found = strstr(line, DROPPED_KEYS[i]);
+        if (!found) continue;
+        stats.droppedVerdicts[i] =
+            strtoul(found + strlen(DROPPED_KEYS[i]), nullptr, 10);
+      }
+    } else if (strncmp(line, "HIST ", 5) == 0) {
+      stats.histograms.push_back(line + 5);
+    } else if (strncmp(line, "PROFILE ", 8) == 0) {
+      stats.profile.push_back(line + 8);
+    } else if (strncmp(line, "FLIGHT ", 7) == 0) {
+      stats.flight.push_back(line + 7);
+    } else if (strncmp(line, "FLIGHT_END ", 11) == 0) {
+      stats.flightEnd = line + 11;
+    } else if (strncmp(line, "STALL ", 6) == 0) {
+      const char* found = strstr(line, "\"us\":");
+      if (found) onStall(line + 6, strtoul(found + 5, nullptr, 10));
+    } else if (strncmp(line, "CALIBRATION ", 12) == 0) {
+      static constexpr const char* NAMES[STROKE_COUNT] = {"push", "riser",
+                                                          "ejection"};
+      for (size_t i = 0; i < STROKE_COUNT; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "\"%s_status\":\"", NAMES[i]);
+        const char* found = strstr(line, key);
+        if (found) {
+          sscanf(found + strlen(key), "%15[A-Z_]", stats.calibrationStatus[i]);
+        }
+        snprintf(key, sizeof(key), "\"%s_min_ms\":", NAMES[i]);
+        found = strstr(line, key);
+        if (found) {
+          stats.calibrationMinMs[i] = strtoul(found + strlen(key), nullptr, 10);
+        }
+        snprintf(key, sizeof(key), "\"%s_ms\":", NAMES[i]);
+        found = strstr(line, key);
+        if (found) {
+          stats.calibrationMs[i] = strtoul(found + strlen(key), nullptr, 10);
+        }
+      }
+      stats.calibratedUs = sim::nowUs();
+    } else if (strncmp(line, "CAPTURE_EDGE ", 13) == 0) {
+      char* end;
+      uint32_t boardId = strtoul(line + 13, &end, 10);
+      onCaptureEdge(boardId, strtoul(end, nullptr, 10));
+    } else if (strncmp(line, "WARNING No verdict for board ", 29) == 0) {
+      onBoardDropped(strtoul(line + 29, nullptr, 10));
+    } else if (strncmp(line, "SLAVE_REQUEST ANALYSIS_ARM", 26) == 0) {
+      onAnalysisArm(strtoul(line + 26, nullptr, 10));
+    } else if (strncmp(line, "SLAVE_REQUEST ANALYSIS_START", 28) == 0) {
+      onAnalysisStart(strtoul(line + 28, nullptr, 10));
+    }
+  }
+
+  void onFrame(const protocol::Frame& frame) {
+    if (frame.type == protocol::MessageType::STATE && frame.length >= 2) {
+      onState(static_cast<RouterState>(frame.payload[1]));
+    } else if (frame.type == protocol::MessageType::HEARTBEAT &&
+               frame.length >= 54) {
+      // Catches a field added without growing HEARTBEAT_PAYLOAD
+      if (frame.length != protocol::HEARTBEAT_PAYLOAD) {
+        stats.badHeartbeats++;
+      }
+      protocol::PayloadReader reader(frame.payload + 50, 4);
+      uint32_t latencyMaxUs = 0;
+      reader.u32(latencyMaxUs);
+      stats.firmwareLatencyMaxUs = latencyMaxUs;
+      if (frame.length >= 94) {
+        protocol::PayloadReader strokes(frame.payload + 82, 12);
+        for (uint32_t& maxMs : stats.strokeMaxMs) strokes.u32(maxMs);
+      }
+      if (frame.length >= 110) {
+        protocol::PayloadReader dropped(frame.payload + 98, 12);
+        for (uint32_t& count : stats.droppedVerdicts) dropped.u32(count);
+      }
+    } else if (frame.type == protocol::MessageType::HISTOGRAM) {
+      static constexpr const char* NAMES[] = {
+          "ANALYSIS_ROUND_TRIP", "SENSOR_TO_PUSH", "WAKE_LATENCY",
+          "CONTROL_PASS", "COMMS_PASS", "LATE_VERDICT"};
+      protocol::PayloadReader reader(frame.payload, frame.length);
+      uint8_t id = 0;
+      uint32_t values[6] = {};
+      reader.u8(id);
+      for (uint32_t& value : values) reader.u32(value);
+      char line[256];
+      snprintf(line, sizeof(line),
+               "{\"name\":\"%s\",\"samples\":%lu,\"p50_us\":%lu,"
+               "\"p90_us\":%lu,\"p99_us\":%lu,\"p999_us\":%lu,"
+               "\"max_us\":%lu}",
+               id < ROUTER_STATE_COUNT ? ROUTER_STATE_NAMES[id]
+                                       : NAMES[id - ROUTER_STATE_COUNT],
+               static_cast<unsigned long>(values[0]),
+               static_cast<unsigned long>(values[1]),
+               static_cast<unsigned long>(values[2]),
+               static_cast<unsigned long>(values[3]),
+               static_cast<unsigned long>(values[4]),
+               static_cast<unsigned long>(values[5]));
+      stats.histograms.push_back(line);
+    } else if (frame.type == protocol::MessageType::FLIGHT) {
+      protocol::PayloadReader reader(frame.payload, frame.length);
+      char line[128];
+      if (frame.length == 4) {
+        // [previous u16][current u16] ends the dump
+        uint16_t previous = 0;
+        uint16_t current = 0;
+        reader.u16(previous);
+        reader.u16(current);
+        snprintf(line, sizeof(line), "{\"previous\":%u,\"current\":%u}",
+                 previous, current);
+        stats.flightEnd = line;
+        return;
+      }
+      // [run u8][us u32][kind u8][a u8][b u16][value u32]
+      uint8_t run = 0;
+      uint32_t us = 0;
+      uint8_t kind = 0;
+      uint8_t a = 0;
+      uint16_t b = 0;
+      uint32_t value = 0;
+      reader.u8(run);
+      reader.u32(us);
+      reader.u8(kind);
+      reader.u8(a);
+      reader.u16(b);
+      reader.u32(value);
+      snprintf(line, sizeof(line),
+               "{\"run\":%u,\"us\":%lu,\"kind\":%u,\"a\":%u,\"b\":%u,"
+               "\"value\":%lu}",
+               run, static_cast<unsigned long>(us), kind, a, b,
+               static_cast<unsigned long>(value));
+      stats.flight.push_back(line);
+    } else if (frame.type == protocol::MessageType::STALL) {
+      static constexpr const char* TASKS[] = {"control", "comms"};
+      static constexpr const char* ACTIVITIES[] = {
+          "ROUTER",    "COMMAND",   "UART_READ",   "SERIALIZE",  "UART_WRITE",
+          "EVENTS",    "HEARTBEAT", "HEAP_REPORT", "SERIAL_LINK"};
+      protocol::PayloadReader reader(frame.payload, frame.length);
+      uint8_t task = 0;
+      uint8_t activity = 0;
+      uint32_t us = 0;
+      uint32_t activityUs = 0;
+      uint32_t atMs = 0;
+      reader.u8(task);
+      reader.u8(activity);
+      reader.u32(us);
+      reader.u32(activityUs);
+      reader.u32(atMs);
+      char line[192];
+      snprintf(line, sizeof(line),
+               "{\"task\":\"%s\",\"activity\":\"%s\",\"us\":%lu,"
+               "\"activity_us\":%lu,\"at_ms\":%lu}",
+               task < 2 ? TASKS[task] : "UNKNOWN",
+               activity < 9 ? ACTIVITIES[activity] : "UNKNOWN",
+               static_cast<unsigned long>(us),
+               static_cast<unsigned long>(activityUs),
+               static_cast<unsigned long>(atMs));
+      onStall(line, us);
+    } else if (frame.type == protocol::MessageType::CALIBRATION) {
+      static constexpr const char* STATUS[] = {"TUNED", "NO_FEEDBACK",
+                                               "FAILED", "ABORTED"};
+      protocol::PayloadReader reader(frame.payload, frame.length);
+      uint8_t persisted = 0;
+      reader.u8(persisted);
+      for (size_t i = 0; i < STROKE_COUNT; i++) {
+        uint8_t status = 0;
+        reader.u8(status);
+        reader.u32(stats.calibrationMinMs[i]);
+        reader.u32(stats.calibrationMs[i]);
+        snprintf(stats.calibrationStatus[i], sizeof(stats.calibrationStatus[i]),
+                 "%s", status < 4 ? STATUS[status] : "UNKNOWN");
+      }
+      stats.calibratedUs = sim::nowUs();
+    } else if (frame.type == protocol::MessageType::ANALYSIS_START) {
+      protocol::PayloadReader reader(frame.payload, frame.length);
+      uint32_t boardId = 0;
+      reader.u32(boardId);
+      onAnalysisStart(boardId);
+    } else if (frame.type == protocol::MessageType::CAPTURE_EDGE) {
+      protocol::PayloadReader reader(frame.payload, frame.length);
+      uint32_t boardId = 0, edgeUs = 0;
+      reader.u32(boardId);
+      reader.u32(edgeUs);
+      onCaptureEdge(boardId, edgeUs);
+    } else if (frame.type == protocol::MessageType::ANALYSIS_ARM) {
+      protocol::PayloadReader reader(frame.payload, frame.length);
+      uint32_t boardId = 0;
+      reader.u32(boardId);
+      onAnalysisArm(boardId);
+    }
+  }
+
+  void onStall(const char* json, uint32_t us) {
+    stats.stalls++;
+    if (us > stats.longestStallUs) {
+      stats.longestStallUs = us;
+      stats.longestStall = json;
+    }
+  }
+
+  void onState(RouterState state) {
+    stats.stateMessages++;
+    uint64_t now = sim::nowUs();
+    if (state == RouterState::WAITING_FOR_PUSH &&
+        lastState == RouterState::IDLE) {
+      cycleStartUs = now;
+      if (arrivalUs) {
+        uint64_t detectUs = now - arrivalUs;
+        stats.detections++;
+        stats.totalDetectUs += detectUs;
+        if (detectUs > stats.maxDetectUs) stats.maxDetectUs = detectUs;
+        arrivalUs = 0;
+      }
+    }
+    // Continuous feed goes from LOWERING straight into the next push
+    bool fed = state == RouterState::PUSHING &&
+               lastState == RouterState::LOWERING;
+    if ((state == RouterState::IDLE || fed) &&
+        lastState == RouterState::LOWERING && cycleStartUs) {
+      uint64_t cycleUs = now - cycleStartUs;
+      stats.cycles++;
+      stats.totalCycleUs += cycleUs;
+      if (cycleUs < stats.minCycleUs) stats.minCycleUs = cycleUs;
+      if (cycleUs > stats.maxCycleUs) stats.maxCycleUs = cycleUs;
+      cycleStartUs = 0;
+    }
+    if (fed) {
+      stats.backToBack++;
+      cycleStartUs = now;
+    }
+    lastState = state;
+  }
+
+  // The camera starts on the pre-trigger; ANALYSIS_START for the same board
+  // then only confirms the riser has settled
+  void onAnalysisArm(uint32_t boardId) {
+    noteRequest(boardId);
+    stats.armed++;
+    armedBoardId = boardId;
+    scheduleReply(boardId);
+  }
+
+  void onCaptureEdge(uint32_t boardId, uint32_t edgeUs) {
+    stats.strobes++;
+    strobeBoardId = boardId;
+    strobeEdgeUs = edgeUs;
+  }
+
+  void onAnalysisStart(uint32_t boardId) {
+    noteRequest(boardId);
+    if (boardId && boardId == strobeBoardId) {
+      uint64_t lagUs = static_cast<uint32_t>(sim::nowUs()) - strobeEdgeUs;
+      stats.totalStartLagUs += lagUs;
+      if (lagUs > stats.maxStartLagUs) stats.maxStartLagUs = lagUs;
+    }
+    if (boardId && boardId == armedBoardId) return;
+    scheduleReply(boardId);
+  }
+
+  // A held reply goes out half a second after the firmware gave up
+  void onBoardDropped(uint32_t boardId) {
+    for (Reply& reply : replies) {
+      if (reply.pending && reply.boardId == boardId &&
+          reply.atUs == UINT64_MAX) {
+        reply.atUs = sim::nowUs() + 500000ULL;
+      }
+    }
+  }
+
+  // Board ids run in order, so a gap is an analysis request that never
+  // reached the master
+  void noteRequest(uint32_t boardId) {
+    if (boardId > lastRequestId + 1) {
+      stats.lostRequests += boardId - lastRequestId - 1;
+    }
+    if (boardId > lastRequestId) lastRequestId = boardId;
+  }
+
+  void scheduleReply(uint32_t boardId) {
+    stats.analysisRequests++;
+    bool eject = options.ejectEvery &&
+                 stats.analysisRequests % options.ejectEvery == 0;
+    if (boardId > verdicts.size()) verdicts.resize(boardId, false);
+    if (boardId) verdicts[boardId - 1] = eject;
+    for (Reply& reply : replies) {
+      if (reply.pending) continue;
+      reply.pending = true;
+      reply.eject = eject;
+      reply.boardId = boardId;
+      reply.atUs = sim::nowUs() +
+                   (options.captureMs + options.analysisMs) * 1000ULL;
+      // Held until the firmware drops the board (onBoardDropped)
+      if (options.lateEvery &&
+          stats.analysisRequests % options.lateEvery == 0) {
+        reply.atUs = UINT64_MAX;
+      }
+      return;
+    }
+  }
+
+  void sendResult(bool eject, uint32_t boardId) {
+    if (eject) stats.ejects++;
+    if (!options.binary) {
+      char command[48];
+      snprintf(command, sizeof(command), "ANALYSIS_RESULT %s %lu\n",
+               eject ? "TRUE" : "FALSE", static_cast<unsigned long>(boardId));
+      sim::injectRx(command);
+      return;
+    }
+    protocol::PayloadWriter payload;
+    payload.u8(eject ? 1 : 0);
+    payload.u32(boardId);
+    uint8_t encoded[protocol::MAX_ENCODED];
+    size_t size = protocol::encodeFrame(protocol::MessageType::ANALYSIS_RESULT,
+                                        txSeq++, payload.data(),
+                                        payload.size(), encoded);
+    sim::injectRx(encoded, size);
+  }
+
+  const Options& options;
+  Stats stats;
+  std::vector<bool> verdicts;  // Expected verdict per board id
+  uint32_t armedBoardId = 0;
+  uint32_t lastRequestId = 0;
+  uint32_t strobeBoardId = 0;
+  uint32_t strobeEdgeUs = 0;
+  Reply replies[8];
+  uint8_t buffer[TX_MAX_MESSAGE];  // A whole line or frame
+  size_t length = 0;
+  bool inFrame = false;
+  uint8_t txSeq = 0;
+  RouterState lastState = RouterState::IDLE;
+  uint64_t cycleStartUs = 0;
+  uint64_t arrivalUs = 0;
+  FILE* capture = nullptr;
+};
+
+bool loadScript(const char* path, std::vector<ScriptEvent>& events) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    fprintf(stderr, "cannot open script %s\n", path);
+    return false;
+  }
+
+  // Each line: <time_ms> PIN <pin> <level>  |  <time_ms> SEND <text>
+  char line[COMMAND_MAX_LENGTH + 32];
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] == '#' || line[0] == '\n') continue;
+    ScriptEvent event = {};
+    unsigned long atMs;
+    int consumed = 0;
+    char action[8];
+    if (sscanf(line, "%lu %7s %n", &atMs, action, &consumed) < 2) continue;
+    event.atUs = atMs * 1000ULL;
+    if (strcmp(action, "PIN") == 0) {
+      unsigned pin;
+      if (sscanf(line + consumed, "%u %d", &pin, &event.level) != 2) continue;
+      event.pin = static_cast<uint8_t>(pin);
+    } else if (strcmp(action, "SEND") == 0) {
+      event.send = true;
+      snprintf(event.text, sizeof(event.text), "%s", line + consumed);
+    } else {
+      continue;
+    }
+    events.push_back(event);
+  }
+  fclose(file);
+  return true;
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    auto number = [&]() {
+      i++;
+      return value ? strtoul(value, nullptr, 10) : 0;
+    };
+
+    if (strcmp(arg, "--binary") == 0) {
+      options.binary = true;
+    } else if (strcmp(arg, "--no-stagger") == 0) {
+      options.noStagger = true;
+    } else if (strcmp(arg, "--continuous-feed") == 0) {
+      options.continuousFeed = true;
+    } else if (strcmp(arg, "--hist") == 0) {
+      options.hist = true;
+    } else if (strcmp(arg, "--profile") == 0) {
+      options.profile = true;
+    } else if (strcmp(arg, "--dump-trace") == 0) {
+      options.dumpTrace = true;
+    } else if (strcmp(arg, "--heap-walk-us") == 0) {
+      options.heapWalkUs = number();
+    } else if (strcmp(arg, "--calibrate") == 0) {
+      options.calibrate = true;
+    } else if (strcmp(arg, "--calibrate-cycles") == 0) {
+      options.calibrateCycles = number();
+    } else if (strcmp(arg, "--calibrate-step-ms") == 0) {
+      options.calibrateStepMs = number();
+    } else if (strcmp(arg, "--calibrate-margin") == 0) {
+      options.calibrateMarginPercent = number();
+    } else if (strcmp(arg, "--pipelined") == 0) {
+      options.pipelined = true;
+    } else if (strcmp(arg, "--alloc-check") == 0) {
+      options.allocCheck = true;
+    } else if (strcmp(arg, "--hours") == 0 && value) {
+      options.hours = atof(value);
+      i++;
+    } else if (strcmp(arg, "--script") == 0 && value) {
+      options.script = value;
+      i++;
+    } else if (strcmp(arg, "--capture") == 0 && value) {
+      options.capture = value;
+      i++;
+    } else if (strcmp(arg, "--record") == 0 && value) {
+      options.record = value;
+      i++;
+    } else if (strcmp(arg, "--replay") == 0 && value) {
+      options.replay = value;
+      i++;
+    } else if (strcmp(arg, "--cycles") == 0) {
+      options.cycles = number();
+    } else if (strcmp(arg, "--tick-us") == 0) {
+      options.tickUs = number();
+    } else if (strcmp(arg, "--feed-gap-ms") == 0) {
+      options.feedGapMs = number();
+    } else if (strcmp(arg, "--push-clear-ms") == 0) {
+      options.pushClearMs = number();
+    } else if (strcmp(arg, "--capture-ms") == 0) {
+      options.captureMs = number();
+    } else if (strcmp(arg, "--analysis-ms") == 0) {
+      options.analysisMs = number();
+    } else if (strcmp(arg, "--eject-every") == 0) {
+      options.ejectEvery = number();
+    } else if (strcmp(arg, "--block-comms-ms") == 0) {
+      options.blockCommsMs = number();
+    } else if (strcmp(arg, "--late-every") == 0) {
+      options.lateEvery = number();
+    } else if (strcmp(arg, "--analysis-timeout-ms") == 0) {
+      options.analysisTimeoutMs = number();
+    } else if (strcmp(arg, "--push-ms") == 0) {
+      options.pushMs = number();
+    } else if (strcmp(arg, "--riser-ms") == 0) {
+      options.riserMs = number();
+    } else if (strcmp(arg, "--eject-ms") == 0) {
+      options.ejectMs = number();
+    } else if (strcmp(arg, "--capture-hold-ms") == 0) {
+      options.captureHoldMs = number();
+    } else if (strcmp(arg, "--trigger-lead-ms") == 0) {
+      options.triggerLeadMs = number();
+    } else if (strcmp(arg, "--sensor-confirm-us") == 0) {
+      options.sensorConfirmUs = number();
+    } else if (strcmp(arg, "--riser-overlap-ms") == 0) {
+      options.riserOverlapMs = number();
+    } else if (strcmp(arg, "--eject-overlap-ms") == 0) {
+      options.ejectOverlapMs = number();
+    } else if (strcmp(arg, "--stroke-sensors") == 0) {
+      options.strokeSensors = number();
+    } else if (strcmp(arg, "--push-stroke-ms") == 0) {
+      options.pushStrokeMs = number();
+    } else if (strcmp(arg, "--riser-stroke-ms") == 0) {
+      options.riserStrokeMs = number();
+    } else if (strcmp(arg, "--eject-stroke-ms") == 0) {
+      options.ejectStrokeMs = number();
+    } else if (strcmp(arg, "--analysis-mode") == 0) {
+      options.analysisMode = number() != 0;
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return false;
+    }
+  }
+  if (options.allocCheck && options.cycles == 0) {
+    options.cycles = 10000;
+  }
+  return true;
+}
+
+void sendSettings(const Options& options) {
+  char command[COMMAND_MAX_LENGTH];
+  int length = snprintf(command, sizeof(command), "SETTINGS {");
+  const char* separator = "";
+  auto add = [&](const char* key, unsigned long value, bool boolean) {
+    length += snprintf(command + length, sizeof(command) - length,
+                       "%s\"%s\":%s", separator, key,
+                       boolean ? (value ? "true" : "false") : "");
+    if (!boolean) {
+      length += snprintf(command + length, sizeof(command) - length, "%lu",
+                         value);
+    }
+    separator = ",";
+  };
+  if (options.pushMs) add("pushTime", options.pushMs, false);
+  if (options.riserMs) add("riserTime", options.riserMs, false);
+  if (options.ejectMs) add("ejectionTime", options.ejectMs, false);
+  if (options.captureHoldMs) add("captureTime", options.captureHoldMs, false);
+  if (options.triggerLeadMs) add("triggerLead", options.triggerLeadMs, false);
+  if (options.sensorConfirmUs) {
+    add("sensorConfirmUs", options.sensorConfirmUs, false);
+  }
+  if (options.riserOverlapMs) {
+    add("riserOverlap", options.riserOverlapMs, false);
+  }
+  if (options.ejectOverlapMs) {
+    add("ejectOverlap", options.ejectOverlapMs, false);
+  }
+  if (options.analysisMode >= 0) {
+    add("analysisMode", options.analysisMode, true);
+  }
+  if (options.pipelined) add("pipelined", 1, true);
+  if (options.continuousFeed) add("continuousFeed", 1, true);
+  if (options.strokeSensors) {
+    add("strokeSensors", options.strokeSensors, false);
+  }
+  if (options.noStagger) add("staggerSolenoids", 0, true);
+  if (options.analysisTimeoutMs) {
+    add("analysisTimeout", options.analysisTimeoutMs, false);
+  }
+  if (*separator == '\0') return;
+  snprintf(command + length, sizeof(command) - length, "}\n");
+  sim::injectRx(command);
+}
+
+void sendCalibrate(const Options& options) {
+  uint16_t cycles = options.calibrateCycles ? options.calibrateCycles
+                                            : CALIBRATION_CYCLES;
+  uint16_t stepMs = options.calibrateStepMs ? options.calibrateStepMs
+                                            : CALIBRATION_STEP_MS;
+  uint8_t margin = options.calibrateMarginPercent
+                       ? options.calibrateMarginPercent
+                       : CALIBRATION_MARGIN_PERCENT;
+  if (!options.binary) {
+    char command[COMMAND_MAX_LENGTH];
+    snprintf(command, sizeof(command),
+             "CALIBRATE {\"cycles\":%u,\"stepMs\":%u,\"marginPercent\":%u}\n",
+             cycles, stepMs, margin);
+    sim::injectRx(command);
+    return;
+  }
+  protocol::PayloadWriter payload;
+  payload.u16(cycles);
+  payload.u16(stepMs);
+  payload.u8(margin);
+  payload.u8(0);
+  uint8_t encoded[protocol::MAX_ENCODED];
+  size_t size = protocol::encodeFrame(protocol::MessageType::CALIBRATE, 0,
+                                      payload.data(), payload.size(),
+                                      encoded);
+  sim::injectRx(encoded, size);
+}
+
+SlaveController controller;
+
+// --record: inputs reach the firmware either before or after the pass at
+// their time, and a replay has to keep that order
+replay::Recorder recorder;
+bool afterLoop = false;
+
+void recordInput(uint8_t pin, int level) {
+  recorder.input(sim::nowUs(), afterLoop, pin, level);
+}
+
+void recordRx(const uint8_t* data, size_t length) {
+  recorder.rx(sim::nowUs(), afterLoop, data, length);
+}
+
+// Tickless stepping: sleep until the firmware's next deadline, unless the
+// line, the master, the script or the hardware has something due sooner
+uint64_t sleepUs(const LineModel& line, const StrokeModel& strokes,
+                 const SimMaster& master,
+                 const std::vector<ScriptEvent>& script, size_t nextEvent,
+                 uint64_t endUs, uint64_t commsBlockedUntil) {
+  if (sim::takeWakeRequest()) return 0;
+  uint64_t now = sim::nowUs();
+  // Held-off comms work waits for the block to end
+  bool blocked = now < commsBlockedUntil;
+  uint64_t next = now + (blocked ? controller.controlWakeUs()
+                                 : controller.nextWakeUs());
+  auto earlier = [&](uint64_t at) {
+    if (at < next) next = at;
+  };
+  if (blocked) earlier(commsBlockedUntil);
+  earlier(sim::nextEventUs());
+  earlier(master.nextEventUs());
+  if (script.empty()) earlier(line.nextEventUs());
+  earlier(strokes.nextEventUs());
+  if (nextEvent < script.size()) earlier(script[nextEvent].atUs);
+  if (endUs) earlier(endUs);
+  return next > now ? next - now : 0;
+}
+
+// Runs the firmware on a recording's inputs alone and checks its output
+int runReplay(const Options& options) {
+  replay::Recording recording;
+  if (!replay::load(options.replay, recording)) return EXIT_FAILURE;
+  const std::vector<replay::Event>& events = recording.events;
+  const replay::Trailer& expected = recording.trailer;
+  // Only reads the output, for the cycle count
+  SimMaster master(options);
+
+  sim::setHeapWalkUs(recording.header.heapWalkUs);
+  serialOut.begin(BAUD_RATE);
+  controller.setup();
+
+  size_t next = 0;
+  auto apply = [&](bool after) {
+    while (next < events.size() && events[next].atUs <= sim::nowUs() &&
+           events[next].afterLoop == after) {
+      const replay::Event& event = events[next++];
+      if (event.rx) {
+        sim::injectRx(recording.rx.data() + event.offset, event.length);
+      } else {
+        sim::setInput(event.pin, event.level);
+      }
+    }
+  };
+  uint8_t tx[4096];
+  uint64_t txBytes = 0;
+  uint32_t txHash = replay::HASH_SEED;
+  auto takeTx = [&]() {
+    size_t count;
+    while ((count = sim::takeTx(tx, sizeof(tx))) > 0) {
+      txHash = replay::hash(txHash, tx, count);
+      txBytes += count;
+      master.feed(tx, count);
+    }
+  };
+
+  unsigned long passes = 0;
+  auto wallStart = std::chrono::steady_clock::now();
+  while (sim::nowUs() < expected.endUs) {
+    apply(false);
+    allocs::arm();
+    controller.loop();
+    allocs::disarm();
+    passes++;
+    apply(true);
+    takeTx();
+
+    uint64_t now = sim::nowUs();
+    uint64_t wakeAt = now + controller.nextWakeUs();
+    if (recording.header.tickUs) {
+      wakeAt = now + recording.header.tickUs;
+    } else if (sim::takeWakeRequest()) {
+      wakeAt = now;
+    } else {
+      if (sim::nextEventUs() < wakeAt) wakeAt = sim::nextEventUs();
+      if (next < events.size() && events[next].atUs < wakeAt) {
+        wakeAt = events[next].atUs;
+      }
+      if (expected.endUs < wakeAt) wakeAt = expected.endUs;
+    }
+    sim::advanceUs(wakeAt > now ? wakeAt - now : 0);
+  }
+  takeTx();
+  double wallSeconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - wallStart)
+                           .count();
+  double simSeconds = sim::nowUs() / 1e6;
+
+  bool same = txBytes == expected.txBytes && txHash == expected.txHash &&
+              next == events.size();
+  printf("replayed       %.1f s in %.2f s wall (%.0fx), %zu inputs\n",
+         simSeconds, wallSeconds,
+         wallSeconds > 0 ? simSeconds / wallSeconds : 0.0, events.size());
+  printf("cycles         %lu\n", master.getStats().cycles);
+  printf("loop passes    %lu (%llu when recorded)\n", passes,
+         static_cast<unsigned long long>(expected.passes));
+  printf("blocked        %.1f ms in delay/serial writes\n",
+         sim::blockedUs() / 1e3);
+  printf("output         %llu bytes, hash %08lx: %s\n",
+         static_cast<unsigned long long>(txBytes),
+         static_cast<unsigned long>(txHash),
+         same ? "identical" : "DIFFERS");
+  if (!same) {
+    fprintf(stderr, "FAIL: recorded %llu bytes, hash %08lx\n",
+            static_cast<unsigned long long>(expected.txBytes),
+            static_cast<unsigned long>(expected.txHash));
+    return EXIT_FAILURE;
+  }
+  printf("allocations    %llu after setup\n",
+         static_cast<unsigned long long>(allocs::count()));
+  if (options.allocCheck && allocs::count() > 0) {
+    fprintf(stderr, "FAIL: heap allocation after setup()\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    return EXIT_FAILURE;
+  }
+  if (options.replay) return runReplay(options);
+
+  std::vector<ScriptEvent> script;
+  if (options.script && !loadScript(options.script, script)) {
+    return EXIT_FAILURE;
+  }
+  size_t nextEvent = 0;
+
+  LineModel line(options);
+  StrokeModel strokes(options);
+  SimMaster master(options);
+  FILE* capture = nullptr;
+  if (options.capture) {
+    capture = fopen(options.capture, "wb");
+    if (!capture) {
+      fprintf(stderr, "cannot write %s\n", options.capture);
+      return EXIT_FAILURE;
+    }
+    master.setCapture(capture);
+  }
+
+  sim::setHeapWalkUs(options.heapWalkUs);
+  if (options.record) {
+    replay::Header header;
+    header.tickUs = options.tickUs;
+    header.heapWalkUs = options.heapWalkUs;
+    if (!recorder.open(options.record, header)) {
+      fprintf(stderr, "cannot write %s\n", options.record);
+      return EXIT_FAILURE;
+    }
+    sim::setTaps(recordInput, recordRx);
+  }
+
+  // Same order as main.cpp on the board
+  serialOut.begin(BAUD_RATE);
+  controller.setup();
+
+  if (options.binary) sim::injectRx("PROTOCOL BINARY\n");
+  sendSettings(options);
+  // The line starts once the dry strokes are done
+  bool lineStarted = false;
+  if (options.calibrate) {
+    sim::setInput(SENSOR1_PIN, HIGH);
+    sendCalibrate(options);
+  } else if (script.empty()) {
+    line.start();
+    lineStarted = true;
+  }
+
+  const uint64_t endUs = static_cast<uint64_t>(options.hours * 3600e6);
+  uint8_t tx[4096];
+  uint64_t txBytes = 0;
+  uint32_t txHash = replay::HASH_SEED;
+  auto takeTx = [&]() {
+    size_t count;
+    while ((count = sim::takeTx(tx, sizeof(tx))) > 0) {
+      txHash = replay::hash(txHash, tx, count);
+      txBytes += count;
+      master.feed(tx, count);
+    }
+  };
+  // Boards are numbered in push order, matching the firmware's board ids
+  uint32_t pushes = 0;
+  unsigned long passes = 0;
+  int lastPush = LOW;
+  int lastEjection = LOW;
+  int lastRiser = LOW;
+  // Overlaps must never lift a board still on the infeed or fire the ejector
+  // while the push cylinder moves the line
+  unsigned long interlockViolations = 0;
+  // Valve edges landing in the same loop pass would share one EMI window
+  const uint8_t valves[] = {PUSH_CYLINDER_PIN, RISER_CYLINDER_PIN,
+                            EJECTION_CYLINDER_PIN};
+  int valveLevels[3] = {LOW, LOW, LOW};
+  uint64_t lastValveEdgeUs = 0;
+  uint64_t closestValveEdgesUs = UINT64_MAX;
+  const uint32_t ejectorOffset = options.pipelined ? PIPELINE_EJECT_OFFSET : 0;
+  uint64_t commsBlockedUntil = 0;
+  auto wallStart = std::chrono::steady_clock::now();
+
+  while (options.cycles ? master.getStats().cycles < options.cycles
+                        : sim::nowUs() < endUs) {
+    afterLoop = false;
+    while (nextEvent < script.size() &&
+           script[nextEvent].atUs <= sim::nowUs()) {
+      const ScriptEvent& event = script[nextEvent++];
+      if (event.send) {
+        sim::injectRx(event.text);
+      } else {
+        sim::setInput(event.pin, event.level);
+      }
+    }
+    bool verdictSent = master.step();
+
+    allocs::arm();
+    if (sim::nowUs() < commsBlockedUntil) {
+      controller.controlStep();
+    } else {
+      controller.loop();
+    }
+    allocs::disarm();
+    passes++;
+    afterLoop = true;
+    // Comms reads the verdict, then stalls as if in a long CRITICAL drain
+    // while the control task runs the next cycle
+    if (verdictSent && options.blockCommsMs) {
+      commsBlockedUntil = sim::nowUs() + options.blockCommsMs * 1000ULL;
+    }
+
+    if (!lineStarted && script.empty() && master.getStats().calibratedUs) {
+      line.start();
+      lineStarted = true;
+    }
+    // After loop() so the line reacts to the push at once; a board arriving
+    // wakes the firmware through the edge interrupt
+    if (lineStarted) {
+      line.step();
+      if (uint64_t arrivedUs = line.takeArrival()) {
+        master.noteArrival(arrivedUs);
+      }
+    }
+
+    strokes.step();
+
+    // Dry calibration strokes move no boards
+    bool dry = options.calibrate && !master.getStats().calibratedUs;
+    int push = sim::pinLevel(PUSH_CYLINDER_PIN);
+    if (push == HIGH && lastPush == LOW && !dry) pushes++;
+    lastPush = push;
+    int ejection = sim::pinLevel(EJECTION_CYLINDER_PIN);
+    if (ejection == HIGH && lastEjection == LOW && !dry) {
+      master.onEjection(pushes > ejectorOffset ? pushes - ejectorOffset : 0);
+    }
+    lastEjection = ejection;
+    if (ejection == HIGH && push == HIGH) interlockViolations++;
+    int riser = sim::pinLevel(RISER_CYLINDER_PIN);
+    if (riser == HIGH && lastRiser == LOW &&
+        sim::pinLevel(SENSOR1_PIN) == LOW) {
+      interlockViolations++;
+    }
+    lastRiser = riser;
+    for (size_t i = 0; i < 3; i++) {
+      int level = sim::pinLevel(valves[i]);
+      if (level == valveLevels[i]) continue;
+      valveLevels[i] = level;
+      uint64_t gapUs = lastValveEdgeUs ? sim::nowUs() - lastValveEdgeUs : 0;
+      if (lastValveEdgeUs && gapUs < closestValveEdgesUs) {
+        closestValveEdgesUs = gapUs;
+      }
+      lastValveEdgeUs = sim::nowUs();
+    }
+
+    takeTx();
+    sim::advanceUs(options.tickUs
+                       ? options.tickUs
+                       : sleepUs(line, strokes, master, script, nextEvent,
+                                 options.cycles ? 0 : endUs,
+                                 commsBlockedUntil));
+
+    // A scripted run without a cycle target ends with its script
+    if (!script.empty() && !options.cycles && nextEvent == script.size() &&
+        sim::nowUs() > script.back().atUs + 60000000ULL) {
+      break;
+    }
+  }
+  if (options.record) {
+    // Everything on the wire by now, which the replay collects the same way
+    takeTx();
+    sim::setTaps(nullptr, nullptr);
+    replay::Trailer trailer;
+    trailer.endUs = sim::nowUs();
+    trailer.txBytes = txBytes;
+    trailer.txHash = txHash;
+    trailer.passes = passes;
+    if (!recorder.close(trailer)) {
+      fprintf(stderr, "cannot write %s\n", options.record);
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Long enough for every reply line to clear the UART
+  auto drainReplies = [&]() {
+    for (int i = 0; i < 500; i++) {
+      controller.loop();
+      takeTx();
+      sim::advanceUs(1000);
+    }
+  };
+  if (options.hist) {
+    if (options.binary) {
+      uint8_t encoded[protocol::MAX_ENCODED];
+      size_t size = protocol::encodeFrame(protocol::MessageType::HIST, 0,
+                                          nullptr, 0, encoded);
+      sim::injectRx(encoded, size);
+    } else {
+      sim::injectRx("HIST\n");
+    }
+    drainReplies();
+  }
+  if (options.profile) {
+    sim::injectRx("PROFILE\n");
+    drainReplies();
+  }
+  if (options.dumpTrace) {
+    // Streamed as the queue drains, so it takes a few seconds of wire time
+    sim::injectRx("DUMP_TRACE\n");
+    for (int i = 0; i < 60 && master.getStats().flightEnd.empty(); i++) {
+      drainReplies();
+    }
+  }
+
+  double wallSeconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - wallStart)
+                           .count();
+  double simSeconds = sim::nowUs() / 1e6;
+  const SimMaster::Stats& stats = master.getStats();
+
+  printf("simulated      %.1f s in %.2f s wall (%.0fx)\n", simSeconds,
+         wallSeconds, wallSeconds > 0 ? simSeconds / wallSeconds : 0.0);
+  printf("cycles         %lu (%.0f boards/hour)\n", stats.cycles,
+         simSeconds > 0 ? stats.cycles * 3600.0 / simSeconds : 0.0);
+  if (stats.cycles) {
+    printf("cycle time     mean %.1f ms  min %.1f ms  max %.1f ms\n",
+           stats.totalCycleUs / 1e3 / stats.cycles, stats.minCycleUs / 1e3,
+           stats.maxCycleUs / 1e3);
+    if (options.riserOverlapMs || options.ejectOverlapMs) {
+      printf("overlap        riser %lu ms, eject %lu ms; %lu interlock"
+             " violations\n",
+             static_cast<unsigned long>(options.riserOverlapMs),
+             static_cast<unsigned long>(options.ejectOverlapMs),
+             interlockViolations);
+    }
+    if (options.continuousFeed) {
+      printf("continuous     %lu of %lu cycles fed back-to-back\n",
+             stats.backToBack, stats.cycles);
+    }
+    printf("tx bytes       %.0f per cycle\n",
+           double(sim::txBytesTotal()) / stats.cycles);
+  }
+  printf("analysis       %lu requests, %lu eject verdicts (%s)\n",
+         stats.analysisRequests, stats.ejects,
+         options.pipelined ? "pipelined" : "one board at a time");
+  if (stats.lostRequests || options.blockCommsMs) {
+    printf("lost requests  %lu boards never reached the master\n",
+           stats.lostRequests);
+  }
+  if (stats.armed) {
+    printf("pre-trigger    %lu captures armed %lu ms ahead of settle\n",
+           stats.armed, static_cast<unsigned long>(options.triggerLeadMs));
+  }
+  if (stats.strobes) {
+    printf("camera strobe  %lu edges; ANALYSIS_START trails by mean %.1f ms,"
+           " max %.1f ms\n",
+           stats.strobes, stats.totalStartLagUs / 1e3 / stats.strobes,
+           stats.maxStartLagUs / 1e3);
+  }
+  if (stats.detections) {
+    printf("sensor         board to WAITING_FOR_PUSH mean %.1f ms, max %.1f ms;"
+           " firmware edge-to-action max %.1f ms\n",
+           stats.totalDetectUs / 1e3 / stats.detections,
+           stats.maxDetectUs / 1e3, stats.firmwareLatencyMaxUs / 1e3);
+  }
+  if (stats.calibratedUs) {
+    printf("calibration    %.1f s; push %s %lu -> %lu ms, riser %s %lu -> %lu"
+           " ms, ejection %s %lu -> %lu ms (min -> applied)\n",
+           stats.calibratedUs / 1e6, stats.calibrationStatus[0],
+           static_cast<unsigned long>(stats.calibrationMinMs[0]),
+           static_cast<unsigned long>(stats.calibrationMs[0]),
+           stats.calibrationStatus[1],
+           static_cast<unsigned long>(stats.calibrationMinMs[1]),
+           static_cast<unsigned long>(stats.calibrationMs[1]),
+           stats.calibrationStatus[2],
+           static_cast<unsigned long>(stats.calibrationMinMs[2]),
+           static_cast<unsigned long>(stats.calibrationMs[2]));
+  } else if (options.calibrate) {
+    printf("calibration    no report\n");
+  }
+  if (options.strokeSensors) {
+    // Longest measured stroke against the timer it cuts short
+    unsigned long timers[STROKE_COUNT] = {
+        options.pushMs ? options.pushMs : DEFAULT_PUSH_TIME,
+        options.riserMs ? options.riserMs : DEFAULT_RISER_TIME,
+        options.ejectMs ? options.ejectMs : DEFAULT_EJECTION_TIME};
+    if (stats.calibratedUs) {
+      for (size_t i = 0; i < STROKE_COUNT; i++) {
+        timers[i] = stats.calibrationMs[i];
+      }
+    }
+    printf("strokes        push %lu/%lu ms, riser %lu/%lu ms,"
+           " ejection %lu/%lu ms (max measured/timer)\n",
+           static_cast<unsigned long>(stats.strokeMaxMs[0]), timers[0],
+           static_cast<unsigned long>(stats.strokeMaxMs[1]), timers[1],
+           static_cast<unsigned long>(stats.strokeMaxMs[2]), timers[2]);
+  }
+  printf("ejector        %lu fired, %lu misrouted\n", stats.ejectorFires,
+         stats.misrouted);
+  printf("verdicts       %lu late, %lu duplicate, %lu unmatched dropped\n",
+         static_cast<unsigned long>(stats.droppedVerdicts[0]),
+         static_cast<unsigned long>(stats.droppedVerdicts[1]),
+         static_cast<unsigned long>(stats.droppedVerdicts[2]));
+  printf("loop passes    %lu (%.1f per simulated second, %s)\n", passes,
+         simSeconds > 0 ? passes / simSeconds : 0.0,
+         options.tickUs ? "fixed tick" : "tickless");
+  printf("blocked        %.1f ms in delay/serial writes\n",
+         sim::blockedUs() / 1e3);
+  if (closestValveEdgesUs != UINT64_MAX) {
+    printf("valve edges    closest pair %.1f ms apart\n",
+           closestValveEdgesUs / 1e3);
+  }
+  printf("stalls         %lu reported%s%s\n", stats.stalls,
+         stats.stalls ? ", longest " : "", stats.longestStall.c_str());
+  printf("allocations    %llu after setup\n",
+         static_cast<unsigned long long>(allocs::count()));
+  for (const std::string& histogram : stats.histograms) {
+    printf("hist           %s\n", histogram.c_str());
+  }
+  for (const std::string& site : stats.profile) {
+    printf("profile        %s\n", site.c_str());
+  }
+  if (options.dumpTrace) {
+    printf("flight         %zu events, end %s\n", stats.flight.size(),
+           stats.flightEnd.empty() ? "missing" : stats.flightEnd.c_str());
+    size_t shown = stats.flight.size() < 5 ? stats.flight.size() : 5;
+    for (size_t i = stats.flight.size() - shown; i < stats.flight.size(); i++) {
+      printf("flight         %s\n", stats.flight[i].c_str());
+    }
+  }
+  if (stats.corruptFrames) {
+    printf("corrupt frames %lu\n", stats.corruptFrames);
+  }
+  if (capture) fclose(capture);
+
+  if (options.allocCheck && allocs::count() > 0) {
+    fprintf(stderr, "FAIL: heap allocation after setup()\n");
+    return EXIT_FAILURE;
+  }
+  if (stats.lostRequests) {
+    fprintf(stderr, "FAIL: analysis request lost before the master\n");
+    return EXIT_FAILURE;
+  }
+  if (options.lateEvery && stats.droppedVerdicts[0] == 0) {
+    fprintf(stderr, "FAIL: --late-every produced no late verdicts\n");
+    return EXIT_FAILURE;
+  }
+  if (stats.badHeartbeats) {
+    fprintf(stderr, "FAIL: %lu heartbeats off their declared layout\n",
+            stats.badHeartbeats);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+static_assert(PIPELINE_DEPTH > PIPELINE_EJECT_OFFSET,
+              "PIPELINE_DEPTH must hold every board between riser and "
+              "ejector");
+
+enum class BoardPhase : uint8_t {
+  LOADED,      // Pushed onto the riser station
+  ARMED,       // ANALYSIS_ARM sent ahead of the riser settling
+  CAPTURING,   // ANALYSIS_START sent, verdict pending
+  IN_TRANSIT,  // Riser lowered, moving towards the ejector
+  AT_EJECTOR,  // Waiting for its verdict to be applied
+};
+
+struct Board {
+  uint32_t id;
+  BoardPhase phase;
+  uint8_t pushesToEjector;  // Further pushes before it reaches the ejector
+  bool verdictKnown;
+  bool eject;
+  unsigned long requestedAt;  // millis() when ANALYSIS_START was sent
+  uint32_t requestedUs;       // The same in micros(), for the round trip
+};
+
+// Fixed-size FIFO of the boards between the riser and the ejector, oldest
+// first. No allocation; a board leaves once its verdict has been applied.
+class BoardPipeline {
+ public:
+  bool empty() const { return count == 0; }
+  bool full() const { return count == PIPELINE_DEPTH; }
+  size_t size() const { return count; }
+
+  Board* push(uint32_t id, uint8_t pushesToEjector) {
+    if (full()) return nullptr;
+    Board& board = boards[(head + count) % PIPELINE_DEPTH];
+    board =
+        Board{id, BoardPhase::LOADED, pushesToEjector, false, false, 0, 0};
+    count++;
+    return &board;
+  }
+
+  void pop() {
+    if (empty()) return;
+    head = (head + 1) % PIPELINE_DEPTH;
+    count--;
+  }
+
+  void clear() { head = count = 0; }
+
+  Board* front() { return empty() ? nullptr : &boards[head]; }
+  const Board* front() const { return empty() ? nullptr : &boards[head]; }
+  Board* back() {
+    return empty() ? nullptr : &boards[(head + count - 1) % PIPELINE_DEPTH];
+  }
+  const Board* back() const {
+    return empty() ? nullptr : &boards[(head + count - 1) % PIPELINE_DEPTH];
+  }
+
+  // A push moves every board already in flight one station downstream
+  void advance() {
+    for (size_t i = 0; i < count; i++) {
+      Board& board = boards[(head + i) % PIPELINE_DEPTH];
+      if (board.pushesToEjector > 0 && --board.pushesToEjector == 0 &&
+          board.phase != BoardPhase::LOADED) {
+        board.phase = BoardPhase::AT_EJECTOR;
+      }
+    }
+  }
+
+  Board* find(uint32_t id) {
+    for (size_t i = 0; i < count; i++) {
+      Board& board = boards[(head + i) % PIPELINE_DEPTH];
+      if (board.id == id) return &board;
+    }
+    return nullptr;
+  }
+
+ private:
+  Board boards[PIPELINE_DEPTH] = {};
+  size_t head = 0;
+  size_t count = 0;
+};
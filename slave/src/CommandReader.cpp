@@ -0,0 +1,88 @@
+#include "CommandReader.h"
+
+#include <ctype.h>
+#include <string.h>
+
+CommandReader::CommandReader()
+    : assemblyLength(0),
+      inFrame(false),
+      discarding(false),
+      head(0),
+      count(0),
+      overruns(0),
+      overlong(0) {}
+
+void CommandReader::feed(uint8_t byte) {
+  if (byte == 0x00) {
+    if (inFrame && assemblyLength > 0) {
+      complete(true);
+      inFrame = false;
+    } else {
+      // Start of a frame; any partial text line is abandoned
+      inFrame = true;
+      assemblyLength = 0;
+      discarding = false;
+    }
+    return;
+  }
+
+  if (!inFrame && byte == '\n') {
+    complete(false);
+    return;
+  }
+
+  if (discarding) {
+    return;
+  }
+
+  if (assemblyLength >= COMMAND_MAX_LENGTH) {
+    overlong++;
+    discarding = true;
+    return;
+  }
+  assembly[assemblyLength++] = static_cast<char>(byte);
+}
+
+void CommandReader::complete(bool frame) {
+  size_t start = 0;
+  size_t end = assemblyLength;
+  bool dropped = discarding;
+
+  assemblyLength = 0;
+  discarding = false;
+  if (dropped) {
+    return;
+  }
+
+  if (!frame) {
+    while (start < end && isspace(static_cast<uint8_t>(assembly[start]))) {
+      start++;
+    }
+    while (end > start && isspace(static_cast<uint8_t>(assembly[end - 1]))) {
+      end--;
+    }
+    if (start == end) {
+      return;
+    }
+  }
+
+  if (count == COMMAND_QUEUE_DEPTH) {
+    overruns++;
+    return;
+  }
+
+  Message& message = queue[(head + count) % COMMAND_QUEUE_DEPTH];
+  message.frame = frame;
+  message.length = end - start;
+  memcpy(message.data, assembly + start, message.length);
+  message.data[message.length] = '\0';
+  count++;
+}
+
+void CommandReader::pop() {
+  if (count == 0) {
+    return;
+  }
+  head = (head + 1) % COMMAND_QUEUE_DEPTH;
+  count--;
+}
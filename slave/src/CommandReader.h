@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+// Byte-at-a-time assembler for inbound serial traffic. Text commands end at
+// '\n'; binary frames are delimited by 0x00 (see Protocol.h). Completed
+// messages are queued so the caller can drain the UART every loop but only
+// execute a bounded number of commands per pass.
+class CommandReader {
+ public:
+  struct Message {
+    bool frame;
+    size_t length;
+    // Text is trimmed and NUL terminated; frames hold the raw COBS block
+    char data[COMMAND_MAX_LENGTH + 1];
+  };
+
+  CommandReader();
+
+  void feed(uint8_t byte);
+
+  bool available() const { return count > 0; }
+  Message& front() { return queue[head]; }
+  void pop();
+
+  // Messages dropped because the queue was full
+  unsigned long getOverruns() const { return overruns; }
+  // Lines or frames dropped for exceeding COMMAND_MAX_LENGTH
+  unsigned long getOverlong() const { return overlong; }
+
+ private:
+  void complete(bool frame);
+
+  char assembly[COMMAND_MAX_LENGTH];
+  size_t assemblyLength;
+  bool inFrame;
+  bool discarding;
+
+  Message queue[COMMAND_QUEUE_DEPTH];
+  uint8_t head;
+  uint8_t count;
+
+  unsigned long overruns;
+  unsigned long overlong;
+};
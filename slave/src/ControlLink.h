@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "RouterController.h"
+#include "SerialOutput.h"
+#include "SpscQueue.h"
+#include "StallMonitor.h"
+#include "Trace.h"
+#include "config.h"
+
+// Fixed-size messages between the control task (RouterController and its
+// I/O) and the comms task (protocol, heartbeat, logging). Each direction is
+// its own SPSC queue, so neither task ever waits on the other.
+
+// Control -> comms
+struct ControlEvent {
+  enum class Kind : uint8_t {
+    STATE,
+    REQUEST,
+    TRACE,
+    QUIET_WINDOW,
+    CALIBRATION,
+    STALL,
+  };
+
+  Kind kind;
+  uint32_t seq;  // Order across both control -> comms queues
+  union {
+    RouterSnapshot state;
+    struct {
+      SlaveRequest request;
+      uint32_t boardId;
+      uint32_t value;
+    } request;
+    trace::Record trace;
+    uint32_t quietUs;
+    CalibrationReport calibration;
+    StallMonitor::Stall stall;
+  };
+};
+
+// Comms -> control
+struct CommandEvent {
+  enum class Kind : uint8_t {
+    ANALYSIS_RESULT,
+    ABORT_ANALYSIS,
+    SETTING,
+    CALIBRATE,
+    ABORT_CALIBRATION,
+    RESET_HISTOGRAMS,
+    RESET_PROFILE,
+  };
+
+  Kind kind;
+  uint8_t key;  // protocol::SettingKey for SETTING
+  bool eject;
+  uint32_t boardId;
+  uint32_t value;
+  CycleTuner::Request calibrate;
+};
+
+// Traces and stalls may be shed when comms falls behind; states, requests
+// and the rest never share their queue with them, so a burst of log output
+// cannot push out an ANALYSIS_START.
+struct ControlLink {
+  SpscQueue<ControlEvent, CONTROL_QUEUE_DEPTH> toComms;
+  SpscQueue<ControlEvent, CONTROL_QUEUE_DEPTH> toCommsLog;
+  SpscQueue<CommandEvent, CONTROL_QUEUE_DEPTH> toControl;
+};
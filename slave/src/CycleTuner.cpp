@@ -0,0 +1,99 @@
+#include "CycleTuner.h"
+
+#include <limits.h>
+
+void CycleTuner::start(const Request& tuning,
+                       const unsigned long (&timingsMs)[TIMINGS],
+                       uint8_t observedMask, unsigned long nowMs) {
+  request = tuning;
+  if (request.cycles == 0) request.cycles = 1;
+  observed = observedMask;
+  for (size_t i = 0; i < TIMINGS; i++) {
+    startMs[i] = timingsMs[i];
+    results[i] = {Status::NO_FEEDBACK, 0, timingsMs[i]};
+  }
+  active = true;
+  timing = 0;
+  phaseStart = nowMs;
+  beginTiming();
+}
+
+void CycleTuner::abort() {
+  if (!active) return;
+  for (size_t i = timing; i < TIMINGS; i++) {
+    if (observed & (1 << i)) results[i].status = Status::ABORTED;
+  }
+  active = false;
+}
+
+CycleTuner::Action CycleTuner::poll(unsigned long nowMs, bool strokeDone) {
+  if (!active) return Action::NONE;
+  unsigned long elapsedMs = nowMs - phaseStart;
+
+  if (!extended) {
+    if (elapsedMs < dwellMs) return Action::NONE;
+    if (timing == TIMINGS) {
+      active = false;
+      return Action::FINISHED;
+    }
+    extended = true;
+    phaseStart = nowMs;
+    return Action::EXTEND;
+  }
+
+  if (!strokeDone && elapsedMs < candidate) return Action::NONE;
+  extended = false;
+  phaseStart = nowMs;
+  // The cylinder gets back at least as long to retract as it had before
+  dwellMs = startMs[timing];
+  record(strokeDone);
+  return Action::RETRACT;
+}
+
+unsigned long CycleTuner::nextDueMs(unsigned long nowMs) const {
+  if (!active) return ULONG_MAX;
+  unsigned long limitMs = extended ? candidate : dwellMs;
+  unsigned long elapsedMs = nowMs - phaseStart;
+  return limitMs > elapsedMs ? limitMs - elapsedMs : 0;
+}
+
+// Skips timings nothing can judge; a different cylinder may start at once
+void CycleTuner::beginTiming() {
+  while (timing < TIMINGS && !(observed & (1 << timing))) timing++;
+  if (timing == TIMINGS) return;
+  candidate = startMs[timing];
+  passedMs = 0;
+  failedMs = 0;
+  passes = 0;
+  dwellMs = 0;
+}
+
+void CycleTuner::record(bool passed) {
+  if (passed) {
+    if (++passes < request.cycles) return;
+    passedMs = candidate;
+  } else if (!passedMs) {
+    finishTiming(Status::FAILED);
+    return;
+  } else {
+    failedMs = candidate;
+  }
+  passes = 0;
+
+  if (passedMs - failedMs <= request.stepMs) {
+    finishTiming(Status::TUNED);
+    return;
+  }
+  candidate = failedMs + (passedMs - failedMs) / 2;
+}
+
+void CycleTuner::finishTiming(Status status) {
+  Result& result = results[timing];
+  result.status = status;
+  if (status == Status::TUNED) {
+    result.minMs = passedMs;
+    result.recommendedMs = passedMs + passedMs * request.marginPercent / 100;
+  }
+  timing++;
+  beginTiming();
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Searches for the shortest reliable stroke timings over dry cycles: the
+// cylinder is extended with no board on the line, and a stroke passes if
+// its end-of-stroke switch confirms before the candidate timing runs out.
+// Each timing is bisected between the last failing and the last passing
+// candidate until the gap is within stepMs; a candidate only passes after
+// `cycles` strokes in a row. The owner drives the valves and reports the
+// switch; the tuner only decides.
+class CycleTuner {
+ public:
+  static constexpr size_t TIMINGS = 3;  // Push, riser, ejection
+
+  struct Request {
+    uint16_t cycles;
+    uint16_t stepMs;
+    uint8_t marginPercent;  // Added to the minimum found
+    bool persist;
+  };
+
+  enum class Status : uint8_t {
+    TUNED,
+    NO_FEEDBACK,  // No end-of-stroke switch fitted, timing left alone
+    FAILED,       // Did not stroke reliably even at the current timing
+    ABORTED,
+  };
+
+  struct Result {
+    Status status;
+    unsigned long minMs;          // Shortest timing that passed every cycle
+    unsigned long recommendedMs;  // minMs plus the margin
+  };
+
+  enum class Action : uint8_t { NONE, EXTEND, RETRACT, FINISHED };
+
+  // observed has a bit per timing with a switch to judge it by
+  void start(const Request& request, const unsigned long (&timingsMs)[TIMINGS],
+             uint8_t observed, unsigned long nowMs);
+  void abort();
+  // strokeDone: the switch of the current timing confirmed since EXTEND
+  Action poll(unsigned long nowMs, bool strokeDone);
+  // ms until poll() has something to do
+  unsigned long nextDueMs(unsigned long nowMs) const;
+
+  bool isActive() const { return active; }
+  size_t current() const { return timing; }
+  unsigned long candidateMs() const { return candidate; }
+  const Result& result(size_t index) const { return results[index]; }
+
+ private:
+  void beginTiming();
+  void record(bool passed);
+  void finishTiming(Status status);
+
+  Request request = {};
+  unsigned long startMs[TIMINGS] = {};
+  uint8_t observed = 0;
+  Result results[TIMINGS] = {};
+  bool active = false;
+
+  size_t timing = 0;
+  bool extended = false;
+  unsigned long phaseStart = 0;
+  unsigned long dwellMs = 0;  // Retracted time before the next stroke
+  unsigned long candidate = 0;
+  unsigned long passedMs = 0;  // 0 until a candidate passed
+  unsigned long failedMs = 0;
+  unsigned passes = 0;
+};
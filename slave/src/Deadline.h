@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "Hal.h"
+
+// Earliest of several pending deadlines, in microseconds from now. The
+// tickless loops sleep for this long unless something wakes them first.
+class Deadline {
+ public:
+  explicit Deadline(uint32_t maxUs)
+      : wakeUs(maxUs), nowMs(hal::millis()), nowUs(hal::micros()) {}
+
+  void inUs(uint32_t us) {
+    if (us < wakeUs) wakeUs = us;
+  }
+
+  // durationMs after the millis() timestamp startMs; due once passed
+  void afterMs(unsigned long startMs, unsigned long durationMs) {
+    unsigned long elapsedMs = nowMs - startMs;
+    inUs(elapsedMs >= durationMs ? 0 : (durationMs - elapsedMs) * 1000);
+  }
+
+  // At the micros() timestamp atUs; due once passed
+  void atUs(uint32_t atUs) {
+    int32_t leftUs = static_cast<int32_t>(atUs - nowUs);
+    inUs(leftUs > 0 ? leftUs : 0);
+  }
+
+  uint32_t us() const { return wakeUs; }
+
+ private:
+  uint32_t wakeUs;
+  unsigned long nowMs;
+  uint32_t nowUs;
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "Hal.h"
+
+// Integrating debouncer fed with interrupt-timestamped edges instead of
+// polled reads. Time spent at the new level counts up, time back at the
+// confirmed level counts down, and the level is confirmed once confirmUs
+// has accumulated. The crossing time is computed from the timestamps, so
+// confirmation does not depend on how often update() runs.
+class Debouncer {
+ public:
+  void begin(int level, uint32_t nowUs) {
+    stable = raw = level;
+    integralUs = 0;
+    lastUs = nowUs;
+  }
+
+  void setConfirmUs(uint32_t us) { confirmUs = us; }
+  uint32_t getConfirmUs() const { return confirmUs; }
+
+  // Raw edge at edgeUs; edges must arrive in time order. Returns true when
+  // the time up to the edge confirmed a change.
+  bool edge(int level, uint32_t edgeUs) {
+    bool changed = update(edgeUs);
+    if (level != raw && level != stable && integralUs == 0) {
+      startUs = edgeUs;
+    }
+    raw = level;
+    return changed;
+  }
+
+  // Integrates up to nowUs; true when the confirmed level changed
+  bool update(uint32_t nowUs) {
+    // An edge stamped before a resync read adds no time
+    if (static_cast<int32_t>(nowUs - lastUs) < 0) return false;
+    uint32_t elapsedUs = nowUs - lastUs;
+    lastUs = nowUs;
+    if (raw == stable) {
+      integralUs = elapsedUs < integralUs ? integralUs - elapsedUs : 0;
+      return false;
+    }
+    integralUs += elapsedUs;
+    if (integralUs < confirmUs) return false;
+    confirmedAtUs = nowUs - (integralUs - confirmUs);
+    stable = raw;
+    integralUs = 0;
+    return true;
+  }
+
+  // Microseconds until a pending change confirms; UINT32_MAX if none is
+  uint32_t pendingUs(uint32_t nowUs) const {
+    if (raw == stable) return UINT32_MAX;
+    uint32_t integratedUs = integralUs + (nowUs - lastUs);
+    return integratedUs >= confirmUs ? 0 : confirmUs - integratedUs;
+  }
+
+  int read() const { return stable; }
+  // First raw edge of the last confirmed change, and when it was confirmed
+  uint32_t changeStartedUs() const { return startUs; }
+  uint32_t changeConfirmedUs() const { return confirmedAtUs; }
+
+ private:
+  uint32_t confirmUs = 3000;
+  int stable = HIGH;
+  int raw = HIGH;
+  uint32_t integralUs = 0;
+  uint32_t lastUs = 0;
+  uint32_t startUs = 0;
+  uint32_t confirmedAtUs = 0;
+};
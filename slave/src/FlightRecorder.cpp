@@ -0,0 +1,87 @@
+#include "FlightRecorder.h"
+
+#include <atomic>
+
+#include "Hal.h"
+
+namespace flight {
+
+namespace {
+
+struct Retained {
+  uint32_t magic;
+  uint32_t next;  // Sequence number of the next event
+  Event events[FLIGHT_RECORDER_EVENTS];
+};
+static_assert(sizeof(Retained) <= RETAINED_MEMORY_SIZE,
+              "The flight recorder fits the retained memory");
+static_assert((FLIGHT_RECORDER_EVENTS & (FLIGHT_RECORDER_EVENTS - 1)) == 0,
+              "FLIGHT_RECORDER_EVENTS is a power of two");
+
+// "FLT" plus the layout size, so a build with another layout starts over
+constexpr uint32_t MAGIC = 0x464C5400u ^ sizeof(Retained);
+
+Retained* retained = nullptr;
+std::atomic<uint32_t> next{0};
+
+// The run that ended in the reset, copied out before this one records
+Event previous[FLIGHT_RECORDER_EVENTS];
+size_t previousCount = 0;
+
+size_t held(uint32_t written) {
+  return written < FLIGHT_RECORDER_EVENTS ? written : FLIGHT_RECORDER_EVENTS;
+}
+
+}  // namespace
+
+void begin(uint8_t resetReason, uint32_t bootCount) {
+  Retained* memory = static_cast<Retained*>(hal::retainedMemory());
+  previousCount = 0;
+  if (memory->magic == MAGIC) {
+    previousCount = held(memory->next);
+    uint32_t first = memory->next - previousCount;
+    for (size_t i = 0; i < previousCount; i++) {
+      previous[i] = memory->events[(first + i) % FLIGHT_RECORDER_EVENTS];
+    }
+  }
+  memory->magic = MAGIC;
+  memory->next = 0;
+  next.store(0, std::memory_order_relaxed);
+  retained = memory;
+  record(Kind::BOOT, resetReason, 0, bootCount);
+}
+
+void record(Kind kind, uint8_t a, uint16_t b, uint32_t value) {
+  if (!retained) return;
+  uint32_t seq = next.fetch_add(1, std::memory_order_relaxed);
+  Event& event = retained->events[seq % FLIGHT_RECORDER_EVENTS];
+  event.us = hal::micros();
+  event.kind = kind;
+  event.a = a;
+  event.b = b;
+  event.value = value;
+  // Both tasks store here, so a reset mid-record can cost the newest event
+  retained->next = seq + 1;
+}
+
+uint32_t first(Run run) {
+  uint32_t written = end(run);
+  return written - held(written);
+}
+
+uint32_t end(Run run) {
+  if (run == Run::PREVIOUS) return previousCount;
+  return next.load(std::memory_order_relaxed);
+}
+
+bool read(Run run, uint32_t seq, Event& event) {
+  if (seq < first(run) || seq >= end(run)) return false;
+  if (run == Run::PREVIOUS) {
+    event = previous[seq];
+  } else {
+    event = retained->events[seq % FLIGHT_RECORDER_EVENTS];
+  }
+  return true;
+}
+
+}  // namespace flight
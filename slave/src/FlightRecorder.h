@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+// Crash-surviving event ring in hal::retainedMemory(). State transitions,
+// valve edges, applied commands and stalls are recorded as fixed 12-byte
+// events, cheap enough to leave on: an atomic increment, a micros() read
+// and three word stores. A software or watchdog reset keeps the ring; at
+// boot begin() moves it aside as the previous run, so DUMP_TRACE can show
+// the seconds before the fault while the new run records over it.
+//
+// record() may be called from both tasks. Power-on leaves the memory
+// random, which the header's magic catches.
+namespace flight {
+
+enum class Kind : uint8_t {
+  BOOT,     // a reset reason, value boot count
+  STATE,    // a state entered, b state left (RouterState)
+  VALVE,    // a pin, b level
+  COMMAND,  // a CommandEvent::Kind, b eject or setting key, value board
+            // id or setting value
+  STALL,    // a StallMonitor::Task, b activity, value pass us
+  COUNT,
+};
+
+struct Event {
+  uint32_t us;  // micros() when recorded
+  Kind kind;
+  uint8_t a;
+  uint16_t b;
+  uint32_t value;
+};
+
+enum class Run : uint8_t { PREVIOUS, CURRENT };
+
+// Keeps what survived the reset as the previous run, starts the current one
+// with a BOOT event
+void begin(uint8_t resetReason, uint32_t bootCount);
+void record(Kind kind, uint8_t a, uint16_t b = 0, uint32_t value = 0);
+
+// A run's events are sequence numbers [first, end), oldest first. The
+// current run keeps growing and overwrites its oldest; an event still being
+// recorded by the other task may read half written.
+uint32_t first(Run run);
+uint32_t end(Run run);
+bool read(Run run, uint32_t seq, Event& event);
+
+}  // namespace flight
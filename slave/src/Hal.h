@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hardware abstraction used by the controllers. HalEsp32.cpp implements it
+// on the board; slave/sim/HalSim.cpp implements it against a virtual clock
+// for the native simulation build.
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#define LOW 0x0
+#define HIGH 0x1
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#endif
+
+namespace hal {
+
+// Time
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+// GPIO
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+void disableInterrupts();
+void enableInterrupts();
+
+// Input edges. An interrupt stamps every level change on an attached pin
+// with micros() and queues it for the control task, so inputs are never
+// polled and no edge is lost between loop passes.
+struct InputEdge {
+  uint8_t pin;
+  uint8_t level;
+  uint32_t us;
+};
+void attachEdgeCapture(uint8_t pin);
+// Oldest queued edge; false when none is waiting
+bool takeInputEdge(InputEdge& edge);
+// Edges lost because the queue was full
+unsigned long inputEdgeDrops();
+
+// Task wake-ups for the tickless loops. A task binds itself to a target,
+// then sleeps in waitForWake() until its timeout passes or wake() is called
+// for it. Sensor and strobe interrupts wake CONTROL; received bytes wake
+// COMMS.
+enum class WakeTarget : uint8_t { CONTROL, COMMS, COUNT };
+void bindWakeTarget(WakeTarget target);
+void wake(WakeTarget target);
+// Returns the micros() at which the wake-up was due: when the first wake()
+// arrived, or the deadline on timeout
+uint32_t waitForWake(WakeTarget target, uint32_t timeoutUs);
+
+// Camera strobe. A hardware timer raises pin delayUs from now and drops it
+// widthUs later, independent of how late loop() runs. Scheduling again
+// replaces a pending strobe.
+void scheduleStrobe(uint8_t pin, uint32_t delayUs, uint32_t widthUs);
+void cancelStrobe();
+// micros() of the last rising edge; true once per edge
+bool takeStrobeEdge(uint32_t& edgeUs);
+
+// UART to the master
+void serialBegin(unsigned long baud, size_t txBufferSize);
+void serialEnd();
+bool serialConnected();
+// Bytes the TX driver accepts right now without blocking
+size_t serialWritable();
+// Blocks until every byte has been handed to the driver
+size_t serialWrite(const uint8_t* data, size_t length);
+// Next received byte, or -1 if none is waiting
+int serialRead();
+
+// System
+// CPU cycle counter for the profiler; wraps, so only differences count
+uint32_t cycleCount();
+uint32_t cyclesPerUs();
+uint32_t freeHeap();
+uint32_t maxAllocHeap();
+int resetReason();
+// Increments the persisted boot counter and returns the new value
+uint8_t incrementBootCount();
+// RETAINED_MEMORY_SIZE bytes that survive software and watchdog resets (RTC
+// slow memory), word aligned. Random after power-on, so check what is there.
+void* retainedMemory();
+// Stroke timings (ms) saved by calibration; false if none have been saved
+bool loadTimings(uint32_t* timingsMs, size_t count);
+void saveTimings(const uint32_t* timingsMs, size_t count);
+
+}  // namespace hal
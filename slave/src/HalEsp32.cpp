@@ -0,0 +1,252 @@
+#include "Hal.h"
+
+#include <EEPROM.h>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <soc/gpio_struct.h>
+
+#include "SpscQueue.h"
+#include "config.h"
+
+// EEPROM layout: boot count, then [magic u32][timing u32 ...] from the
+// last persisted calibration
+#define EEPROM_SIZE 64
+#define BOOT_COUNT_ADDR 0
+#define TIMINGS_ADDR 4
+#define TIMINGS_MAGIC 0x54494D31  // "TIM1"
+#define STROBE_TIMER 0
+#define STROBE_TIMER_DIVIDER 80  // 80 MHz APB clock -> 1 us ticks
+
+static_assert(CAMERA_TRIGGER_PIN < 32,
+              "The strobe ISR writes GPIO.out_w1ts/out_w1tc directly");
+static_assert(SENSOR1_PIN < 32 && PUSH_STROKE_PIN < 32 &&
+                  RISER_STROKE_PIN < 32 && EJECTION_STROKE_PIN < 32,
+              "The edge ISR reads GPIO.in directly");
+
+namespace {
+
+// The notification value carries the micros() the wake-up was due at;
+// eSetValueWithoutOverwrite keeps the first one until the task runs
+struct Waker {
+  TaskHandle_t task = nullptr;
+  esp_timer_handle_t timer = nullptr;
+  uint32_t deadlineUs = 0;
+};
+Waker wakers[static_cast<size_t>(hal::WakeTarget::COUNT)];
+
+void IRAM_ATTR wakeFromIsr(hal::WakeTarget target, uint32_t us) {
+  TaskHandle_t task = wakers[static_cast<size_t>(target)].task;
+  if (!task) return;
+  BaseType_t woken = pdFALSE;
+  xTaskNotifyFromISR(task, us, eSetValueWithoutOverwrite, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+void onWakeTimer(void* arg) {
+  Waker* waker = static_cast<Waker*>(arg);
+  xTaskNotify(waker->task, waker->deadlineUs, eSetValueWithoutOverwrite);
+}
+
+hw_timer_t* strobeTimer = nullptr;
+portMUX_TYPE strobeMux = portMUX_INITIALIZER_UNLOCKED;
+volatile uint32_t strobeMask = 0;
+volatile uint32_t strobeWidthUs = 0;
+volatile bool strobeHigh = false;
+volatile bool strobeEdgeReady = false;
+volatile uint32_t strobeEdgeUs = 0;
+
+// Runs twice per strobe: once for the rising edge, once to end the pulse
+void IRAM_ATTR onStrobeTimer() {
+  bool rising = false;
+  portENTER_CRITICAL_ISR(&strobeMux);
+  if (!strobeHigh) {
+    GPIO.out_w1ts = strobeMask;
+    strobeEdgeUs = static_cast<uint32_t>(esp_timer_get_time());
+    strobeEdgeReady = true;
+    strobeHigh = true;
+    rising = true;
+    timerAlarmWrite(strobeTimer, timerRead(strobeTimer) + strobeWidthUs,
+                    false);
+    timerAlarmEnable(strobeTimer);
+  } else {
+    GPIO.out_w1tc = strobeMask;
+    strobeHigh = false;
+  }
+  portEXIT_CRITICAL_ISR(&strobeMux);
+  if (rising) wakeFromIsr(hal::WakeTarget::CONTROL, strobeEdgeUs);
+}
+
+// Filled by the GPIO ISR, drained by the control task
+SpscQueue<hal::InputEdge, INPUT_EDGE_QUEUE_DEPTH> inputEdges;
+
+void IRAM_ATTR onInputEdge(void* arg) {
+  uint8_t pin = static_cast<uint8_t>(reinterpret_cast<uintptr_t>(arg));
+  hal::InputEdge edge;
+  edge.us = static_cast<uint32_t>(esp_timer_get_time());
+  edge.pin = pin;
+  edge.level = (GPIO.in >> pin) & 1;
+  inputEdges.push(edge);
+  wakeFromIsr(hal::WakeTarget::CONTROL, edge.us);
+}
+
+}  // namespace
+
+namespace hal {
+
+uint32_t millis() { return ::millis(); }
+uint32_t micros() { return ::micros(); }
+void delay(uint32_t ms) { ::delay(ms); }
+void delayMicroseconds(uint32_t us) { ::delayMicroseconds(us); }
+
+void pinMode(uint8_t pin, uint8_t mode) { ::pinMode(pin, mode); }
+void digitalWrite(uint8_t pin, uint8_t level) { ::digitalWrite(pin, level); }
+int digitalRead(uint8_t pin) { return ::digitalRead(pin); }
+void disableInterrupts() { noInterrupts(); }
+void enableInterrupts() { interrupts(); }
+
+void bindWakeTarget(WakeTarget target) {
+  Waker& waker = wakers[static_cast<size_t>(target)];
+  esp_timer_create_args_t args = {};
+  args.callback = &onWakeTimer;
+  args.arg = &waker;
+  args.name = "wake";
+  esp_timer_create(&args, &waker.timer);
+  waker.task = xTaskGetCurrentTaskHandle();
+}
+
+void wake(WakeTarget target) {
+  TaskHandle_t task = wakers[static_cast<size_t>(target)].task;
+  if (task) {
+    xTaskNotify(task, static_cast<uint32_t>(esp_timer_get_time()),
+                eSetValueWithoutOverwrite);
+  }
+}
+
+// A one-shot esp_timer ends the sleep, so deadlines are not rounded up to
+// the next FreeRTOS tick
+uint32_t waitForWake(WakeTarget target, uint32_t timeoutUs) {
+  Waker& waker = wakers[static_cast<size_t>(target)];
+  uint32_t dueUs;
+  if (timeoutUs == 0) {
+    // Work is already pending; just consume a notification that raced it
+    return xTaskNotifyWait(0, 0, &dueUs, 0) == pdTRUE ? dueUs : ::micros();
+  }
+  waker.deadlineUs = ::micros() + timeoutUs;
+  esp_timer_start_once(waker.timer, timeoutUs);
+  xTaskNotifyWait(0, 0, &dueUs, portMAX_DELAY);
+  esp_timer_stop(waker.timer);
+  // The timer may have fired after an early wake; its notification would
+  // end the next sleep at once. The caller polls for work on return, so a
+  // wake() cleared here with it is not lost.
+  xTaskNotifyStateClear(nullptr);
+  return dueUs;
+}
+
+// The ISR is installed on the calling core, so attach from the core the
+// control task runs on
+void attachEdgeCapture(uint8_t pin) {
+  attachInterruptArg(digitalPinToInterrupt(pin), onInputEdge,
+                     reinterpret_cast<void*>(static_cast<uintptr_t>(pin)),
+                     CHANGE);
+}
+
+bool takeInputEdge(InputEdge& edge) { return inputEdges.pop(edge); }
+unsigned long inputEdgeDrops() { return inputEdges.getDrops(); }
+
+void scheduleStrobe(uint8_t pin, uint32_t delayUs, uint32_t widthUs) {
+  if (!strobeTimer) {
+    strobeTimer = timerBegin(STROBE_TIMER, STROBE_TIMER_DIVIDER, true);
+    timerAttachInterrupt(strobeTimer, &onStrobeTimer, true);
+  }
+  cancelStrobe();
+  portENTER_CRITICAL(&strobeMux);
+  strobeMask = 1UL << pin;
+  strobeWidthUs = widthUs;
+  timerWrite(strobeTimer, 0);
+  // An alarm at the count just reset to never fires
+  timerAlarmWrite(strobeTimer, delayUs ? delayUs : 1, false);
+  timerAlarmEnable(strobeTimer);
+  portEXIT_CRITICAL(&strobeMux);
+}
+
+void cancelStrobe() {
+  if (!strobeTimer) return;
+  portENTER_CRITICAL(&strobeMux);
+  timerAlarmDisable(strobeTimer);
+  GPIO.out_w1tc = strobeMask;
+  strobeHigh = false;
+  portEXIT_CRITICAL(&strobeMux);
+}
+
+bool takeStrobeEdge(uint32_t& edgeUs) {
+  portENTER_CRITICAL(&strobeMux);
+  bool ready = strobeEdgeReady;
+  edgeUs = strobeEdgeUs;
+  strobeEdgeReady = false;
+  portEXIT_CRITICAL(&strobeMux);
+  return ready;
+}
+
+void serialBegin(unsigned long baud, size_t txBufferSize) {
+  // The driver only allocates its TX ring (and uses the TX interrupt to
+  // drain it) if the size is set before begin()
+  Serial.setTxBufferSize(txBufferSize);
+  Serial.begin(baud);
+  Serial.onReceive([]() { wake(WakeTarget::COMMS); });
+}
+
+void serialEnd() { Serial.end(); }
+bool serialConnected() { return static_cast<bool>(Serial); }
+size_t serialWritable() { return Serial.availableForWrite(); }
+
+size_t serialWrite(const uint8_t* data, size_t length) {
+  return Serial.write(data, length);
+}
+
+int serialRead() { return Serial.available() > 0 ? Serial.read() : -1; }
+
+uint32_t cycleCount() { return ESP.getCycleCount(); }
+uint32_t cyclesPerUs() { return ESP.getCpuFreqMHz(); }
+uint32_t freeHeap() { return ESP.getFreeHeap(); }
+uint32_t maxAllocHeap() { return ESP.getMaxAllocHeap(); }
+int resetReason() { return esp_reset_reason(); }
+
+uint8_t incrementBootCount() {
+  EEPROM.begin(EEPROM_SIZE);
+  uint8_t bootCount = EEPROM.read(BOOT_COUNT_ADDR) + 1;
+  EEPROM.write(BOOT_COUNT_ADDR, bootCount);
+  EEPROM.commit();
+  return bootCount;
+}
+
+void* retainedMemory() {
+  static RTC_NOINIT_ATTR uint32_t memory[RETAINED_MEMORY_SIZE / 4];
+  return memory;
+}
+
+bool loadTimings(uint32_t* timingsMs, size_t count) {
+  if (TIMINGS_ADDR + (count + 1) * sizeof(uint32_t) > EEPROM_SIZE) {
+    return false;
+  }
+  EEPROM.begin(EEPROM_SIZE);
+  uint32_t magic;
+  EEPROM.get(TIMINGS_ADDR, magic);
+  if (magic != TIMINGS_MAGIC) return false;
+  for (size_t i = 0; i < count; i++) {
+    EEPROM.get(TIMINGS_ADDR + (i + 1) * sizeof(uint32_t), timingsMs[i]);
+  }
+  return true;
+}
+
+void saveTimings(const uint32_t* timingsMs, size_t count) {
+  if (TIMINGS_ADDR + (count + 1) * sizeof(uint32_t) > EEPROM_SIZE) return;
+  EEPROM.begin(EEPROM_SIZE);
+  EEPROM.put(TIMINGS_ADDR, static_cast<uint32_t>(TIMINGS_MAGIC));
+  for (size_t i = 0; i < count; i++) {
+    EEPROM.put(TIMINGS_ADDR + (i + 1) * sizeof(uint32_t), timingsMs[i]);
+  }
+  EEPROM.commit();
+}
+
+}  // namespace hal
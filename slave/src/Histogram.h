@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// Latency distribution in log-linear microsecond buckets, HDR style: values
+// below SUB_BUCKETS are exact, and each power of two above is split into
+// SUB_BUCKETS equal buckets, so a bucket is never wider than a quarter of
+// its lower bound. Memory is fixed. One task records and resets; any task
+// may read.
+class Histogram {
+ public:
+  static constexpr size_t SUB_BITS = 2;
+  static constexpr size_t SUB_BUCKETS = 1 << SUB_BITS;
+  static constexpr size_t BUCKETS = (32 - SUB_BITS + 1) * SUB_BUCKETS;
+
+  static size_t bucketOf(uint32_t us) {
+    if (us < SUB_BUCKETS) return us;
+    size_t shift = 31 - __builtin_clz(us) - SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS + ((us >> shift) & (SUB_BUCKETS - 1));
+  }
+
+  // Largest value that lands in the bucket
+  static uint32_t bucketUpperUs(size_t bucket) {
+    if (bucket < SUB_BUCKETS) return bucket;
+    size_t shift = bucket / SUB_BUCKETS - 1;
+    uint64_t sub = bucket % SUB_BUCKETS;
+    return static_cast<uint32_t>(((SUB_BUCKETS + sub + 1) << shift) - 1);
+  }
+
+  void record(uint32_t us) {
+    counts[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+    samples.fetch_add(1, std::memory_order_relaxed);
+    if (us > maxUs.load(std::memory_order_relaxed)) {
+      maxUs.store(us, std::memory_order_relaxed);
+    }
+  }
+
+  void reset() {
+    for (std::atomic<uint32_t>& count : counts) {
+      count.store(0, std::memory_order_relaxed);
+    }
+    samples.store(0, std::memory_order_relaxed);
+    maxUs.store(0, std::memory_order_relaxed);
+  }
+
+  uint32_t getCount(size_t bucket) const {
+    return counts[bucket].load(std::memory_order_relaxed);
+  }
+  uint32_t getSamples() const {
+    return samples.load(std::memory_order_relaxed);
+  }
+  uint32_t getMaxUs() const { return maxUs.load(std::memory_order_relaxed); }
+
+  // Upper bound of the bucket holding the given percentile, never above the
+  // largest sample; 0 if empty
+  uint32_t percentileUs(uint32_t percent) const {
+    return quantileUs(percent, 100);
+  }
+  uint32_t perMilleUs(uint32_t perMille) const {
+    return quantileUs(perMille, 1000);
+  }
+
+ private:
+  uint32_t quantileUs(uint32_t parts, uint32_t whole) const {
+    uint32_t total = getSamples();
+    if (total == 0) return 0;
+    uint64_t wanted = (uint64_t(total) * parts + whole - 1) / whole;
+    uint64_t seen = 0;
+    uint32_t max = getMaxUs();
+    for (size_t i = 0; i < BUCKETS; i++) {
+      seen += getCount(i);
+      if (seen >= wanted) {
+        uint32_t upper = bucketUpperUs(i);
+        return upper < max ? upper : max;
+      }
+    }
+    return max;
+  }
+
+  std::atomic<uint32_t> counts[BUCKETS] = {};
+  std::atomic<uint32_t> samples{0};
+  std::atomic<uint32_t> maxUs{0};
+};
@@ -0,0 +1,83 @@
+#include "Profiler.h"
+
+#ifdef PROFILER_ENABLED
+
+#include <string.h>
+
+#include <atomic>
+
+namespace profiler {
+
+namespace {
+
+Site sites[MAX_SITES];
+std::atomic<size_t> reserved{0};
+std::atomic<size_t> registered{0};  // Named sites, published in slot order
+
+size_t bucketOf(uint32_t cycles) {
+  size_t bucket = 0;
+  while (bucket < BUCKETS - 1 &&
+         (cycles >> (bucket + FIRST_BUCKET_BITS + 1)) != 0) {
+    bucket++;
+  }
+  return bucket;
+}
+
+}  // namespace
+
+// Sites register on their first call, from function-local statics. The
+// count goes up only once the name is written; a slot reserved earlier by
+// the task on the other core is published first.
+Site* registerSite(const char* name) {
+  size_t index = reserved.fetch_add(1, std::memory_order_relaxed);
+  if (index >= MAX_SITES) return nullptr;
+  sites[index].name = name;
+  size_t expected = index;
+  while (!registered.compare_exchange_weak(expected, index + 1,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+    expected = index;
+  }
+  return &sites[index];
+}
+
+void record(Site* site, uint32_t cycles) {
+  site->calls++;
+  site->totalCycles += cycles;
+  if (cycles > site->maxCycles) site->maxCycles = cycles;
+  site->buckets[bucketOf(cycles)]++;
+}
+
+size_t siteCount() {
+  return registered.load(std::memory_order_acquire);
+}
+
+const Site& site(size_t index) { return sites[index]; }
+
+uint32_t percentileCycles(const Site& site, uint32_t percent) {
+  if (site.calls == 0) return 0;
+  uint64_t wanted = (uint64_t(site.calls) * percent + 99) / 100;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < BUCKETS - 1; i++) {
+    seen += site.buckets[i];
+    if (seen >= wanted) {
+      uint32_t upper = (2UL << (i + FIRST_BUCKET_BITS)) - 1;
+      return upper < site.maxCycles ? upper : site.maxCycles;
+    }
+  }
+  return site.maxCycles;
+}
+
+void reset() {
+  for (size_t i = 0; i < siteCount(); i++) {
+    Site& site = sites[i];
+    site.calls = 0;
+    site.totalCycles = 0;
+    site.maxCycles = 0;
+    memset(site.buckets, 0, sizeof(site.buckets));
+  }
+}
+
+}  // namespace profiler
+
+#endif
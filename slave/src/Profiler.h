@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Hal.h"
+
+// Scoped CPU cycle profiler for hot paths. PROFILE_SCOPE("name") at the top
+// of a block times the rest of the block with hal::cycleCount() and adds it
+// to a site in a fixed registry: call count, total, max and power-of-two
+// buckets. Each site is recorded by the task that runs it; PROFILE reads
+// them from the comms task.
+//
+// Only built with -D PROFILER_ENABLED (pio run -e esp32_profile); otherwise
+// every scope compiles to nothing.
+namespace profiler {
+
+constexpr size_t MAX_SITES = 16;
+// Bucket i holds [2^(i + 4), 2^(i + 5)) cycles; the first and last also
+// take everything below and above
+constexpr size_t BUCKETS = 20;
+constexpr size_t FIRST_BUCKET_BITS = 4;
+
+struct Site {
+  const char* name;
+  uint32_t calls;
+  uint64_t totalCycles;
+  uint32_t maxCycles;
+  uint32_t buckets[BUCKETS];
+};
+
+#ifdef PROFILER_ENABLED
+
+// nullptr once MAX_SITES sites are registered; that scope then does nothing
+Site* registerSite(const char* name);
+void record(Site* site, uint32_t cycles);
+size_t siteCount();
+const Site& site(size_t index);
+// Upper bound of the bucket holding the percentile, capped at the max
+uint32_t percentileCycles(const Site& site, uint32_t percent);
+// Run by the control task; samples in flight on the comms task may land
+// either side of the reset
+void reset();
+
+class Scope {
+ public:
+  explicit Scope(Site* site) : site(site), startCycles(hal::cycleCount()) {}
+  ~Scope() {
+    if (site) record(site, hal::cycleCount() - startCycles);
+  }
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+
+ private:
+  Site* site;
+  uint32_t startCycles;
+};
+
+#endif
+
+}  // namespace profiler
+
+#ifdef PROFILER_ENABLED
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name)                                            \
+  static profiler::Site* const PROFILE_CONCAT(profileSite_, __LINE__) = \
+      profiler::registerSite(name);                                    \
+  profiler::Scope PROFILE_CONCAT(profileScope_, __LINE__)(             \
+      PROFILE_CONCAT(profileSite_, __LINE__))
+#else
+#define PROFILE_SCOPE(name) static_cast<void>(0)
+#endif
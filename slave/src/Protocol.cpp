@@ -0,0 +1,98 @@
+#include "Protocol.h"
+
+namespace protocol {
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+uint16_t crc16(const uint8_t* data, size_t length) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= uint16_t(data[i]) << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+size_t cobsEncode(const uint8_t* in, size_t length, uint8_t* out) {
+  size_t codeIndex = 0;
+  size_t outIndex = 1;
+  uint8_t code = 1;
+
+  for (size_t i = 0; i < length; i++) {
+    if (in[i] == 0) {
+      out[codeIndex] = code;
+      codeIndex = outIndex++;
+      code = 1;
+      continue;
+    }
+    out[outIndex++] = in[i];
+    if (++code == 0xFF) {
+      out[codeIndex] = code;
+      codeIndex = outIndex++;
+      code = 1;
+    }
+  }
+  out[codeIndex] = code;
+  return outIndex;
+}
+
+size_t cobsDecode(const uint8_t* in, size_t length, uint8_t* out) {
+  size_t inIndex = 0;
+  size_t outIndex = 0;
+
+  while (inIndex < length) {
+    uint8_t code = in[inIndex++];
+    if (code == 0 || inIndex + code - 1 > length) {
+      return 0;
+    }
+    for (uint8_t i = 1; i < code; i++) {
+      out[outIndex++] = in[inIndex++];
+    }
+    if (code != 0xFF && inIndex < length) {
+      out[outIndex++] = 0;
+    }
+  }
+  return outIndex;
+}
+
+size_t encodeFrame(MessageType type, uint8_t seq, const uint8_t* payload,
+                   size_t length, uint8_t* out) {
+  if (length > MAX_PAYLOAD) {
+    return 0;
+  }
+
+  uint8_t raw[MAX_FRAME];
+  raw[0] = static_cast<uint8_t>(type);
+  raw[1] = seq;
+  for (size_t i = 0; i < length; i++) raw[2 + i] = payload[i];
+  uint16_t crc = crc16(raw, length + 2);
+  raw[length + 2] = uint8_t(crc);
+  raw[length + 3] = uint8_t(crc >> 8);
+
+  out[0] = FRAME_DELIMITER;
+  size_t encoded = cobsEncode(raw, length + 4, out + 1);
+  out[encoded + 1] = FRAME_DELIMITER;
+  return encoded + 2;
+}
+
+bool decodeFrame(uint8_t* buf, size_t length, Frame& frame) {
+  size_t decoded = cobsDecode(buf, length, buf);
+  if (decoded < 4) {
+    return false;
+  }
+
+  uint16_t expected = uint16_t(buf[decoded - 2]) | uint16_t(buf[decoded - 1])
+                                                       << 8;
+  if (crc16(buf, decoded - 2) != expected) {
+    return false;
+  }
+
+  frame.type = static_cast<MessageType>(buf[0]);
+  frame.seq = buf[1];
+  frame.payload = buf + 2;
+  frame.length = decoded - 4;
+  return true;
+}
+
+}  // namespace protocol
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary framing used once the master negotiates "PROTOCOL BINARY".
+//
+// Frame before encoding: [type][seq][payload...][crc16 lo][crc16 hi]
+// On the wire the frame is COBS encoded and wrapped in 0x00 delimiters, so
+// binary frames can be interleaved with the plain-text DEBUG/WARNING lines
+// (text never contains 0x00). All multi-byte fields are little-endian.
+namespace protocol {
+
+enum class MessageType : uint8_t {
+  STATE = 0x01,
+  HEARTBEAT = 0x02,
+  SETTINGS = 0x03,
+  ANALYSIS_START = 0x04,
+  ANALYSIS_RESULT = 0x05,
+  NON_ANALYSIS_CYCLE = 0x06,
+  ANALYSIS_ARM = 0x07,
+  CAPTURE_EDGE = 0x08,
+  CALIBRATE = 0x09,    // Master -> slave
+  CALIBRATION = 0x0A,  // Slave -> master, the outcome of a CALIBRATE
+  HIST = 0x0B,         // Master -> slave
+  HISTOGRAM = 0x0C,    // Slave -> master, one per histogram for a HIST
+  STALL = 0x0D,        // Slave -> master, a pass over STALL_THRESHOLD_US
+  TRACE = 0x0E,        // Slave -> master, a DEBUG trace record (Trace.h)
+  FLIGHT = 0x0F,       // Slave -> master, a flight recorder event
+};
+
+// SETTINGS payload is a list of [key:u8][value:u32] pairs so new settings can
+// be added without breaking older masters.
+enum class SettingKey : uint8_t {
+  PUSH_TIME = 0x01,
+  RISER_TIME = 0x02,
+  EJECTION_TIME = 0x03,
+  ANALYSIS_MODE = 0x04,
+  PIPELINED = 0x05,
+  CAPTURE_TIME = 0x06,
+  TRIGGER_LEAD = 0x07,
+  STAGGER_SOLENOIDS = 0x08,
+  SENSOR_CONFIRM_US = 0x09,
+  RISER_OVERLAP = 0x0A,
+  EJECT_OVERLAP = 0x0B,
+  CONTINUOUS_FEED = 0x0C,
+  STROKE_SENSORS = 0x0D,
+  LOG_LEVEL = 0x0E,  // Highest SerialOutput::Priority traced
+  ANALYSIS_TIMEOUT = 0x0F,
+};
+
+// STATE payload flag bits
+constexpr uint8_t STATE_FLAG_PUSH = 0x01;
+constexpr uint8_t STATE_FLAG_RISER = 0x02;
+constexpr uint8_t STATE_FLAG_EJECTION = 0x04;
+constexpr uint8_t STATE_FLAG_SENSOR1 = 0x08;
+
+constexpr uint8_t FRAME_DELIMITER = 0x00;
+constexpr size_t MAX_PAYLOAD = 128;
+// The largest payload; a field added to the heartbeat must grow this too
+constexpr size_t HEARTBEAT_PAYLOAD = 118;
+static_assert(HEARTBEAT_PAYLOAD <= MAX_PAYLOAD,
+              "HEARTBEAT no longer fits in MAX_PAYLOAD");
+constexpr size_t MAX_FRAME = MAX_PAYLOAD + 4;  // type + seq + crc16
+// COBS adds one byte per 254, plus the leading code byte and two delimiters
+constexpr size_t MAX_ENCODED = MAX_FRAME + MAX_FRAME / 254 + 1 + 2;
+
+uint16_t crc16(const uint8_t* data, size_t length);
+
+size_t cobsEncode(const uint8_t* in, size_t length, uint8_t* out);
+// Safe to call with in == out. Returns 0 for malformed input.
+size_t cobsDecode(const uint8_t* in, size_t length, uint8_t* out);
+
+// Writes a complete delimited frame into out (MAX_ENCODED bytes).
+// Returns the number of bytes written, or 0 if the payload is too large.
+size_t encodeFrame(MessageType type, uint8_t seq, const uint8_t* payload,
+                   size_t length, uint8_t* out);
+
+struct Frame {
+  MessageType type;
+  uint8_t seq;
+  const uint8_t* payload;
+  size_t length;
+};
+
+// Decodes one COBS block (delimiters already stripped) in place and checks
+// its CRC. The returned payload points into buf.
+bool decodeFrame(uint8_t* buf, size_t length, Frame& frame);
+
+class PayloadWriter {
+ public:
+  PayloadWriter() : length(0), overflow(false) {}
+
+  void u8(uint8_t value) { put(&value, 1); }
+  void u16(uint16_t value) {
+    uint8_t bytes[2] = {uint8_t(value), uint8_t(value >> 8)};
+    put(bytes, 2);
+  }
+  void u32(uint32_t value) {
+    uint8_t bytes[4] = {uint8_t(value), uint8_t(value >> 8),
+                        uint8_t(value >> 16), uint8_t(value >> 24)};
+    put(bytes, 4);
+  }
+
+  const uint8_t* data() const { return buffer; }
+  size_t size() const { return length; }
+  bool overflowed() const { return overflow; }
+
+ private:
+  void put(const uint8_t* bytes, size_t count) {
+    if (length + count > MAX_PAYLOAD) {
+      overflow = true;
+      return;
+    }
+    for (size_t i = 0; i < count; i++) buffer[length++] = bytes[i];
+  }
+
+  uint8_t buffer[MAX_PAYLOAD];
+  size_t length;
+  bool overflow;
+};
+
+class PayloadReader {
+ public:
+  PayloadReader(const uint8_t* data, size_t length)
+      : data(data), length(length), offset(0) {}
+
+  bool u8(uint8_t& value) {
+    if (remaining() < 1) return false;
+    value = data[offset++];
+    return true;
+  }
+  bool u16(uint16_t& value) {
+    if (remaining() < 2) return false;
+    value = uint16_t(data[offset]) | uint16_t(data[offset + 1]) << 8;
+    offset += 2;
+    return true;
+  }
+  bool u32(uint32_t& value) {
+    if (remaining() < 4) return false;
+    value = uint32_t(data[offset]) | uint32_t(data[offset + 1]) << 8 |
+            uint32_t(data[offset + 2]) << 16 |
+            uint32_t(data[offset + 3]) << 24;
+    offset += 4;
+    return true;
+  }
+
+  size_t remaining() const { return length - offset; }
+
+ private:
+  const uint8_t* data;
+  size_t length;
+  size_t offset;
+};
+
+}  // namespace protocol
@@ -1,6 +1,23 @@
 #include "RouterController.h"
 
-#include <Bounce2.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Deadline.h"
+#include "FlightRecorder.h"
+#include "Profiler.h"
+
+namespace {
+
+constexpr uint8_t STROKE_PINS[STROKE_COUNT] = {
+    PUSH_STROKE_PIN, RISER_STROKE_PIN, EJECTION_STROKE_PIN};
+constexpr uint8_t VALVE_PINS[STROKE_COUNT] = {
+    PUSH_CYLINDER_PIN, RISER_CYLINDER_PIN, EJECTION_CYLINDER_PIN};
+constexpr const char* STROKE_NAMES[STROKE_COUNT] = {"Push", "Riser",
+                                                     "Ejection"};
+
+}  // namespace
 
 RouterController::RouterController()
     : currentState(RouterState::IDLE),
@@ -10,293 +27,976 @@ RouterController::RouterController()
       riserTime(DEFAULT_RISER_TIME),
       ejectionTime(DEFAULT_EJECTION_TIME),
       analysisMode(true),
-      analysisComplete(false),
-      shouldEject(false),
+      pipelined(false),
+      requestedPipelined(false),
+      captureTime(DEFAULT_CAPTURE_TIME),
+      triggerLead(DEFAULT_TRIGGER_LEAD),
+      staggerSolenoids(DEFAULT_STAGGER_SOLENOIDS),
+      riserOverlap(DEFAULT_RISER_OVERLAP),
+      ejectOverlap(DEFAULT_EJECT_OVERLAP),
+      continuousFeed(DEFAULT_CONTINUOUS_FEED),
+      analysisTimeout(DEFAULT_ANALYSIS_TIMEOUT),
       pushCylinderState(false),
       riserCylinderState(false),
       ejectionCylinderState(false) {}
 
 void RouterController::setup() {
-  pinMode(PUSH_CYLINDER_PIN, OUTPUT);
-  pinMode(RISER_CYLINDER_PIN, OUTPUT);
-  pinMode(EJECTION_CYLINDER_PIN, OUTPUT);
-  pinMode(SENSOR1_PIN, INPUT);
+  hal::pinMode(PUSH_CYLINDER_PIN, OUTPUT);
+  hal::pinMode(RISER_CYLINDER_PIN, OUTPUT);
+  hal::pinMode(EJECTION_CYLINDER_PIN, OUTPUT);
+  hal::pinMode(SENSOR1_PIN, INPUT);
+  hal::pinMode(CAMERA_TRIGGER_PIN, OUTPUT);
+
+  hal::digitalWrite(PUSH_CYLINDER_PIN, LOW);
+  hal::digitalWrite(RISER_CYLINDER_PIN, LOW);
+  hal::digitalWrite(EJECTION_CYLINDER_PIN, LOW);
+  hal::digitalWrite(CAMERA_TRIGGER_PIN, LOW);
+
+  sensor1Debouncer.setConfirmUs(DEFAULT_SENSOR_CONFIRM_US);
+  sensor1Debouncer.begin(hal::digitalRead(SENSOR1_PIN), hal::micros());
+  hal::attachEdgeCapture(SENSOR1_PIN);
+  setStrokeSensors(DEFAULT_STROKE_SENSORS);
+
+  // Timings from the last persisted calibration; SETTINGS still override
+  uint32_t saved[STROKE_COUNT];
+  if (hal::loadTimings(saved, STROKE_COUNT)) {
+    pushTime = saved[0];
+    riserTime = saved[1];
+    ejectionTime = saved[2];
+    TRACE_TO(emitTrace, SerialOutput::DEBUG,
+             "DEBUG: Calibrated timings: push %lu, riser %lu, "
+             "ejection %lu ms\r\n",
+             pushTime, riserTime, ejectionTime);
+  }
+  setupTime = hal::millis();
+  lastDispatchTime = setupTime;
+  dwellStartUs = hal::micros();
+}
+
+using R = RouterController;
+using S = RouterState;
+
+// The whole cycle. Rows of a state are tried in order and the first one
+// that is due fires; dispatch runs to completion, so WAITING_FOR_ANALYSIS
+// is left in the same pass when the ejector already has its answer.
+constexpr R::Machine::Transition R::TRANSITIONS[] = {
+    // from, guard, action, timeout, to
+    {S::IDLE, Machine::when<&R::isSensor1Active>,
+     Machine::run<&R::beginCycle>, Machine::after<&R::powerSettleMs>,
+     S::WAITING_FOR_PUSH},
+    {S::WAITING_FOR_PUSH, nullptr, Machine::run<&R::pushBoard>,
+     Machine::afterMs<SENSOR_DELAY_TIME>, S::PUSHING},
+    // Internal: overlap the riser stroke with the end of the push
+    {S::PUSHING, Machine::when<&R::canRaiseEarly>, Machine::run<&R::startRiser>,
+     Machine::after<&R::raiseEarlyMs>, S::PUSHING},
+    {S::PUSHING, Machine::when<&R::boardClearForAnalysis>,
+     Machine::run<&R::raiseBoard>, Machine::after<&R::pushPhaseMs>,
+     S::RAISING},
+    // Nothing in flight: no verdict to wait for, straight down
+    {S::PUSHING, Machine::when<&R::boardClearNoneInFlight>,
+     Machine::run<&R::skipAnalysis>, Machine::after<&R::pushPhaseMs>,
+     S::LOWERING},
+    {S::PUSHING, Machine::when<&R::boardClear>,
+     Machine::run<&R::skipAnalysis>, Machine::after<&R::pushPhaseMs>,
+     S::WAITING_FOR_ANALYSIS},
+    // Internal: arm the camera triggerLead before the riser settles
+    {S::RAISING, Machine::when<&R::canArm>, Machine::run<&R::armAnalysis>,
+     Machine::after<&R::armMs>, S::RAISING},
+    // Internal: fire the downstream ejector before the riser settles
+    {S::RAISING, Machine::when<&R::canEjectEarly>, Machine::run<&R::ejectBoard>,
+     Machine::after<&R::ejectEarlyMs>, S::RAISING},
+    {S::RAISING, Machine::when<&R::isPipelinedCycle>,
+     Machine::run<&R::startAnalysis>, Machine::after<&R::riserSettleMs>,
+     S::CAPTURING},
+    {S::RAISING, nullptr, Machine::run<&R::startAnalysis>,
+     Machine::after<&R::riserSettleMs>, S::WAITING_FOR_ANALYSIS},
+    {S::CAPTURING, Machine::when<&R::canEjectEarly>,
+     Machine::run<&R::ejectBoard>, nullptr, S::CAPTURING},
+    {S::CAPTURING, nullptr, Machine::run<&R::releaseBoard>,
+     Machine::after<&R::captureHoldMs>, S::WAITING_FOR_ANALYSIS},
+    // An early ejection finishes its stroke before the riser lowers
+    {S::WAITING_FOR_ANALYSIS, Machine::when<&R::ejectorBusy>, nullptr,
+     nullptr, S::EJECTING},
+    {S::WAITING_FOR_ANALYSIS, Machine::when<&R::ejectorFree>,
+     Machine::run<&R::lowerRiser>, nullptr, S::LOWERING},
+    {S::WAITING_FOR_ANALYSIS, Machine::when<&R::verdictEject>,
+     Machine::run<&R::ejectBoard>, nullptr, S::EJECTING},
+    {S::WAITING_FOR_ANALYSIS, Machine::when<&R::verdictPass>,
+     Machine::run<&R::passBoard>, nullptr, S::LOWERING},
+    {S::WAITING_FOR_ANALYSIS, Machine::when<&R::abortPending>,
+     Machine::run<&R::dropBoard>, nullptr, S::LOWERING},
+    {S::WAITING_FOR_ANALYSIS, nullptr, Machine::run<&R::dropBoard>,
+     Machine::after<&R::analysisTimeoutMs>, S::LOWERING},
+    {S::EJECTING, nullptr, Machine::run<&R::retractEjector>,
+     Machine::after<&R::ejectHoldMs>, S::LOWERING},
+    // Continuous feed: skip IDLE and WAITING_FOR_PUSH for a queued board
+    {S::LOWERING, Machine::when<&R::boardQueued>,
+     Machine::run<&R::feedNextBoard>, Machine::after<&R::feedMs>,
+     S::PUSHING},
+    {S::LOWERING, nullptr, Machine::run<&R::completeCycle>,
+     Machine::afterMs<CYCLE_DELAY>, S::IDLE},
+    // ERROR is entered by the watchdog and left only by a reset
+};
+
+constexpr R::Machine::Index R::TRANSITION_INDEX =
+    Machine::index(TRANSITIONS);
 
-  digitalWrite(PUSH_CYLINDER_PIN, LOW);
-  digitalWrite(RISER_CYLINDER_PIN, LOW);
-  digitalWrite(EJECTION_CYLINDER_PIN, LOW);
+void RouterController::loop() {
+  serviceQuietWindow();
+
+  uint32_t edgeUs;
+  if (hal::takeStrobeEdge(edgeUs) && onSlaveRequest) {
+    onSlaveRequest(SlaveRequest::CAPTURE_EDGE, strobeBoardId, edgeUs);
+  }
 
-  sensor1Debouncer.attach(SENSOR1_PIN, INPUT);
-  sensor1Debouncer.interval(SENSOR_DEBOUNCE_TIME);
+  pollSensor();
+  serviceCalibration();
+  runMachine();
+  publishState();
 }
 
-void RouterController::loop() {
-  // Check for sensor state changes
-  bool currentSensor1State = isSensor1Active();
-  if (currentSensor1State != lastSensor1State) {
-    Serial.print("DEBUG: Sensor 1 changed to: ");
-    Serial.println(currentSensor1State ? "ON" : "OFF");
-    lastSensor1State = currentSensor1State;
-    broadcastState();
-  }
-
-  // Check sensor in IDLE state
-  if (currentState == RouterState::IDLE && isSensor1Active()) {
-    startCycle();
-    return;
+uint32_t RouterController::nextWakeUs() {
+  Deadline deadline(MAX_SLEEP_US);
+
+  if (quietActive) deadline.atUs(quietUntilUs);
+  deadline.inUs(sensor1Debouncer.pendingUs(hal::micros()));
+  for (size_t i = 0; i < STROKE_COUNT; i++) {
+    if (strokeSensors & (1 << i)) {
+      deadline.inUs(strokes[i].debouncer.pendingUs(hal::micros()));
+    }
   }
 
-  updateState();
+  // Timed rows already due but held by a guard wait for the sensor or a
+  // verdict, both of which wake the task
+  unsigned long timeoutMs =
+      Machine::nextTimeoutMs(TRANSITIONS, TRANSITION_INDEX, *this,
+                             currentState, hal::millis() - stateStartTime);
+  if (timeoutMs != ULONG_MAX) deadline.inUs(timeoutMs * 1000UL);
+  unsigned long tunerMs = tuner.nextDueMs(hal::millis());
+  if (tunerMs != ULONG_MAX) deadline.inUs(tunerMs * 1000UL);
+  return deadline.us();
 }
 
-void RouterController::updateState() {
-  unsigned long currentTime = millis();
-  static unsigned long lastStateUpdate = 0;
+void RouterController::runMachine() {
+  static_assert(Machine::statesInRange(TRANSITIONS), "state out of range");
+  static_assert(Machine::rowsGrouped(TRANSITIONS),
+                "rows of a state must be adjacent");
+  static_assert(Machine::allReachable(TRANSITIONS, {S::IDLE, S::ERROR}),
+                "unreachable router state");
+  static_assert(Machine::allExit(TRANSITIONS, {S::ERROR}),
+                "router state without a way out");
+  static_assert(Machine::timedStatesExit(TRANSITIONS),
+                "timed router state without a timed exit");
+  static_assert(Machine::noShadowedRows(TRANSITIONS),
+                "transition row can never fire");
+  // An empty pipeline leaves at once instead of waiting out the timeout
+  static_assert(Machine::triedBefore(TRANSITIONS, S::WAITING_FOR_ANALYSIS,
+                                     Machine::when<&R::ejectorFree>,
+                                     Machine::when<&R::verdictEject>),
+                "verdict rows must follow the empty-ejector row");
+  PROFILE_SCOPE("runMachine");
+
+  unsigned long now = hal::millis();
+  // A pass this late may have missed every deadline of the cycle
+  if (currentState != RouterState::ERROR &&
+      now - lastDispatchTime > STALL_TIMEOUT_MS) {
+    // A STALL report names the culprit when it was a long pass and not a
+    // late one
+    TRACE_TO(emitTrace, SerialOutput::NORMAL,
+             "WARNING No control pass for %lu ms\r\n", now - lastDispatchTime);
+    enterError("ERROR: State transition timeout");
+  }
+  lastDispatchTime = now;
 
-  // Add watchdog for state transitions
-  if (currentTime - lastStateUpdate > 10000) {  // 10 second timeout
-    Serial.println("ERROR: State transition timeout");
-    currentState = RouterState::ERROR;
-    deactivatePushCylinder();
-    deactivateRiserCylinder();
-    broadcastState();
+  // Every state entered is published, so the master never misses one
+  // that was passed straight through
+  Machine::dispatch(TRANSITIONS, TRANSITION_INDEX, *this, currentState,
+                    stateStartTime, now, Machine::run<&R::enteredState>);
+}
+
+void RouterController::enterError(const char* reason) {
+  TRACE_TO(emitTrace, SerialOutput::CRITICAL, "%s\r\n", reason);
+  abortCalibration();
+  currentState = RouterState::ERROR;
+  stateStartTime = hal::millis();
+  hal::cancelStrobe();
+  deactivatePushCylinder();
+  deactivateRiserCylinder();
+  enteredState();
+}
+
+// Guards
+
+bool RouterController::boardClearForAnalysis() const {
+  return !isSensor1Active() && cycleAnalysed;
+}
+
+bool RouterController::canArm() const {
+  const Board* board = pipeline.back();
+  return triggerLead > 0 && hal::millis() - riserStartedAt < riserTime &&
+         !strokeDone(Stroke::RISER) && board &&
+         board->phase == BoardPhase::LOADED;
+}
+
+// Interlocks for the overlaps: the riser never lifts a board still on the
+// infeed, and the ejector only fires early on a board that is not on the
+// riser (pipelined) while the push cylinder is retracted
+
+bool RouterController::canRaiseEarly() const {
+  return riserOverlap > 0 && cycleAnalysed && !isSensor1Active() &&
+         !valveCommanded(Stroke::RISER);
+}
+
+bool RouterController::canEjectEarly() const {
+  const Board* board = pipeline.front();
+  // The push cylinder must have retracted, not only been told to
+  return ejectOverlap > 0 && pipelined && !pushCylinderState &&
+         !valveCommanded(Stroke::PUSH) &&
+         !valveCommanded(Stroke::EJECTION) && board &&
+         board->pushesToEjector == 0 &&
+         board->verdictKnown && board->eject;
+}
+
+// Nothing at the ejector waits for a verdict
+bool RouterController::ejectorFree() const {
+  const Board* board = pipeline.front();
+  return !board || board->pushesToEjector > 0;
+}
+
+bool RouterController::verdictEject() const {
+  const Board* board = pipeline.front();
+  return board && board->verdictKnown && board->eject;
+}
+
+bool RouterController::verdictPass() const {
+  const Board* board = pipeline.front();
+  return board && board->verdictKnown && !board->eject;
+}
+
+// Timeouts
+
+// No cycle starts until the supply has settled after boot
+unsigned long RouterController::powerSettleMs() const {
+  unsigned long settledAt = setupTime + POWER_SETTLE_TIME;
+  return settledAt > stateStartTime ? settledAt - stateStartTime : 0;
+}
+
+// A confirmed stroke ends its phase; the timer is only the upper bound
+unsigned long RouterController::pushPhaseMs() const {
+  return strokeDone(Stroke::PUSH) ? 0 : pushTime;
+}
+
+unsigned long RouterController::raiseEarlyMs() const {
+  return pushTime > riserOverlap ? pushTime - riserOverlap : 0;
+}
+
+// The riser may have started before RAISING was entered
+unsigned long RouterController::riserSettleMs() const {
+  if (strokeDone(Stroke::RISER)) return 0;
+  unsigned long settledAt = riserStartedAt + riserTime;
+  return settledAt > stateStartTime ? settledAt - stateStartTime : 0;
+}
+
+unsigned long RouterController::armMs() const {
+  unsigned long settleMs = riserSettleMs();
+  return settleMs > triggerLead ? settleMs - triggerLead : 0;
+}
+
+unsigned long RouterController::ejectEarlyMs() const {
+  unsigned long settleMs = riserSettleMs();
+  return settleMs > ejectOverlap ? settleMs - ejectOverlap : 0;
+}
+
+// An armed camera started its capture triggerLead before settling
+unsigned long RouterController::captureHoldMs() const {
+  return captureTime > triggerLead ? captureTime - triggerLead : 0;
+}
+
+// Counted from the request, which in pipelined mode predates the state
+unsigned long RouterController::analysisTimeoutMs() const {
+  const Board* board = pipeline.front();
+  if (!board) return 0;
+  unsigned long dueAt = board->requestedAt + analysisTimeout;
+  return dueAt > stateStartTime ? dueAt - stateStartTime : 0;
+}
+
+// The dwell and the queued board's settle delay run side by side
+unsigned long RouterController::feedMs() const {
+  unsigned long settledAt = boardSeenAt + SENSOR_DELAY_TIME;
+  unsigned long settleMs =
+      settledAt > stateStartTime ? settledAt - stateStartTime : 0;
+  return settleMs > CYCLE_DELAY ? settleMs : CYCLE_DELAY;
+}
+
+unsigned long RouterController::ejectHoldMs() const {
+  if (strokeDone(Stroke::EJECTION)) return 0;
+  unsigned long doneAt = ejectStartedAt + ejectionTime;
+  return doneAt > stateStartTime ? doneAt - stateStartTime : 0;
+}
+
+// Actions
+
+void RouterController::beginCycle() {
+  if (requestedPipelined != pipelined) {
+    // Boards in flight were tracked for the other ejector position; they
+    // leave the line without a verdict
+    if (!pipeline.empty()) {
+      flushedBoards += pipeline.size();
+      TRACE_TO(emitTrace, SerialOutput::NORMAL,
+               "WARNING Pipeline mode changed, %u boards flushed\r\n",
+               static_cast<unsigned>(pipeline.size()));
+      pipeline.clear();
+    }
+    pipelined = requestedPipelined;
   }
+  cycleAnalysed = analysisMode;
+  abortRequested = false;
+  cycleStartTime = hal::millis();
+}
+
+// The start stamps hold until a queued edge is driven and restamps them
+void RouterController::startRiser() {
+  activateRiserCylinder();
+  riserStartedAt = hal::millis();
+}
 
-  // Add cycle completion tracking
-  if (currentState == RouterState::LOWERING &&
-      currentTime - stateStartTime >= CYCLE_DELAY) {
-    lastCycleTime = currentTime - cycleStartTime;
-    Serial.printf("DEBUG: Cycle %lu completed in %lu ms\n", cycleCount,
-                  lastCycleTime);
+void RouterController::raiseBoard() {
+  deactivatePushCylinder();
+  boardPushed();
+  if (!valveCommanded(Stroke::RISER)) startRiser();
+  scheduleCameraTrigger();
+}
+
+void RouterController::skipAnalysis() {
+  deactivatePushCylinder();
+  boardPushed();
+  if (onSlaveRequest) {
+    onSlaveRequest(SlaveRequest::NON_ANALYSIS_CYCLE, 0, 0);
   }
+}
 
-  switch (currentState) {
-    case RouterState::WAITING_FOR_PUSH:
-      if (currentTime - stateStartTime >= SENSOR_DELAY_TIME) {
-        currentState = RouterState::PUSHING;
-        activatePushCylinder();
-        stateStartTime = currentTime;
-        broadcastState();
-      }
-      break;
+void RouterController::armAnalysis() {
+  Board* board = pipeline.back();
+  board->phase = BoardPhase::ARMED;
+  if (onSlaveRequest) {
+    unsigned long elapsedMs = hal::millis() - riserStartedAt;
+    onSlaveRequest(SlaveRequest::ANALYSIS_ARM, board->id,
+                   riserTime - elapsedMs);
+  }
+}
 
-    case RouterState::PUSHING:
-      if (!isSensor1Active() && (currentTime - stateStartTime >= pushTime)) {
-        deactivatePushCylinder();
-        if (analysisMode) {
-          currentState = RouterState::RAISING;
-          activateRiserCylinder();
-        } else {
-          Serial.println("SLAVE_REQUEST NON_ANALYSIS_CYCLE");
-          currentState = RouterState::LOWERING;
-        }
-        stateStartTime = currentTime;
-        broadcastState();
-      }
-      break;
+void RouterController::startAnalysis() {
+  Board* board = pipeline.back();
+  uint32_t boardId = 0;
+  if (board) {
+    board->phase = board->pushesToEjector == 0 ? BoardPhase::AT_EJECTOR
+                                               : BoardPhase::CAPTURING;
+    board->requestedAt = hal::millis();
+    board->requestedUs = hal::micros();
+    boardId = board->id;
+  }
 
-    case RouterState::RAISING:
-      if (currentTime - stateStartTime >= riserTime) {
-        if (analysisMode) {
-          startAnalysis();
-        } else {
-          Serial.println(
-              "WARNING Unexpected state: RAISING in non-analysis mode");
-          lowerAndWait();
-        }
-        broadcastState();
-      }
-      break;
+  // Signal to master to start analysis
+  if (onSlaveRequest) {
+    onSlaveRequest(SlaveRequest::ANALYSIS_START, boardId, 0);
+  }
+}
 
-    case RouterState::WAITING_FOR_ANALYSIS:
-      if (currentTime - stateStartTime >= ANALYSIS_TIMEOUT) {
-        abortAnalysis();
-      }
-      break;
+// The image is taken; the board rides on towards the ejector
+void RouterController::releaseBoard() {
+  Board* board = pipeline.back();
+  if (board && board->phase == BoardPhase::CAPTURING) {
+    board->phase = BoardPhase::IN_TRANSIT;
+  }
+  deactivateRiserCylinder();
+}
 
-    case RouterState::EJECTING:
-      if (currentTime - stateStartTime >= ejectionTime) {
-        digitalWrite(EJECTION_CYLINDER_PIN, LOW);
-        ejectionCylinderState = false;
-        lowerAndWait();
-        broadcastState();
-      }
-      break;
+void RouterController::ejectBoard() {
+  retireBoard();
+  TRACE_TO(emitTrace, SerialOutput::DEBUG,
+           "DEBUG: Processing analysis result: EJECT\r\n");
+  activateEjectionCylinder();
+  ejectStartedAt = hal::millis();
+}
 
-    case RouterState::LOWERING:
-      if (currentTime - stateStartTime >= CYCLE_DELAY) {
-        // Add debug logging before state change
-        Serial.println("DEBUG: Completing lowering cycle");
-        Serial.printf(
-            "DEBUG: Cycle stats - Duration: %lu ms, State time: %lu ms\n",
-            currentTime - cycleStartTime, currentTime - stateStartTime);
-
-        lastCycleTime = currentTime - cycleStartTime;
-        currentState = RouterState::IDLE;
-        cycleCount++;
-
-        // Add debug after state change
-        Serial.println("DEBUG: Transition to IDLE complete");
-        broadcastState();
-      }
-      break;
+void RouterController::passBoard() {
+  retireBoard();
+  TRACE_TO(emitTrace, SerialOutput::DEBUG,
+           "DEBUG: Processing analysis result: PASS\r\n");
+  lowerRiser();
+}
 
-    case RouterState::ERROR:
-      // Handle error state if needed
-      break;
+// The board at the ejector passes without a verdict
+void RouterController::dropBoard() {
+  abortRequested = false;
+  if (const Board* board = pipeline.front()) {
+    TRACE_TO(emitTrace, SerialOutput::NORMAL,
+             "WARNING No verdict for board %lu, passed unsorted\r\n",
+             static_cast<unsigned long>(board->id));
+  }
+  retireBoard();
+  lowerRiser();
+}
 
-    default:
-      break;
+void RouterController::lowerRiser() {
+  if (valveCommanded(Stroke::RISER)) {
+    deactivateRiserCylinder();
   }
+}
 
-  lastStateUpdate = currentTime;
+void RouterController::retractEjector() {
+  deactivateEjectionCylinder();
+  lowerRiser();
 }
 
-void RouterController::startCycle() {
-  cycleStartTime = millis();
-  stateStartTime = cycleStartTime;
-  currentState = RouterState::WAITING_FOR_PUSH;
-  broadcastState();
+void RouterController::feedNextBoard() {
+  completeCycle();
+  // Without continuous feed the push would start SENSOR_DELAY_TIME after
+  // the later of the dwell ending and the board arriving
+  unsigned long now = hal::millis();
+  unsigned long dwellEnd = stateStartTime + CYCLE_DELAY;
+  unsigned long pushAt =
+      (boardSeenAt > dwellEnd ? boardSeenAt : dwellEnd) + SENSOR_DELAY_TIME;
+  lastIdleSkipped = pushAt > now ? pushAt - now : 0;
+  TRACE_TO(emitTrace, SerialOutput::DEBUG,
+           "DEBUG: Continuous feed skipped %lu ms idle\r\n", lastIdleSkipped);
+  beginCycle();
+  pushBoard();
+}
+
+// Settle delays included: this is the wait a board sees at the infeed
+void RouterController::pushBoard() {
+  sensorToPush.record(hal::micros() - boardEdgeUs);
+  activatePushCylinder();
+}
+
+void RouterController::completeCycle() {
+  unsigned long now = hal::millis();
+  lastCycleTime = now - cycleStartTime;
+  lastIdleSkipped = 0;
+  cycleCount++;
+  TRACE_TO(emitTrace, SerialOutput::DEBUG,
+           "DEBUG: Cycle %lu completed in %lu ms, lowering took %lu ms\r\n",
+           cycleCount, lastCycleTime, now - stateStartTime);
 }
 
 void RouterController::activatePushCylinder() {
-  // Disable interrupts briefly during solenoid switching
-  noInterrupts();
-  digitalWrite(PUSH_CYLINDER_PIN, HIGH);
-  pushCylinderState = true;
-  delayMicroseconds(500);  // Let EMI settle
-  interrupts();
-
-  // Small delay before serial communication
-  delay(10);
-  Serial.println("DEBUG: Push cylinder activated");
-  broadcastState();
+  switchSolenoid(Stroke::PUSH, true);
+  TRACE_TO(emitTrace, SerialOutput::DEBUG,
+           "DEBUG: Push cylinder activated\r\n");
 }
 
 void RouterController::deactivatePushCylinder() {
-  noInterrupts();
-  digitalWrite(PUSH_CYLINDER_PIN, LOW);
-  pushCylinderState = false;
-  delayMicroseconds(500);  // Let EMI settle
-  interrupts();
-
-  delay(10);
-  Serial.println("DEBUG: Push cylinder deactivated");
-  broadcastState();
+  switchSolenoid(Stroke::PUSH, false);
+  TRACE_TO(emitTrace, SerialOutput::DEBUG,
+           "DEBUG: Push cylinder deactivated\r\n");
 }
 
 void RouterController::activateRiserCylinder() {
-  digitalWrite(RISER_CYLINDER_PIN, HIGH);
-  riserCylinderState = true;
-  Serial.println("DEBUG: Riser cylinder activated");
-  broadcastState();
+  switchSolenoid(Stroke::RISER, true);
+  TRACE_TO(emitTrace, SerialOutput::DEBUG,
+           "DEBUG: Riser cylinder activated\r\n");
 }
 
 void RouterController::deactivateRiserCylinder() {
-  digitalWrite(RISER_CYLINDER_PIN, LOW);
-  riserCylinderState = false;
-  Serial.println("DEBUG: Riser cylinder deactivated");
-  broadcastState();
+  switchSolenoid(Stroke::RISER, false);
+  TRACE_TO(emitTrace, SerialOutput::DEBUG,
+           "DEBUG: Riser cylinder deactivated\r\n");
 }
 
-bool RouterController::isSensor1Active() {
-  sensor1Debouncer.update();
-  return sensor1Debouncer.read() == LOW;
+void RouterController::activateEjectionCylinder() {
+  switchSolenoid(Stroke::EJECTION, true);
+  TRACE_TO(emitTrace, SerialOutput::DEBUG,
+           "DEBUG: Ejection cylinder activated\r\n");
 }
 
-void RouterController::startAnalysis() {
-  stateStartTime = millis();
-  currentState = RouterState::WAITING_FOR_ANALYSIS;
-  analysisComplete = false;
-  // Signal to master to start analysis
-  Serial.println("SLAVE_REQUEST ANALYSIS_START");
+void RouterController::deactivateEjectionCylinder() {
+  switchSolenoid(Stroke::EJECTION, false);
+  TRACE_TO(emitTrace, SerialOutput::DEBUG,
+           "DEBUG: Ejection cylinder deactivated\r\n");
 }
 
-void RouterController::handleAnalysisResult(bool eject) {
-  if (currentState != RouterState::WAITING_FOR_ANALYSIS) {
-    Serial.println("DEBUG: Ignoring analysis result - not in waiting state");
+void RouterController::driveCylinder(Stroke stroke, bool extend) {
+  switch (stroke) {
+    case Stroke::PUSH:
+      extend ? activatePushCylinder() : deactivatePushCylinder();
+      break;
+    case Stroke::RISER:
+      extend ? activateRiserCylinder() : deactivateRiserCylinder();
+      break;
+    case Stroke::EJECTION:
+      extend ? activateEjectionCylinder() : deactivateEjectionCylinder();
+      break;
+  }
+}
+
+// Every valve edge opens a quiet window instead of stalling the loop: sensor
+// edges are dropped and serial output is held until the noise is gone.
+void RouterController::switchSolenoid(Stroke valve, bool on) {
+  PROFILE_SCOPE("switchSolenoid");
+  if (!staggerSolenoids || !inQuietWindow()) {
+    writeValve(valve, on);
     return;
   }
+  // A later command for a valve still waiting replaces its edge, so no
+  // more than one edge per valve is ever queued
+  for (size_t i = 0; i < pendingEdgeCount; i++) {
+    if (pendingEdges[i].valve != valve) continue;
+    if (pendingEdges[i].on != on) {
+      // Back to where the valve already is
+      pendingEdgeCount--;
+      memmove(pendingEdges + i, pendingEdges + i + 1,
+              (pendingEdgeCount - i) * sizeof(pendingEdges[0]));
+    }
+    return;
+  }
+  if (cylinderState(valve) != on) {
+    pendingEdges[pendingEdgeCount++] = {valve, on};
+  }
+}
 
-  analysisComplete = true;
-  shouldEject = eject;
+// The valve moves here, so its state and stroke timing follow the pin
+// rather than the command that queued the edge
+void RouterController::writeValve(Stroke valve, bool on) {
+  size_t index = static_cast<size_t>(valve);
+  uint8_t level = on ? HIGH : LOW;
+  hal::digitalWrite(VALVE_PINS[index], level);
+  flight::record(flight::Kind::VALVE, VALVE_PINS[index], level);
+  switch (valve) {
+    case Stroke::PUSH:
+      pushCylinderState = on;
+      break;
+    case Stroke::RISER:
+      riserCylinderState = on;
+      if (on) riserStartedAt = hal::millis();
+      break;
+    case Stroke::EJECTION:
+      ejectionCylinderState = on;
+      if (on) ejectStartedAt = hal::millis();
+      break;
+  }
+  on ? startStroke(valve) : endStroke(valve);
+  stateDirty = true;
+  startQuietWindow();
+}
 
-  Serial.print("DEBUG: Processing analysis result: ");
-  Serial.println(eject ? "EJECT" : "PASS");
+bool RouterController::cylinderState(Stroke valve) const {
+  switch (valve) {
+    case Stroke::PUSH:
+      return pushCylinderState;
+    case Stroke::RISER:
+      return riserCylinderState;
+    case Stroke::EJECTION:
+      break;
+  }
+  return ejectionCylinderState;
+}
 
-  if (eject) {
-    Serial.println("DEBUG: Starting ejection sequence");
-    startEjection();
-  } else {
-    Serial.println("DEBUG: No ejection needed, lowering");
-    lowerAndWait();
+// Where a valve is headed: its queued edge if one waits, else the pin
+bool RouterController::valveCommanded(Stroke valve) const {
+  for (size_t i = 0; i < pendingEdgeCount; i++) {
+    if (pendingEdges[i].valve == valve) return pendingEdges[i].on;
   }
-  broadcastState();
+  return cylinderState(valve);
 }
 
-void RouterController::abortAnalysis() {
-  if (currentState != RouterState::WAITING_FOR_ANALYSIS) {
-    return;
+bool RouterController::inQuietWindow() const {
+  return quietActive &&
+         static_cast<int32_t>(hal::micros() - quietUntilUs) < 0;
+}
+
+void RouterController::startQuietWindow() {
+  quietStartUs = hal::micros();
+  quietUntilUs = quietStartUs + EMI_QUIET_WINDOW_US;
+  quietActive = true;
+  if (onQuietWindow) {
+    onQuietWindow(EMI_QUIET_WINDOW_US);
   }
-  lowerAndWait();
 }
 
-void RouterController::startEjection() {
-  Serial.println("DEBUG: startEjection called");
-  digitalWrite(EJECTION_CYLINDER_PIN, HIGH);
-  ejectionCylinderState = true;
-  Serial.println("DEBUG: Ejection cylinder activated");
-  stateStartTime = millis();
-  currentState = RouterState::EJECTING;
-  broadcastState();
+void RouterController::serviceQuietWindow() {
+  if (!quietActive || inQuietWindow()) return;
+  quietActive = false;
+  // Edges during the window were dropped; resync to the settled level
+  sensor1Debouncer.edge(hal::digitalRead(SENSOR1_PIN), hal::micros());
+  for (size_t i = 0; i < STROKE_COUNT; i++) {
+    if (strokeSensors & (1 << i)) {
+      strokes[i].debouncer.edge(hal::digitalRead(STROKE_PINS[i]),
+                                hal::micros());
+    }
+  }
+  if (pendingEdgeCount == 0) return;
+
+  SolenoidEdge edge = pendingEdges[0];
+  pendingEdgeCount--;
+  memmove(pendingEdges, pendingEdges + 1,
+          pendingEdgeCount * sizeof(pendingEdges[0]));
+  writeValve(edge.valve, edge.on);
+  // The strobe was timed from the queued stamp; retime it from the drive
+  if (edge.valve == Stroke::RISER && edge.on &&
+      currentState == RouterState::RAISING) {
+    scheduleCameraTrigger();
+  }
 }
 
-void RouterController::lowerAndWait() {
-  deactivateRiserCylinder();
-  stateStartTime = millis();
-  currentState = RouterState::LOWERING;
+// Feeds the queued edges through the integrator. Edges stamped inside a
+// quiet window are valve noise and are dropped; the real level is picked up
+// again when the window closes.
+void RouterController::pollSensor() {
+  PROFILE_SCOPE("pollSensor");
+  hal::InputEdge edge;
+  bool changed = false;
+  while (hal::takeInputEdge(edge)) {
+    if (quietStartUs && edge.us - quietStartUs < EMI_QUIET_WINDOW_US) {
+      continue;
+    }
+    if (edge.pin == SENSOR1_PIN) {
+      changed |= sensor1Debouncer.edge(edge.level, edge.us);
+      continue;
+    }
+    for (size_t i = 0; i < STROKE_COUNT; i++) {
+      if (edge.pin == STROKE_PINS[i] && (strokeSensors & (1 << i))) {
+        strokes[i].debouncer.edge(edge.level, edge.us);
+      }
+    }
+  }
+  pollStrokes();
+
+  uint32_t now = hal::micros();
+  changed |= sensor1Debouncer.update(now);
+  if (!changed || isSensor1Active() == lastSensor1State) return;
+
+  lastSensor1State = isSensor1Active();
+  if (lastSensor1State) {
+    boardSeenAt = hal::millis();
+    boardEdgeUs = sensor1Debouncer.changeStartedUs();
+  }
+  sensorLatencyUs = now - sensor1Debouncer.changeStartedUs();
+  if (sensorLatencyUs > sensorLatencyMaxUs) {
+    sensorLatencyMaxUs = sensorLatencyUs;
+  }
+  TRACE_TO(emitTrace, SerialOutput::DEBUG,
+           "DEBUG: Sensor 1 changed to: %s (%lu us)\r\n",
+           lastSensor1State ? "ON" : "OFF",
+           static_cast<unsigned long>(sensorLatencyUs));
+  stateDirty = true;
+}
+
+// A stroke is done once its switch confirms closed after the valve opened;
+// a switch that never opened (stuck cylinder) leaves the timer in charge
+void RouterController::pollStrokes() {
+  uint32_t now = hal::micros();
+  for (size_t i = 0; i < STROKE_COUNT; i++) {
+    StrokeInput& stroke = strokes[i];
+    if (!(strokeSensors & (1 << i))) continue;
+    stroke.debouncer.update(now);
+    if (!stroke.running || stroke.done || stroke.debouncer.read() != LOW) {
+      continue;
+    }
+    uint32_t confirmedUs = stroke.debouncer.changeConfirmedUs();
+    if (static_cast<int32_t>(confirmedUs - stroke.startUs) <= 0) continue;
+
+    stroke.done = true;
+    strokeMs[i] = (confirmedUs - stroke.startUs) / 1000;
+    if (strokeMs[i] > strokeMaxMs[i]) strokeMaxMs[i] = strokeMs[i];
+    TRACE_TO(emitTrace, SerialOutput::DEBUG,
+             "DEBUG: %s stroke %lu ms\r\n", STROKE_NAMES[i], strokeMs[i]);
+    // The camera fires at the confirmed settle, not the padded timer
+    if (static_cast<Stroke>(i) == Stroke::RISER &&
+        currentState == RouterState::RAISING) {
+      scheduleCameraTrigger();
+    }
+  }
+}
+
+void RouterController::startStroke(Stroke stroke) {
+  StrokeInput& input = strokes[static_cast<size_t>(stroke)];
+  input.startUs = hal::micros();
+  input.running = true;
+  input.done = false;
+}
+
+void RouterController::endStroke(Stroke stroke) {
+  StrokeInput& input = strokes[static_cast<size_t>(stroke)];
+  input.running = false;
+  input.done = false;
+}
+
+void RouterController::setStrokeSensors(uint8_t mask) {
+  for (size_t i = 0; i < STROKE_COUNT; i++) {
+    if (!(mask & (1 << i)) || (strokeSensors & (1 << i))) continue;
+    hal::pinMode(STROKE_PINS[i], INPUT_PULLUP);
+    strokes[i].debouncer.setConfirmUs(STROKE_CONFIRM_US);
+    strokes[i].debouncer.begin(hal::digitalRead(STROKE_PINS[i]),
+                               hal::micros());
+    hal::attachEdgeCapture(STROKE_PINS[i]);
+  }
+  strokeSensors = mask;
+}
+
+RouterSnapshot RouterController::snapshot() {
+  RouterSnapshot state;
+  state.state = currentState;
+  state.pushCylinder = pushCylinderState;
+  state.riserCylinder = riserCylinderState;
+  state.ejectionCylinder = ejectionCylinderState;
+  state.sensor1 = isSensor1Active();
+  state.cycleCount = cycleCount;
+  state.lastCycleTime = lastCycleTime;
+  state.sensorLatencyUs = sensorLatencyUs;
+  state.sensorLatencyMaxUs = sensorLatencyMaxUs;
+  state.lastIdleSkipped = lastIdleSkipped;
+  state.lateVerdicts = lateVerdicts;
+  state.duplicateVerdicts = duplicateVerdicts;
+  state.unmatchedVerdicts = unmatchedVerdicts;
+  for (size_t i = 0; i < STROKE_COUNT; i++) {
+    state.strokeMs[i] = strokeMs[i];
+    state.strokeMaxMs[i] = strokeMaxMs[i];
+  }
+  return state;
+}
+
+void RouterController::boardPushed() {
+  pipeline.advance();
+  // Boards that reach the ejector without having been analysed simply pass
+  Board* board = pipeline.front();
+  while (board && board->pushesToEjector == 0 &&
+         board->phase == BoardPhase::LOADED) {
+    pipeline.pop();
+    board = pipeline.front();
+  }
+  if (!cycleAnalysed) return;
+
+  // Without pipelining the ejector works on the raised board itself
+  if (!pipeline.push(nextBoardId, pipelined ? PIPELINE_EJECT_OFFSET : 0)) {
+    TRACE_TO(emitTrace, SerialOutput::CRITICAL,
+             "ERROR: Board pipeline full\r\n");
+    flushedBoards++;
+    pipeline.pop();
+    pipeline.push(nextBoardId, pipelined ? PIPELINE_EJECT_OFFSET : 0);
+  }
+  nextBoardId++;
+}
+
+// The strobe fires off the timer exactly riserTime after the riser started,
+// so loop() latency and the serial link stay out of the capture timing
+void RouterController::scheduleCameraTrigger() {
+  Board* board = pipeline.back();
+  strobeBoardId = board ? board->id : 0;
+  unsigned long elapsedMs = hal::millis() - riserStartedAt;
+  unsigned long remainingMs = riserTime > elapsedMs ? riserTime - elapsedMs : 0;
+  if (strokeDone(Stroke::RISER)) remainingMs = 0;
+  hal::scheduleStrobe(CAMERA_TRIGGER_PIN, remainingMs * 1000UL,
+                      CAMERA_TRIGGER_PULSE_US);
+}
+
+// Every board that got as far as ANALYSIS_START leaves through here
+void RouterController::retireBoard() {
+  if (const Board* board = pipeline.front()) {
+    retiredBoards[retiredCount++ % MAX_RETIRED_BOARDS] =
+        RetiredBoard{board->id, hal::micros(), board->verdictKnown};
+  }
+  pipeline.pop();
+}
+
+RouterController::RetiredBoard* RouterController::findRetired(uint32_t id) {
+  for (RetiredBoard& retired : retiredBoards) {
+    if (id && retired.id == id) return &retired;
+  }
+  return nullptr;
+}
+
+void RouterController::handleAnalysisResult(bool eject, uint32_t boardId) {
+  Board* board = boardId ? pipeline.find(boardId) : nullptr;
+  if (!board || board->phase == BoardPhase::LOADED || board->verdictKnown) {
+    dropVerdict(boardId, board && board->verdictKnown);
+    return;
+  }
+
+  board->verdictKnown = true;
+  board->eject = eject;
+  analysisRoundTrip.record(hal::micros() - board->requestedUs);
+
+  TRACE_TO(emitTrace, SerialOutput::DEBUG,
+           "DEBUG: Analysis result for board %lu: %s\r\n",
+           static_cast<unsigned long>(board->id), eject ? "EJECT" : "PASS");
+
+  // Verdicts for boards still upstream wait until they reach the ejector
+  runMachine();
+  publishState();
+}
+
+// Never applied to another board: a verdict after the timeout would
+// otherwise sort whichever board is waiting now
+void RouterController::dropVerdict(uint32_t boardId, bool duplicate) {
+  RetiredBoard* retired = duplicate ? nullptr : findRetired(boardId);
+  if (duplicate || (retired && retired->answered)) {
+    duplicateVerdicts++;
+    TRACE_TO(emitTrace, SerialOutput::DEBUG,
+             "DEBUG: Duplicate analysis result for board %lu dropped\r\n",
+             static_cast<unsigned long>(boardId));
+  } else if (retired) {
+    retired->answered = true;
+    lateVerdicts++;
+    uint32_t lateUs = hal::micros() - retired->retiredUs;
+    verdictLateness.record(lateUs);
+    TRACE_TO(emitTrace, SerialOutput::NORMAL,
+             "WARNING Analysis result for board %lu dropped, %lu ms late\r\n",
+             static_cast<unsigned long>(boardId),
+             static_cast<unsigned long>(lateUs / 1000));
+  } else {
+    unmatchedVerdicts++;
+    TRACE_TO(emitTrace, SerialOutput::NORMAL,
+             "WARNING Analysis result for unknown board %lu dropped\r\n",
+             static_cast<unsigned long>(boardId));
+  }
+  // The counts reach the heartbeat through the snapshot
+  stateDirty = true;
+  publishState();
 }
 
 void RouterController::abortCurrentAnalysis() {
-  if (currentState == RouterState::WAITING_FOR_ANALYSIS) {
-    abortAnalysis();
+  if (currentState != RouterState::WAITING_FOR_ANALYSIS) return;
+  abortRequested = true;
+  runMachine();
+  publishState();
+}
+
+// Calibration
+
+void RouterController::startCalibration(const CycleTuner::Request& request) {
+  if (tuner.isActive()) {
+    TRACE_TO(emitTrace, SerialOutput::NORMAL,
+             "WARNING Calibration already running\r\n");
+    return;
+  }
+  if (currentState != RouterState::IDLE || isSensor1Active()) {
+    TRACE_TO(emitTrace, SerialOutput::NORMAL,
+             "WARNING Calibration needs the router idle and sensor 1 "
+             "clear\r\n");
+    return;
   }
+  unsigned long timings[STROKE_COUNT] = {pushTime, riserTime, ejectionTime};
+  persistCalibration = request.persist;
+  tuner.start(request, timings, strokeSensors, hal::millis());
+  TRACE_TO(emitTrace, SerialOutput::DEBUG,
+           "DEBUG: Calibration started, %u cycles per step, %u ms "
+           "resolution\r\n",
+           request.cycles, request.stepMs);
 }
 
-void RouterController::broadcastState() {
-  // Add debug logging for state changes
-  Serial.print("DEBUG: Current state: ");
-  switch (currentState) {
-    case RouterState::IDLE:
-      Serial.println("IDLE");
-      break;
-    case RouterState::WAITING_FOR_PUSH:
-      Serial.println("WAITING_FOR_PUSH");
-      break;
-    case RouterState::PUSHING:
-      Serial.println("PUSHING");
-      break;
-    case RouterState::RAISING:
-      Serial.println("RAISING");
-      break;
-    case RouterState::WAITING_FOR_ANALYSIS:
-      Serial.println("WAITING_FOR_ANALYSIS");
+void RouterController::abortCalibration() {
+  if (!tuner.isActive()) return;
+  tuner.abort();
+  // Calibration only runs from IDLE, so every cylinder out is its own
+  if (valveCommanded(Stroke::PUSH)) deactivatePushCylinder();
+  if (valveCommanded(Stroke::RISER)) deactivateRiserCylinder();
+  if (valveCommanded(Stroke::EJECTION)) deactivateEjectionCylinder();
+  finishCalibration();
+}
+
+// Dry strokes only run while the infeed is empty; a board arriving would
+// be pushed by a cylinder that is being deliberately cut short
+void RouterController::serviceCalibration() {
+  if (!tuner.isActive()) return;
+  if (isSensor1Active()) {
+    TRACE_TO(emitTrace, SerialOutput::NORMAL,
+             "WARNING Board on sensor 1, calibration aborted\r\n");
+    abortCalibration();
+    return;
+  }
+
+  size_t index = tuner.current();
+  Stroke stroke = static_cast<Stroke>(index);
+  bool done = index < STROKE_COUNT && strokeDone(stroke);
+  unsigned long candidateMs = tuner.candidateMs();
+  switch (tuner.poll(hal::millis(), done)) {
+    case CycleTuner::Action::EXTEND:
+      driveCylinder(stroke, true);
       break;
-    case RouterState::EJECTING:
-      Serial.println("EJECTING");
+    case CycleTuner::Action::RETRACT:
+      driveCylinder(stroke, false);
+      TRACE_TO(emitTrace, SerialOutput::DEBUG,
+               "DEBUG: %s stroke at %lu ms: %s\r\n", STROKE_NAMES[index],
+               candidateMs, done ? "complete" : "short");
       break;
-    case RouterState::LOWERING:
-      Serial.println("LOWERING");
+    case CycleTuner::Action::FINISHED:
+      finishCalibration();
       break;
-    case RouterState::ERROR:
-      Serial.println("ERROR");
+    case CycleTuner::Action::NONE:
       break;
-    default:
-      Serial.println("UNKNOWN");
+  }
+}
+
+// Tuned timings take effect at once; the rest are left as they were
+void RouterController::finishCalibration() {
+  CalibrationReport report;
+  bool tuned = false;
+  for (size_t i = 0; i < STROKE_COUNT; i++) {
+    report.results[i] = tuner.result(i);
+    if (report.results[i].status != CycleTuner::Status::TUNED) continue;
+    *strokeTiming(static_cast<Stroke>(i)) = report.results[i].recommendedMs;
+    tuned = true;
+  }
+  report.persisted = persistCalibration && tuned;
+  if (report.persisted) {
+    uint32_t timings[STROKE_COUNT];
+    for (size_t i = 0; i < STROKE_COUNT; i++) {
+      timings[i] = *strokeTiming(static_cast<Stroke>(i));
+    }
+    hal::saveTimings(timings, STROKE_COUNT);
+  }
+  if (onCalibration) onCalibration(report);
+}
+
+unsigned long* RouterController::strokeTiming(Stroke stroke) {
+  switch (stroke) {
+    case Stroke::PUSH:
+      return &pushTime;
+    case Stroke::RISER:
+      return &riserTime;
+    case Stroke::EJECTION:
       break;
   }
+  return &ejectionTime;
+}
+
+void RouterController::resetHistograms() {
+  for (Histogram& dwell : stateDwell) dwell.reset();
+  analysisRoundTrip.reset();
+  verdictLateness.reset();
+  sensorToPush.reset();
+}
+
+// Closes the dwell of the state just left
+void RouterController::enteredState() {
+  uint32_t now = hal::micros();
+  stateDwell[static_cast<size_t>(dwellState)].record(now - dwellStartUs);
+  flight::record(flight::Kind::STATE, static_cast<uint8_t>(currentState),
+                 static_cast<uint16_t>(dwellState));
+  dwellState = currentState;
+  dwellStartUs = now;
+  stateDirty = true;
+  publishState();
+}
+
+void RouterController::publishState() {
+  if (!stateDirty) return;
+  stateDirty = false;
+  broadcastState();
+}
+
+void RouterController::broadcastState() {
+  PROFILE_SCOPE("broadcastState");
+  // Add debug logging for state changes
+  TRACE_TO(emitTrace, SerialOutput::DEBUG,
+           "DEBUG: Current state: %s\r\n", routerStateToString(currentState));
 
   if (onStateChange) {
     onStateChange();
   }
-}
\ No newline at end of file
+}
+
+void RouterController::emitTrace(const trace::Record& record) {
+  if (onTrace) onTrace(record);
+}
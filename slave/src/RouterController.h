@@ -1,8 +1,13 @@
 #pragma once
 
-#include <Arduino.h>
-#include <Bounce2.h>
-
+#include "BoardPipeline.h"
+#include "CycleTuner.h"
+#include "Debouncer.h"
+#include "Hal.h"
+#include "Histogram.h"
+#include "SerialOutput.h"
+#include "StateMachine.h"
+#include "Trace.h"
 #include "config.h"
 
 enum class RouterState {
@@ -13,9 +18,76 @@ enum class RouterState {
   WAITING_FOR_ANALYSIS,
   EJECTING,
   LOWERING,
+  CAPTURING,  // Pipelined mode: riser held up for the camera
   ERROR
 };
 
+constexpr const char* ROUTER_STATE_NAMES[] = {
+    "IDLE",
+    "WAITING_FOR_PUSH",
+    "PUSHING",
+    "RAISING",
+    "WAITING_FOR_ANALYSIS",
+    "EJECTING",
+    "LOWERING",
+    "CAPTURING",
+    "ERROR",
+};
+constexpr size_t ROUTER_STATE_COUNT =
+    static_cast<size_t>(RouterState::ERROR) + 1;
+static_assert(sizeof(ROUTER_STATE_NAMES) / sizeof(ROUTER_STATE_NAMES[0]) ==
+                  ROUTER_STATE_COUNT,
+              "ROUTER_STATE_NAMES must cover every RouterState");
+
+constexpr const char* routerStateToString(RouterState state) {
+  return static_cast<size_t>(state) <= static_cast<size_t>(RouterState::ERROR)
+             ? ROUTER_STATE_NAMES[static_cast<size_t>(state)]
+             : "UNKNOWN";
+}
+
+// Cylinders with an optional end-of-stroke reed switch
+enum class Stroke : uint8_t { PUSH, RISER, EJECTION };
+constexpr size_t STROKE_COUNT = 3;
+static_assert(STROKE_COUNT == CycleTuner::TIMINGS,
+              "The tuner has a timing per stroke");
+
+// Messages the router asks the owning controller to send to the master
+enum class SlaveRequest {
+  ANALYSIS_ARM,
+  ANALYSIS_START,
+  NON_ANALYSIS_CYCLE,
+  CAPTURE_EDGE,
+};
+
+// Everything the comms side reports about the router, copied in one go so
+// it never reads controller state from the other task
+struct RouterSnapshot {
+  RouterState state;
+  bool pushCylinder;
+  bool riserCylinder;
+  bool ejectionCylinder;
+  bool sensor1;
+  unsigned long cycleCount;
+  unsigned long lastCycleTime;
+  uint32_t sensorLatencyUs;  // Sensor edge to state machine, last change
+  uint32_t sensorLatencyMaxUs;
+  unsigned long lastIdleSkipped;  // Continuous feed saving, last cycle (ms)
+  // Measured valve-on to end-of-stroke times; 0 until a switch reports
+  unsigned long strokeMs[STROKE_COUNT];
+  unsigned long strokeMaxMs[STROKE_COUNT];
+  // Verdicts dropped: for a board already given up on, for one already
+  // decided, or for no board awaiting one
+  unsigned long lateVerdicts;
+  unsigned long duplicateVerdicts;
+  unsigned long unmatchedVerdicts;
+};
+
+// Outcome of a calibration run, per stroke
+struct CalibrationReport {
+  CycleTuner::Result results[STROKE_COUNT];
+  bool persisted;
+};
+
 class RouterController {
  private:
   RouterState currentState;
@@ -27,46 +99,200 @@ class RouterController {
   unsigned long riserTime;
   unsigned long ejectionTime;
   bool analysisMode;
-  bool analysisComplete;
-  bool shouldEject;
+  bool pipelined;
+  bool requestedPipelined;  // Applied at the next cycle start
+  unsigned long captureTime;
+  unsigned long triggerLead;
+  bool staggerSolenoids;
+  unsigned long riserOverlap;  // Riser starts this long before push retract
+  unsigned long ejectOverlap;  // Ejector fires this long before riser settle
+  bool continuousFeed;
+  unsigned long analysisTimeout;
+  bool cycleAnalysed = true;  // analysisMode latched at the cycle start
+  bool abortRequested = false;
+  bool stateDirty = false;  // Cylinder/sensor change not yet published
+  unsigned long lastDispatchTime = 0;
+  unsigned long riserStartedAt = 0;
+  unsigned long ejectStartedAt = 0;
 
-  // Cylinder states
+  // Cylinder states, as driven on the pins
   bool pushCylinderState;
   bool riserCylinderState;
   bool ejectionCylinderState;
 
   bool lastSensor1State = false;
-  unsigned long lastSensor1ChangeTime = 0;
 
-  Bounce sensor1Debouncer;
+  Debouncer sensor1Debouncer;
+
+  struct StrokeInput {
+    Debouncer debouncer;
+    uint32_t startUs = 0;  // Valve switched on
+    bool running = false;
+    bool done = false;  // Confirmed since the valve switched on
+  };
+  StrokeInput strokes[STROKE_COUNT];
+  uint8_t strokeSensors = 0;  // Bit per fitted reed switch
+  unsigned long strokeMs[STROKE_COUNT] = {};
+  unsigned long strokeMaxMs[STROKE_COUNT] = {};
+  unsigned long setupTime = 0;
+  unsigned long boardSeenAt = 0;  // Sensor 1 last confirmed a board
+  // First raw edge to the loop pass that acted on the confirmed level
+  uint32_t sensorLatencyUs = 0;
+  uint32_t sensorLatencyMaxUs = 0;
+
+  // Solenoid EMI quiet window and edges staggered behind it, at most one
+  // per valve
+  struct SolenoidEdge {
+    Stroke valve;
+    bool on;
+  };
+  SolenoidEdge pendingEdges[STROKE_COUNT] = {};
+  size_t pendingEdgeCount = 0;
+  bool quietActive = false;
+  uint32_t quietStartUs = 0;
+  uint32_t quietUntilUs = 0;
 
   unsigned long cycleCount = 0;
   unsigned long lastCycleTime = 0;
+  unsigned long lastIdleSkipped = 0;
+
+  // Tail latency, read by the comms task for HIST
+  Histogram stateDwell[ROUTER_STATE_COUNT];
+  Histogram analysisRoundTrip;  // ANALYSIS_START out to the verdict in
+  Histogram sensorToPush;       // Board's raw sensor 1 edge to the push
+  Histogram verdictLateness;    // Board given up on to its verdict arriving
+  RouterState dwellState = RouterState::IDLE;
+  uint32_t dwellStartUs = 0;
+  uint32_t boardEdgeUs = 0;
 
-  void updateState();
-  void startCycle();
+  // Dry-cycle calibration of the stroke timings, run from IDLE
+  CycleTuner tuner;
+  bool persistCalibration = false;
+
+  // Boards between the riser and the ejector
+  BoardPipeline pipeline;
+  uint32_t nextBoardId = 1;
+  uint32_t strobeBoardId = 0;  // Board the pending camera strobe is for
+  unsigned long flushedBoards = 0;
+
+  // Boards that left the ejector after ANALYSIS_START, newest last, so a
+  // verdict turning up afterwards is told apart from one for no board
+  struct RetiredBoard {
+    uint32_t id;
+    uint32_t retiredUs;
+    bool answered;  // Had its verdict, or a late one has been counted
+  };
+  static constexpr size_t MAX_RETIRED_BOARDS = 8;
+  RetiredBoard retiredBoards[MAX_RETIRED_BOARDS] = {};
+  size_t retiredCount = 0;
+  unsigned long lateVerdicts = 0;
+  unsigned long duplicateVerdicts = 0;
+  unsigned long unmatchedVerdicts = 0;
+
+  // The cycle as a transition table; see RouterController.cpp
+  using Machine =
+      StateTable<RouterController, RouterState, ROUTER_STATE_COUNT>;
+  static const Machine::Transition TRANSITIONS[];
+  static const Machine::Index TRANSITION_INDEX;
+  static constexpr unsigned long STALL_TIMEOUT_MS = 10000;
+
+  void runMachine();
+  void enterError(const char* reason);
+  void switchSolenoid(Stroke valve, bool on);
+  void writeValve(Stroke valve, bool on);
+  bool cylinderState(Stroke valve) const;
+  bool valveCommanded(Stroke valve) const;
+  bool inQuietWindow() const;
+  void startQuietWindow();
+  void serviceQuietWindow();
+  void pollSensor();
+  void pollStrokes();
+  void startStroke(Stroke stroke);
+  void endStroke(Stroke stroke);
+  bool strokeDone(Stroke stroke) const {
+    return strokes[static_cast<size_t>(stroke)].done;
+  }
   void activatePushCylinder();
   void deactivatePushCylinder();
   void activateRiserCylinder();
   void deactivateRiserCylinder();
+  void activateEjectionCylinder();
+  void deactivateEjectionCylinder();
+  void driveCylinder(Stroke stroke, bool extend);
+  void serviceCalibration();
+  void finishCalibration();
+  unsigned long* strokeTiming(Stroke stroke);
+  void boardPushed();
+  void scheduleCameraTrigger();
+  void retireBoard();
+  RetiredBoard* findRetired(uint32_t id);
+  void dropVerdict(uint32_t boardId, bool duplicate);
+
+  // Guards
+  bool boardClearForAnalysis() const;
+  bool boardClear() const { return !isSensor1Active(); }
+  bool boardClearNoneInFlight() const {
+    return boardClear() && pipeline.empty();
+  }
+  bool canArm() const;
+  bool canRaiseEarly() const;
+  bool canEjectEarly() const;
+  bool ejectorBusy() const { return valveCommanded(Stroke::EJECTION); }
+  bool boardQueued() const { return continuousFeed && isSensor1Active(); }
+  bool isPipelinedCycle() const { return pipelined; }
+  bool ejectorFree() const;
+  bool verdictEject() const;
+  bool verdictPass() const;
+  bool abortPending() const { return abortRequested; }
+
+  // Timeouts, in ms since the state was entered
+  unsigned long powerSettleMs() const;
+  unsigned long pushPhaseMs() const;
+  unsigned long raiseEarlyMs() const;
+  unsigned long riserSettleMs() const;
+  unsigned long armMs() const;
+  unsigned long ejectEarlyMs() const;
+  unsigned long captureHoldMs() const;
+  unsigned long analysisTimeoutMs() const;
+  unsigned long ejectHoldMs() const;
+  unsigned long feedMs() const;
+
+  // Actions
+  void beginCycle();
+  void startRiser();
+  void raiseBoard();
+  void skipAnalysis();
+  void armAnalysis();
   void startAnalysis();
-  void handleAnalysisResponse(bool eject);
-  void abortAnalysis();
-  void startEjection();
-  void lowerAndWait();
+  void releaseBoard();
+  void ejectBoard();
+  void passBoard();
+  void dropBoard();
+  void lowerRiser();
+  void retractEjector();
+  void completeCycle();
+  void feedNextBoard();
+  void pushBoard();
+
+  void enteredState();
+  void publishState();
   void broadcastState();
+  void emitTrace(const trace::Record& record);
 
  public:
   RouterController();
   void setup();
   void loop();
+  // Microseconds until loop() has work that no wake-up will announce
+  uint32_t nextWakeUs();
 
   // Getters
   RouterState getState() const { return currentState; }
   bool isPushCylinderActive() const { return pushCylinderState; }
   bool isRiserCylinderActive() const { return riserCylinderState; }
   bool isEjectionCylinderActive() const { return ejectionCylinderState; }
-  bool isSensor1Active();
+  bool isSensor1Active() const { return sensor1Debouncer.read() == LOW; }
+  RouterSnapshot snapshot();
 
   // Settings
   void setPushTime(unsigned long timeMs) { pushTime = timeMs; }
@@ -75,15 +301,80 @@ class RouterController {
   unsigned long getRiserTime() const { return riserTime; }
   void setEjectionTime(unsigned long timeMs) { ejectionTime = timeMs; }
   void setAnalysisMode(bool enabled) { analysisMode = enabled; }
-  void handleAnalysisResult(bool eject);
+  void setPipelined(bool enabled) { requestedPipelined = enabled; }
+  void setCaptureTime(unsigned long timeMs) { captureTime = timeMs; }
+  void setTriggerLead(unsigned long timeMs) { triggerLead = timeMs; }
+  void setStaggerSolenoids(bool enabled) { staggerSolenoids = enabled; }
+  void setRiserOverlap(unsigned long timeMs) { riserOverlap = timeMs; }
+  void setEjectOverlap(unsigned long timeMs) { ejectOverlap = timeMs; }
+  void setContinuousFeed(bool enabled) { continuousFeed = enabled; }
+  void setStrokeSensors(uint8_t mask);
+  void setSensorConfirmUs(uint32_t us) { sensor1Debouncer.setConfirmUs(us); }
+  void setAnalysisTimeout(unsigned long timeMs) { analysisTimeout = timeMs; }
+  // Applied only to the board with that id while it awaits its verdict;
+  // anything else is counted and dropped
+  void handleAnalysisResult(bool eject, uint32_t boardId);
   void abortCurrentAnalysis();
+  // Only starts from IDLE with sensor 1 clear; a board arriving aborts it
+  void startCalibration(const CycleTuner::Request& request);
+  void abortCalibration();
+  bool isCalibrating() const { return tuner.isActive(); }
   unsigned long getEjectionTime() const { return ejectionTime; }
   bool isAnalysisModeEnabled() const { return analysisMode; }
+  bool isPipelined() const { return pipelined; }
+  unsigned long getCaptureTime() const { return captureTime; }
+  unsigned long getTriggerLead() const { return triggerLead; }
+  unsigned long getRiserOverlap() const { return riserOverlap; }
+  unsigned long getEjectOverlap() const { return ejectOverlap; }
+  bool isContinuousFeed() const { return continuousFeed; }
+  uint8_t getStrokeSensors() const { return strokeSensors; }
+  unsigned long getAnalysisTimeout() const { return analysisTimeout; }
+  uint32_t getSensorConfirmUs() const {
+    return sensor1Debouncer.getConfirmUs();
+  }
 
   void (*onStateChange)() =
       nullptr;  // Function pointer for state change callback
   void setStateChangeCallback(void (*callback)()) { onStateChange = callback; }
 
+  // value: ms until the riser settles for ANALYSIS_ARM, the strobe edge in
+  // micros() for CAPTURE_EDGE, otherwise 0
+  void (*onSlaveRequest)(SlaveRequest, uint32_t boardId,
+                         uint32_t value) = nullptr;
+  void setSlaveRequestCallback(
+      void (*callback)(SlaveRequest, uint32_t, uint32_t)) {
+    onSlaveRequest = callback;
+  }
+
+  // Trace records and quiet windows are handed to the comms side, which
+  // owns the serial port
+  void (*onTrace)(const trace::Record& record) = nullptr;
+  void setTraceCallback(void (*callback)(const trace::Record&)) {
+    onTrace = callback;
+  }
+
+  void (*onCalibration)(const CalibrationReport& report) = nullptr;
+  void setCalibrationCallback(void (*callback)(const CalibrationReport&)) {
+    onCalibration = callback;
+  }
+
+  void (*onQuietWindow)(uint32_t us) = nullptr;
+  void setQuietWindowCallback(void (*callback)(uint32_t)) {
+    onQuietWindow = callback;
+  }
+
+  const Histogram& getStateDwell(RouterState state) const {
+    return stateDwell[static_cast<size_t>(state)];
+  }
+  const Histogram& getAnalysisRoundTrip() const { return analysisRoundTrip; }
+  const Histogram& getSensorToPush() const { return sensorToPush; }
+  const Histogram& getVerdictLateness() const { return verdictLateness; }
+  // Control task only, like recording
+  void resetHistograms();
+
   unsigned long getCycleCount() const { return cycleCount; }
   unsigned long getLastCycleTime() const { return lastCycleTime; }
+  unsigned long getLastIdleSkipped() const { return lastIdleSkipped; }
+  size_t getBoardsInFlight() const { return pipeline.size(); }
+  unsigned long getFlushedBoards() const { return flushedBoards; }
 };
\ No newline at end of file
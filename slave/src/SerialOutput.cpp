@@ -0,0 +1,170 @@
+#include "SerialOutput.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+namespace {
+// Each queued message is prefixed with its length (u16, little-endian)
+constexpr size_t HEADER_SIZE = 2;
+}  // namespace
+
+uint8_t SerialOutput::criticalBuffer[TX_CRITICAL_BUFFER];
+uint8_t SerialOutput::normalBuffer[TX_NORMAL_BUFFER];
+uint8_t SerialOutput::debugBuffer[TX_DEBUG_BUFFER];
+
+SerialOutput serialOut;
+
+void SerialOutput::begin(unsigned long baud) {
+  hal::serialBegin(baud, TX_UART_BUFFER);
+}
+
+bool SerialOutput::write(Priority priority, const uint8_t* data,
+                         size_t length) {
+  Ring& ring = rings[priority];
+  size_t needed = length + HEADER_SIZE;
+  if (needed > ring.capacity) {
+    drops[priority]++;
+    return false;
+  }
+
+  if (priority == CRITICAL) {
+    if (ring.space() < needed) {
+      criticalStalls++;
+      while (ring.space() < needed) {
+        drain(needed, true);
+      }
+    }
+  } else if (shouldShed(priority, needed)) {
+    drops[priority]++;
+    return false;
+  }
+
+  uint8_t header[HEADER_SIZE] = {uint8_t(length), uint8_t(length >> 8)};
+  ring.put(header, HEADER_SIZE);
+  ring.put(data, length);
+  return true;
+}
+
+bool SerialOutput::print(Priority priority, const char* text) {
+  return write(priority, reinterpret_cast<const uint8_t*>(text), strlen(text));
+}
+
+bool SerialOutput::println(Priority priority, const char* text) {
+  return printf(priority, "%s\r\n", text);
+}
+
+bool SerialOutput::printf(Priority priority, const char* format, ...) {
+  char buffer[TX_MAX_MESSAGE];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (length < 0) {
+    return false;
+  }
+  // Cut short it would lose its \r\n and run into the next line
+  if (static_cast<size_t>(length) >= sizeof(buffer)) {
+    oversized++;
+    return false;
+  }
+  return write(priority, reinterpret_cast<const uint8_t*>(buffer), length);
+}
+
+void SerialOutput::pump() {
+  if (holding) {
+    if (static_cast<int32_t>(hal::micros() - holdUntilUs) < 0) return;
+    holding = false;
+  }
+  drain(hal::serialWritable(), false);
+}
+
+void SerialOutput::holdFor(uint32_t us) {
+  uint32_t until = hal::micros() + us;
+  // Overlapping windows extend the hold, never shorten it
+  if (!holding || static_cast<int32_t>(until - holdUntilUs) > 0) {
+    holdUntilUs = until;
+  }
+  holding = true;
+}
+
+uint32_t SerialOutput::nextWakeUs() const {
+  bool pending = remaining > 0;
+  for (const Ring& ring : rings) pending |= ring.used > 0;
+  if (!pending) return UINT32_MAX;
+  if (holding) {
+    int32_t leftUs = static_cast<int32_t>(holdUntilUs - hal::micros());
+    if (leftUs > 0) return leftUs;
+  }
+  return TX_PUMP_INTERVAL_US;
+}
+
+bool SerialOutput::shouldShed(Priority priority, size_t needed) const {
+  if (rings[priority].space() < needed) {
+    return true;
+  }
+  // The wire is not keeping up; keep the bandwidth for state traffic
+  const Ring& critical = rings[CRITICAL];
+  return priority == DEBUG && critical.used > critical.capacity / 4;
+}
+
+void SerialOutput::drain(size_t budget, bool block) {
+  while (budget > 0) {
+    if (remaining == 0) {
+      current = -1;
+      for (int i = 0; i < PRIORITY_COUNT; i++) {
+        if (rings[i].used > 0) {
+          current = i;
+          break;
+        }
+      }
+      if (current < 0) {
+        return;
+      }
+      uint8_t header[HEADER_SIZE];
+      rings[current].get(header, HEADER_SIZE);
+      remaining = header[0] | header[1] << 8;
+      continue;
+    }
+
+    const uint8_t* data;
+    size_t chunk = rings[current].contiguous(&data);
+    if (chunk > remaining) chunk = remaining;
+    if (chunk > budget) chunk = budget;
+
+    size_t written = hal::serialWrite(data, chunk);
+    rings[current].consume(written);
+    remaining -= written;
+    budget -= written;
+    if (written < chunk && !block) {
+      return;
+    }
+  }
+}
+
+void SerialOutput::Ring::put(const uint8_t* data, size_t length) {
+  size_t tail = (head + used) % capacity;
+  size_t first = capacity - tail;
+  if (first > length) first = length;
+  memcpy(buffer + tail, data, first);
+  memcpy(buffer, data + first, length - first);
+  used += length;
+}
+
+void SerialOutput::Ring::get(uint8_t* data, size_t length) {
+  size_t first = capacity - head;
+  if (first > length) first = length;
+  memcpy(data, buffer + head, first);
+  memcpy(data + first, buffer, length - first);
+  consume(length);
+}
+
+size_t SerialOutput::Ring::contiguous(const uint8_t** data) const {
+  *data = buffer + head;
+  size_t run = capacity - head;
+  return run < used ? run : used;
+}
+
+void SerialOutput::Ring::consume(size_t length) {
+  head = (head + length) % capacity;
+  used -= length;
+}
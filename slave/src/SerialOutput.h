@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string.h>
+
+#include "Hal.h"
+#include "config.h"
+
+// Prioritized, non-blocking serial output. Messages are queued whole into one
+// ring per priority and pump() hands as many bytes to the UART driver as it
+// can take without waiting. Messages never interleave on the wire.
+//
+// CRITICAL (state, analysis requests, errors) is never dropped; if its ring
+// fills the writer waits for the wire and the stall is counted. NORMAL is
+// dropped when its ring is full. DEBUG is shed first: it is also dropped as
+// soon as the critical backlog starts building up.
+class SerialOutput {
+ public:
+  enum Priority : uint8_t { CRITICAL, NORMAL, DEBUG, PRIORITY_COUNT };
+
+  // constexpr so the queue is usable from other globals' constructors
+  constexpr SerialOutput()
+      : rings{{criticalBuffer, TX_CRITICAL_BUFFER, 0, 0},
+              {normalBuffer, TX_NORMAL_BUFFER, 0, 0},
+              {debugBuffer, TX_DEBUG_BUFFER, 0, 0}},
+        current(-1),
+        remaining(0),
+        drops{},
+        criticalStalls(0),
+        oversized(0),
+        holding(false),
+        holdUntilUs(0) {}
+
+  void begin(unsigned long baud);
+
+  bool write(Priority priority, const uint8_t* data, size_t length);
+  bool print(Priority priority, const char* text);
+  bool println(Priority priority, const char* text);
+  bool printf(Priority priority, const char* format, ...)
+      __attribute__((format(printf, 3, 4)));
+
+  // Moves queued bytes into the UART driver. Never blocks.
+  void pump();
+  // Defers pump() for the next us microseconds (solenoid EMI window).
+  // Messages still queue; bytes already in the driver keep going out.
+  void holdFor(uint32_t us);
+  // Microseconds until pump() can make progress; UINT32_MAX when idle
+  uint32_t nextWakeUs() const;
+
+  // Bytes a priority can queue right now, length headers included
+  size_t space(Priority priority) const { return rings[priority].space(); }
+  unsigned long getDrops(Priority priority) const { return drops[priority]; }
+  unsigned long getCriticalStalls() const { return criticalStalls; }
+  // Lines refused for being longer than TX_MAX_MESSAGE
+  unsigned long getOversized() const { return oversized; }
+
+ private:
+  struct Ring {
+    uint8_t* buffer;
+    size_t capacity;
+    size_t head;
+    size_t used;
+
+    size_t space() const { return capacity - used; }
+    void put(const uint8_t* data, size_t length);
+    void get(uint8_t* data, size_t length);
+    size_t contiguous(const uint8_t** data) const;
+    void consume(size_t length);
+  };
+
+  bool shouldShed(Priority priority, size_t needed) const;
+  // Writes at most budget bytes; with block set, waits on the UART instead.
+  void drain(size_t budget, bool block);
+
+  static uint8_t criticalBuffer[TX_CRITICAL_BUFFER];
+  static uint8_t normalBuffer[TX_NORMAL_BUFFER];
+  static uint8_t debugBuffer[TX_DEBUG_BUFFER];
+
+  Ring rings[PRIORITY_COUNT];
+  // Message currently being written to the UART
+  int current;
+  size_t remaining;
+
+  unsigned long drops[PRIORITY_COUNT];
+  unsigned long criticalStalls;
+  unsigned long oversized;
+
+  bool holding;
+  uint32_t holdUntilUs;
+};
+
+extern SerialOutput serialOut;
@@ -1,116 +1,399 @@
 #include "SlaveController.h"
 
-#include <EEPROM.h>
-#define BOOT_COUNT_ADDR 0
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include "Deadline.h"
+#include "Profiler.h"
+#include "SerialOutput.h"
 #define HEARTBEAT_INTERVAL 1000  // Send heartbeat every 1 second
+#define SERIAL_CHECK_INTERVAL 1000
+#define MEM_CHECK_INTERVAL 10000
+
+namespace {
+
+constexpr const char* CALIBRATION_STATUS_NAMES[] = {"TUNED", "NO_FEEDBACK",
+                                                    "FAILED", "ABORTED"};
+// CALIBRATION JSON keys per stroke: status, minimum, recommended timing
+constexpr const char* CALIBRATION_KEYS[STROKE_COUNT][3] = {
+    {"push_status", "push_min_ms", "push_ms"},
+    {"riser_status", "riser_min_ms", "riser_ms"},
+    {"ejection_status", "ejection_min_ms", "ejection_ms"},
+};
 
-#include <esp_system.h>
+// HIST ids after the per-state dwell histograms, which use the RouterState
+enum class HistogramId : uint8_t {
+  ANALYSIS_ROUND_TRIP = ROUTER_STATE_COUNT,
+  SENSOR_TO_PUSH,
+  WAKE_LATENCY,
+  CONTROL_PASS,
+  COMMS_PASS,
+  LATE_VERDICT,
+  COUNT,
+};
+constexpr const char* HISTOGRAM_NAMES[] = {
+    "ANALYSIS_ROUND_TRIP", "SENSOR_TO_PUSH", "WAKE_LATENCY", "CONTROL_PASS",
+    "COMMS_PASS",          "LATE_VERDICT"};
+
+constexpr const char* STALL_TASK_NAMES[] = {"control", "comms"};
+constexpr const char* STALL_ACTIVITY_NAMES[] = {
+    "ROUTER",    "COMMAND",   "UART_READ",   "SERIALIZE",  "UART_WRITE",
+    "EVENTS",    "HEARTBEAT", "HEAP_REPORT", "SERIAL_LINK"};
+static_assert(sizeof(STALL_ACTIVITY_NAMES) / sizeof(*STALL_ACTIVITY_NAMES) ==
+                  static_cast<size_t>(StallMonitor::Activity::COUNT),
+              "a name per stall activity");
+
+constexpr const char* FLIGHT_KIND_NAMES[] = {"BOOT", "STATE", "VALVE",
+                                             "COMMAND", "STALL"};
+static_assert(sizeof(FLIGHT_KIND_NAMES) / sizeof(*FLIGHT_KIND_NAMES) ==
+                  static_cast<size_t>(flight::Kind::COUNT),
+              "a name per flight recorder event");
+// CommandEvent::Kind
+constexpr const char* COMMAND_NAMES[] = {
+    "ANALYSIS_RESULT", "ABORT_ANALYSIS",    "SETTING",
+    "CALIBRATE",       "ABORT_CALIBRATION", "RESET_HISTOGRAMS",
+    "RESET_PROFILE"};
+static_assert(sizeof(COMMAND_NAMES) / sizeof(*COMMAND_NAMES) ==
+                  static_cast<size_t>(CommandEvent::Kind::RESET_PROFILE) + 1,
+              "a name per command event");
+// NORMAL queue room a FLIGHT line needs; the dump waits for it
+constexpr size_t FLIGHT_LINE_ROOM = 160;
+
+// Recorded indexes may come from another firmware build
+template <size_t N>
+const char* nameOf(const char* const (&names)[N], size_t index) {
+  return index < N ? names[index] : "UNKNOWN";
+}
+
+}  // namespace
 
 SlaveController* SlaveController::instance = nullptr;
 
-String routerStateToString(RouterState state) {
-  switch (state) {
-    case RouterState::IDLE:
-      return "IDLE";
-    case RouterState::WAITING_FOR_PUSH:
-      return "WAITING_FOR_PUSH";
-    case RouterState::PUSHING:
-      return "PUSHING";
-    case RouterState::RAISING:
-      return "RAISING";
-    case RouterState::WAITING_FOR_ANALYSIS:
-      return "WAITING_FOR_ANALYSIS";
-    case RouterState::EJECTING:
-      return "EJECTING";
-    case RouterState::LOWERING:
-      return "LOWERING";
-    case RouterState::ERROR:
-      return "ERROR";
-    default:
-      return "UNKNOWN";
+void SlaveController::queueForComms(ControlEvent& event) {
+  event.seq = eventSeq++;
+  if (event.kind == ControlEvent::Kind::TRACE ||
+      event.kind == ControlEvent::Kind::STALL) {
+    link.toCommsLog.push(event);
+  } else {
+    link.toComms.push(event);
   }
+  hal::wake(hal::WakeTarget::COMMS);
 }
 
-void SlaveController::staticSendState() { instance->sendState(); }
+void SlaveController::staticSendState() {
+  ControlEvent event;
+  event.kind = ControlEvent::Kind::STATE;
+  event.state = instance->router.snapshot();
+  instance->queueForComms(event);
+}
 
-SlaveController::SlaveController() : currentStatus(Status::IDLE) {
+void SlaveController::staticSendRequest(SlaveRequest request,
+                                        uint32_t boardId, uint32_t value) {
+  ControlEvent event;
+  event.kind = ControlEvent::Kind::REQUEST;
+  event.request.request = request;
+  event.request.boardId = boardId;
+  event.request.value = value;
+  instance->queueForComms(event);
+}
+
+void SlaveController::staticTrace(const trace::Record& record) {
+  ControlEvent event;
+  event.kind = ControlEvent::Kind::TRACE;
+  event.trace = record;
+  instance->queueForComms(event);
+}
+
+void SlaveController::staticQuietWindow(uint32_t us) {
+  ControlEvent event;
+  event.kind = ControlEvent::Kind::QUIET_WINDOW;
+  event.quietUs = us;
+  instance->queueForComms(event);
+}
+
+void SlaveController::staticCalibration(const CalibrationReport& report) {
+  ControlEvent event;
+  event.kind = ControlEvent::Kind::CALIBRATION;
+  event.calibration = report;
+  instance->queueForComms(event);
+}
+
+SlaveController::SlaveController()
+    : eventSeq(0),
+      currentStatus(Status::IDLE),
+      binaryMode(false),
+      txSeq(0),
+      oversizedFrames(0),
+      controlMonitor(StallMonitor::Task::CONTROL),
+      commsMonitor(StallMonitor::Task::COMMS),
+      dumping(false),
+      reportedEventDrops(0) {
   instance = this;
   settings.pushTime = DEFAULT_PUSH_TIME;
   settings.riserTime = DEFAULT_RISER_TIME;
+  settings.pipelined = false;
+  settings.captureTime = DEFAULT_CAPTURE_TIME;
+  settings.triggerLead = DEFAULT_TRIGGER_LEAD;
+  settings.staggerSolenoids = DEFAULT_STAGGER_SOLENOIDS;
+  settings.sensorConfirmUs = DEFAULT_SENSOR_CONFIRM_US;
+  settings.riserOverlap = DEFAULT_RISER_OVERLAP;
+  settings.ejectOverlap = DEFAULT_EJECT_OVERLAP;
+  settings.continuousFeed = DEFAULT_CONTINUOUS_FEED;
+  settings.strokeSensors = DEFAULT_STROKE_SENSORS;
+  settings.logLevel = trace::getMaxPriority();
+  settings.analysisTimeout = DEFAULT_ANALYSIS_TIMEOUT;
   lastHeartbeatTime = 0;
+  lastSerialCheck = 0;
+  lastMemCheck = 0;
+  serialRestartAt = 0;
 
   // Read and increment boot count
-  EEPROM.begin(4);
-  bootCount = EEPROM.read(BOOT_COUNT_ADDR);
-  bootCount++;
-  EEPROM.write(BOOT_COUNT_ADDR, bootCount);
-  EEPROM.commit();
+  bootCount = hal::incrementBootCount();
 
   // Log boot count
-  Serial.print("DEBUG: Boot count: ");
-  Serial.println(bootCount);
+  TRACE_TO(sendTrace, SerialOutput::DEBUG, "DEBUG: Boot count: %lu\r\n",
+           bootCount);
 
   router.setStateChangeCallback(&SlaveController::staticSendState);
+  router.setSlaveRequestCallback(&SlaveController::staticSendRequest);
+  router.setTraceCallback(&SlaveController::staticTrace);
+  router.setQuietWindowCallback(&SlaveController::staticQuietWindow);
+  router.setCalibrationCallback(&SlaveController::staticCalibration);
 }
 
 void SlaveController::setup() {
-  // Add power stabilization delay on boot
-  delay(100);  // Let power stabilize
-  Serial.begin(BAUD_RATE);
+  flight::begin(static_cast<uint8_t>(hal::resetReason()), bootCount);
+  // The router ignores the sensor for POWER_SETTLE_TIME instead of the
+  // boot stalling here
   router.setup();
+  lastState = router.snapshot();
+  // setup() may have loaded calibrated timings
+  settings.pushTime = router.getPushTime();
+  settings.riserTime = router.getRiserTime();
+  settings.ejectionTime = router.getEjectionTime();
 }
 
 void SlaveController::loop() {
-  static unsigned long lastSerialCheck = 0;
-  const unsigned long currentTime = millis();
+  PROFILE_SCOPE("loop");
+  controlStep();
+  commsStep();
+}
 
-  // Monitor serial connection every second
-  if (currentTime - lastSerialCheck >= 1000) {
-    if (!Serial) {
-      Serial.end();
-      delay(100);
-      Serial.begin(BAUD_RATE);
-      Serial.println("DEBUG: Serial connection reestablished");
+uint32_t SlaveController::nextWakeUs() {
+  uint32_t controlUs = controlWakeUs();
+  uint32_t commsUs = commsWakeUs();
+  return controlUs < commsUs ? controlUs : commsUs;
+}
+
+uint32_t SlaveController::controlWakeUs() {
+  return link.toControl.empty() ? router.nextWakeUs() : 0;
+}
+
+uint32_t SlaveController::commsWakeUs() {
+  if (!link.toComms.empty() || !link.toCommsLog.empty() ||
+      reader.available()) {
+    return 0;
+  }
+  if (dumping &&
+      serialOut.space(SerialOutput::NORMAL) >= FLIGHT_LINE_ROOM) {
+    return 0;
+  }
+  Deadline deadline(MAX_SLEEP_US);
+  deadline.inUs(serialOut.nextWakeUs());
+  deadline.afterMs(lastHeartbeatTime, HEARTBEAT_INTERVAL);
+  deadline.afterMs(lastMemCheck, MEM_CHECK_INTERVAL);
+  if (serialRestartAt) {
+    deadline.afterMs(serialRestartAt, SERIAL_RESTART_DELAY);
+  } else {
+    deadline.afterMs(lastSerialCheck, SERIAL_CHECK_INTERVAL);
+  }
+  return deadline.us();
+}
+
+void SlaveController::recordWakeLatency(uint32_t us) {
+  wakeLatency.record(us);
+}
+
+void SlaveController::controlStep() {
+  PROFILE_SCOPE("controlStep");
+  controlMonitor.begin(StallMonitor::Activity::COMMAND);
+  CommandEvent command;
+  while (link.toControl.pop(command)) {
+    applyCommand(command);
+  }
+  controlMonitor.mark(StallMonitor::Activity::ROUTER);
+  router.loop();
+
+  StallMonitor::Stall stall;
+  if (controlMonitor.end(stall)) {
+    ControlEvent event;
+    event.kind = ControlEvent::Kind::STALL;
+    event.stall = stall;
+    queueForComms(event);
+  }
+}
+
+void SlaveController::applyCommand(const CommandEvent& command) {
+  const auto kind = static_cast<uint8_t>(command.kind);
+  if (command.kind == CommandEvent::Kind::ANALYSIS_RESULT) {
+    flight::record(flight::Kind::COMMAND, kind, command.eject,
+                   command.boardId);
+  } else {
+    flight::record(flight::Kind::COMMAND, kind, command.key, command.value);
+  }
+  switch (command.kind) {
+    case CommandEvent::Kind::ANALYSIS_RESULT:
+      router.handleAnalysisResult(command.eject, command.boardId);
+      break;
+    case CommandEvent::Kind::ABORT_ANALYSIS:
+      router.abortCurrentAnalysis();
+      break;
+    case CommandEvent::Kind::SETTING:
+      applyRouterSetting(static_cast<protocol::SettingKey>(command.key),
+                         command.value);
+      break;
+    case CommandEvent::Kind::CALIBRATE:
+      router.startCalibration(command.calibrate);
+      break;
+    case CommandEvent::Kind::ABORT_CALIBRATION:
+      router.abortCalibration();
+      break;
+    case CommandEvent::Kind::RESET_HISTOGRAMS:
+      router.resetHistograms();
+      wakeLatency.reset();
+      controlMonitor.resetPassTime();
+      break;
+    case CommandEvent::Kind::RESET_PROFILE:
+#ifdef PROFILER_ENABLED
+      profiler::reset();
+#endif
+      break;
+  }
+}
+
+void SlaveController::commsStep() {
+  PROFILE_SCOPE("commsStep");
+  commsMonitor.begin(StallMonitor::Activity::SERIAL_LINK);
+  const unsigned long currentTime = hal::millis();
+
+  // Monitor serial connection every second; the restart completes on a
+  // later pass so the control loop never waits for the UART
+  if (serialRestartAt &&
+      currentTime - serialRestartAt >= SERIAL_RESTART_DELAY) {
+    serialOut.begin(BAUD_RATE);
+    TRACE_TO(sendTrace, SerialOutput::DEBUG,
+             "DEBUG: Serial connection reestablished\r\n");
+    serialRestartAt = 0;
+  } else if (!serialRestartAt &&
+             currentTime - lastSerialCheck >= SERIAL_CHECK_INTERVAL) {
+    if (!hal::serialConnected()) {
+      hal::serialEnd();
+      serialRestartAt = currentTime ? currentTime : 1;
     }
     lastSerialCheck = currentTime;
   }
 
   // Add memory monitoring
-  static unsigned long lastMemCheck = 0;
-  if (currentTime - lastMemCheck >= 10000) {  // Check every 10 seconds
-    Serial.printf("DEBUG: Free heap: %d, Largest block: %d\n",
-                  ESP.getFreeHeap(), ESP.getMaxAllocHeap());
+  commsMonitor.mark(StallMonitor::Activity::HEAP_REPORT);
+  if (currentTime - lastMemCheck >= MEM_CHECK_INTERVAL) {
+    TRACE_TO(sendTrace, SerialOutput::DEBUG,
+             "DEBUG: Free heap: %lu, Largest block: %lu\r\n",
+             static_cast<unsigned long>(hal::freeHeap()),
+             static_cast<unsigned long>(hal::maxAllocHeap()));
     lastMemCheck = currentTime;
   }
 
   // Send heartbeat with more debug info
+  commsMonitor.mark(StallMonitor::Activity::HEARTBEAT);
   if (currentTime - lastHeartbeatTime >= HEARTBEAT_INTERVAL) {
-    // Add more diagnostic info to heartbeat
-    StaticJsonDocument<200> doc;
-    doc["type"] = "heartbeat";
-    doc["uptime"] = millis();
-    doc["boot_count"] = bootCount;
-    doc["free_heap"] = ESP.getFreeHeap();
-    doc["router_state"] = routerStateToString(router.getState());
-    doc["last_error"] = esp_reset_reason();
-    doc["cycle_count"] =
-        router.getCycleCount();  // Add this to RouterController
-    doc["last_cycle_time"] =
-        router.getLastCycleTime();  // Add this to RouterController
-
-    String output;
-    serializeJson(doc, output);
-    Serial.println("HEARTBEAT " + output);
+    sendHeartbeat();
     lastHeartbeatTime = currentTime;
   }
 
-  if (Serial.available()) {
-    String input = Serial.readStringUntil('\n');
-    input.trim();
+  commsMonitor.mark(StallMonitor::Activity::UART_READ);
+  pollSerial();
+  commsMonitor.mark(StallMonitor::Activity::EVENTS);
+  dispatchControlEvents();
+  commsMonitor.mark(StallMonitor::Activity::SERIALIZE);
+  streamDump();
+  commsMonitor.mark(StallMonitor::Activity::UART_WRITE);
+  serialOut.pump();
+
+  // Reported after the pass so the report is not part of it
+  StallMonitor::Stall stall;
+  if (commsMonitor.end(stall)) noteStall(stall);
+}
+
+// Oldest first across both queues, so the output keeps the control task's
+// order
+bool SlaveController::popControlEvent(ControlEvent& event) {
+  const ControlEvent* essential = link.toComms.peek();
+  const ControlEvent* log = link.toCommsLog.peek();
+  if (log && (!essential ||
+              static_cast<int32_t>(log->seq - essential->seq) < 0)) {
+    return link.toCommsLog.pop(event);
+  }
+  return link.toComms.pop(event);
+}
+
+void SlaveController::dispatchControlEvents() {
+  // Only a stalled comms task lets the essential queue fill
+  unsigned long drops = link.toComms.getDrops();
+  if (drops != reportedEventDrops) {
+    sendWarning("Control events dropped: %lu", drops - reportedEventDrops);
+    reportedEventDrops = drops;
+  }
+  ControlEvent event;
+  while (popControlEvent(event)) {
+    switch (event.kind) {
+      case ControlEvent::Kind::STATE:
+        lastState = event.state;
+        sendState();
+        break;
+      case ControlEvent::Kind::REQUEST:
+        sendRequest(event.request.request, event.request.boardId,
+                    event.request.value);
+        break;
+      case ControlEvent::Kind::TRACE:
+        sendTrace(event.trace);
+        break;
+      case ControlEvent::Kind::QUIET_WINDOW:
+        serialOut.holdFor(event.quietUs);
+        break;
+      case ControlEvent::Kind::CALIBRATION:
+        sendCalibration(event.calibration);
+        break;
+      case ControlEvent::Kind::STALL:
+        noteStall(event.stall);
+        break;
+    }
+  }
+}
+
+void SlaveController::sendCommand(const CommandEvent& command) {
+  if (!link.toControl.push(command)) {
+    sendWarning("Control queue full, command dropped");
+    return;
+  }
+  hal::wake(hal::WakeTarget::CONTROL);
+}
+
+void SlaveController::pollSerial() {
+  // Drain whatever the UART holds without waiting for a full line
+  int byte;
+  while ((byte = hal::serialRead()) >= 0) {
+    reader.feed(static_cast<uint8_t>(byte));
+  }
 
-    if (input.startsWith("SETTINGS ")) {
+  commsMonitor.mark(StallMonitor::Activity::COMMAND);
+
+  for (int i = 0; i < MAX_COMMANDS_PER_LOOP && reader.available(); i++) {
+    CommandReader::Message& message = reader.front();
+    if (message.frame) {
+      handleFrame(reinterpret_cast<uint8_t*>(message.data), message.length);
+    } else if (strncmp(message.data, "SETTINGS ", 9) == 0) {
       StaticJsonDocument<200> doc;
-      DeserializationError error = deserializeJson(doc, input.substring(9));
+      DeserializationError error = deserializeJson(doc, message.data + 9);
 
       if (error) {
         sendError("Failed to parse settings");
@@ -118,100 +401,812 @@ void SlaveController::loop() {
         updateSettings(doc.as<JsonObject>());
       }
     } else {
-      processCommand(input);
+      processCommand(message.data);
     }
+    reader.pop();
   }
-
-  // Update router state
-  router.loop();
 }
 
-void SlaveController::processCommand(const String& command) {
-  if (command == "STATUS") {
+void SlaveController::processCommand(const char* command) {
+  PROFILE_SCOPE("processCommand");
+  if (strcmp(command, "STATUS") == 0) {
     sendState();
-  } else if (command == "ABORT_ANALYSIS") {
-    router.abortCurrentAnalysis();
-  } else if (command.startsWith("ANALYSIS_RESULT ")) {
-    String result = command.substring(15);
-    result.trim();
-    bool shouldEject = (result == "TRUE");
-
-    Serial.print("DEBUG: Analysis result received. Raw value: '");
-    Serial.print(result);
-    Serial.println("'");
-    Serial.println(shouldEject ? "Decision: EJECT" : "Decision: PASS");
-
-    router.handleAnalysisResult(shouldEject);
+  } else if (strcmp(command, "PROTOCOL BINARY") == 0) {
+    binaryMode = true;
+    serialOut.println(SerialOutput::CRITICAL, "PROTOCOL BINARY");
+  } else if (strcmp(command, "PROTOCOL TEXT") == 0) {
+    binaryMode = false;
+    serialOut.println(SerialOutput::CRITICAL, "PROTOCOL TEXT");
+  } else if (strcmp(command, "HIST") == 0) {
+    sendHistograms(false);
+  } else if (strcmp(command, "HIST RESET") == 0) {
+    sendHistograms(true);
+  } else if (strcmp(command, "PROFILE") == 0) {
+    sendProfile(false);
+  } else if (strcmp(command, "PROFILE RESET") == 0) {
+    sendProfile(true);
+  } else if (strcmp(command, "STALLS") == 0) {
+    sendStalls(false);
+  } else if (strcmp(command, "STALLS RESET") == 0) {
+    sendStalls(true);
+  } else if (strcmp(command, "DUMP_TRACE") == 0) {
+    startDump();
+  } else if (strcmp(command, "CALIBRATE ABORT") == 0) {
+    CommandEvent abort = {};
+    abort.kind = CommandEvent::Kind::ABORT_CALIBRATION;
+    sendCommand(abort);
+  } else if (strncmp(command, "CALIBRATE", 9) == 0 &&
+             (command[9] == '\0' || command[9] == ' ')) {
+    // CALIBRATE [{"cycles":N,"stepMs":N,"marginPercent":N,"persist":B}]
+    CycleTuner::Request request = {CALIBRATION_CYCLES, CALIBRATION_STEP_MS,
+                                   CALIBRATION_MARGIN_PERCENT, false};
+    const char* options = command + 9;
+    while (*options == ' ') options++;
+    if (*options) {
+      StaticJsonDocument<200> doc;
+      if (deserializeJson(doc, options)) {
+        sendError("Failed to parse calibration options");
+        return;
+      }
+      JsonObject json = doc.as<JsonObject>();
+      if (json.containsKey("cycles")) request.cycles = json["cycles"];
+      if (json.containsKey("stepMs")) request.stepMs = json["stepMs"];
+      if (json.containsKey("marginPercent")) {
+        request.marginPercent = json["marginPercent"];
+      }
+      if (json.containsKey("persist")) request.persist = json["persist"];
+    }
+    startCalibration(request);
+  } else if (strcmp(command, "ABORT_ANALYSIS") == 0) {
+    CommandEvent abort = {};
+    abort.kind = CommandEvent::Kind::ABORT_ANALYSIS;
+    sendCommand(abort);
+  } else if (strncmp(command, "ANALYSIS_RESULT ", 16) == 0) {
+    // ANALYSIS_RESULT <TRUE|FALSE> <board id>; without the id the router
+    // drops it
+    const char* result = command + 16;
+    while (*result == ' ') result++;
+    const char* idText = strchr(result, ' ');
+    size_t resultLength = idText ? idText - result : strlen(result);
+    bool shouldEject = resultLength == 4 && strncmp(result, "TRUE", 4) == 0;
+    uint32_t boardId = idText ? strtoul(idText, nullptr, 10) : 0;
+
+    TRACE_TO(sendTrace, SerialOutput::DEBUG,
+             "DEBUG: Analysis result received. Raw value: '%s'\r\n", result);
+    TRACE_TO(sendTrace, SerialOutput::DEBUG, "Decision: %s\r\n",
+             shouldEject ? "EJECT" : "PASS");
+
+    CommandEvent verdict = {};
+    verdict.kind = CommandEvent::Kind::ANALYSIS_RESULT;
+    verdict.eject = shouldEject;
+    verdict.boardId = boardId;
+    sendCommand(verdict);
   } else {
-    sendError("Unknown command: " + command);
+    sendError("Unknown command: %s", command);
   }
 }
 
-void SlaveController::updateSettings(const JsonObject& json) {
-  if (json.containsKey("pushTime")) {
-    settings.pushTime = json["pushTime"];
-    router.setPushTime(settings.pushTime);
+void SlaveController::handleFrame(uint8_t* buf, size_t length) {
+  protocol::Frame frame;
+  if (!protocol::decodeFrame(buf, length, frame)) {
+    sendError("Corrupt frame");
+    return;
+  }
+
+  protocol::PayloadReader reader(frame.payload, frame.length);
+  switch (frame.type) {
+    case protocol::MessageType::ANALYSIS_RESULT: {
+      // [eject u8][board id u32]
+      uint8_t eject;
+      uint32_t boardId = 0;
+      if (reader.u8(eject)) {
+        reader.u32(boardId);
+        TRACE_TO(sendTrace, SerialOutput::DEBUG,
+                 "DEBUG: Analysis result received. Board %lu: %s\r\n",
+                 static_cast<unsigned long>(boardId),
+                 eject ? "EJECT" : "PASS");
+        CommandEvent verdict = {};
+        verdict.kind = CommandEvent::Kind::ANALYSIS_RESULT;
+        verdict.eject = eject != 0;
+        verdict.boardId = boardId;
+        sendCommand(verdict);
+      }
+      break;
+    }
+    case protocol::MessageType::CALIBRATE: {
+      // [cycles u16][step ms u16][margin % u8][persist u8], each optional;
+      // cycles 0 aborts a running calibration
+      CycleTuner::Request request = {CALIBRATION_CYCLES, CALIBRATION_STEP_MS,
+                                     CALIBRATION_MARGIN_PERCENT, false};
+      uint8_t persist = 0;
+      if (reader.u16(request.cycles) && request.cycles == 0) {
+        CommandEvent abort = {};
+        abort.kind = CommandEvent::Kind::ABORT_CALIBRATION;
+        sendCommand(abort);
+        break;
+      }
+      if (reader.u16(request.stepMs) && reader.u8(request.marginPercent) &&
+          reader.u8(persist)) {
+        request.persist = persist != 0;
+      }
+      startCalibration(request);
+      break;
+    }
+    case protocol::MessageType::HIST: {
+      // [reset u8, optional]
+      uint8_t reset = 0;
+      reader.u8(reset);
+      sendHistograms(reset != 0);
+      break;
+    }
+    case protocol::MessageType::SETTINGS: {
+      uint8_t key;
+      uint32_t value;
+      while (reader.u8(key) && reader.u32(value)) {
+        applySetting(static_cast<protocol::SettingKey>(key), value);
+      }
+      break;
+    }
+    default:
+      sendError("Unexpected frame type");
+      break;
   }
-  if (json.containsKey("riserTime")) {
-    settings.riserTime = json["riserTime"];
-    router.setRiserTime(settings.riserTime);
+}
+
+// Comms side: remember the value for reporting and hand it to the control
+// task, which owns the router
+void SlaveController::applySetting(protocol::SettingKey key, uint32_t value) {
+  switch (key) {
+    case protocol::SettingKey::PUSH_TIME:
+      settings.pushTime = value;
+      break;
+    case protocol::SettingKey::RISER_TIME:
+      settings.riserTime = value;
+      break;
+    case protocol::SettingKey::EJECTION_TIME:
+      settings.ejectionTime = value;
+      break;
+    case protocol::SettingKey::ANALYSIS_MODE:
+      settings.analysisMode = value != 0;
+      break;
+    case protocol::SettingKey::PIPELINED:
+      settings.pipelined = value != 0;
+      break;
+    case protocol::SettingKey::CAPTURE_TIME:
+      settings.captureTime = value;
+      break;
+    case protocol::SettingKey::TRIGGER_LEAD:
+      settings.triggerLead = value;
+      break;
+    case protocol::SettingKey::STAGGER_SOLENOIDS:
+      settings.staggerSolenoids = value != 0;
+      break;
+    case protocol::SettingKey::SENSOR_CONFIRM_US:
+      settings.sensorConfirmUs = value;
+      break;
+    case protocol::SettingKey::RISER_OVERLAP:
+      settings.riserOverlap = value;
+      break;
+    case protocol::SettingKey::EJECT_OVERLAP:
+      settings.ejectOverlap = value;
+      break;
+    case protocol::SettingKey::CONTINUOUS_FEED:
+      settings.continuousFeed = value != 0;
+      break;
+    case protocol::SettingKey::STROKE_SENSORS:
+      settings.strokeSensors = value;
+      break;
+    case protocol::SettingKey::LOG_LEVEL:
+      // Both tasks read it directly; traces above it are never packed
+      settings.logLevel = value;
+      trace::setMaxPriority(settings.logLevel);
+      return;
+    case protocol::SettingKey::ANALYSIS_TIMEOUT:
+      settings.analysisTimeout = value;
+      break;
+    default:
+      return;
   }
-  if (json.containsKey("ejectionTime")) {
-    settings.ejectionTime = json["ejectionTime"];
-    router.setEjectionTime(settings.ejectionTime);
+
+  CommandEvent command = {};
+  command.kind = CommandEvent::Kind::SETTING;
+  command.key = static_cast<uint8_t>(key);
+  command.value = value;
+  sendCommand(command);
+}
+
+void SlaveController::applyRouterSetting(protocol::SettingKey key,
+                                         uint32_t value) {
+  switch (key) {
+    case protocol::SettingKey::PUSH_TIME:
+      router.setPushTime(value);
+      break;
+    case protocol::SettingKey::RISER_TIME:
+      router.setRiserTime(value);
+      break;
+    case protocol::SettingKey::EJECTION_TIME:
+      router.setEjectionTime(value);
+      break;
+    case protocol::SettingKey::ANALYSIS_MODE:
+      router.setAnalysisMode(value != 0);
+      break;
+    case protocol::SettingKey::PIPELINED:
+      router.setPipelined(value != 0);
+      break;
+    case protocol::SettingKey::CAPTURE_TIME:
+      router.setCaptureTime(value);
+      break;
+    case protocol::SettingKey::TRIGGER_LEAD:
+      router.setTriggerLead(value);
+      break;
+    case protocol::SettingKey::STAGGER_SOLENOIDS:
+      router.setStaggerSolenoids(value != 0);
+      break;
+    case protocol::SettingKey::SENSOR_CONFIRM_US:
+      router.setSensorConfirmUs(value);
+      break;
+    case protocol::SettingKey::RISER_OVERLAP:
+      router.setRiserOverlap(value);
+      break;
+    case protocol::SettingKey::EJECT_OVERLAP:
+      router.setEjectOverlap(value);
+      break;
+    case protocol::SettingKey::CONTINUOUS_FEED:
+      router.setContinuousFeed(value != 0);
+      break;
+    case protocol::SettingKey::STROKE_SENSORS:
+      router.setStrokeSensors(value);
+      break;
+    case protocol::SettingKey::ANALYSIS_TIMEOUT:
+      router.setAnalysisTimeout(value);
+      break;
+    default:
+      break;
   }
-  if (json.containsKey("analysisMode")) {
-    settings.analysisMode = json["analysisMode"];
-    router.setAnalysisMode(settings.analysisMode);
+}
+
+void SlaveController::updateSettings(const JsonObject& json) {
+  // JSON names for the binary SETTINGS keys
+  static constexpr struct {
+    const char* name;
+    protocol::SettingKey key;
+  } FIELDS[] = {
+      {"pushTime", protocol::SettingKey::PUSH_TIME},
+      {"riserTime", protocol::SettingKey::RISER_TIME},
+      {"ejectionTime", protocol::SettingKey::EJECTION_TIME},
+      {"analysisMode", protocol::SettingKey::ANALYSIS_MODE},
+      {"pipelined", protocol::SettingKey::PIPELINED},
+      {"captureTime", protocol::SettingKey::CAPTURE_TIME},
+      {"triggerLead", protocol::SettingKey::TRIGGER_LEAD},
+      {"staggerSolenoids", protocol::SettingKey::STAGGER_SOLENOIDS},
+      {"sensorConfirmUs", protocol::SettingKey::SENSOR_CONFIRM_US},
+      {"riserOverlap", protocol::SettingKey::RISER_OVERLAP},
+      {"ejectOverlap", protocol::SettingKey::EJECT_OVERLAP},
+      {"continuousFeed", protocol::SettingKey::CONTINUOUS_FEED},
+      {"strokeSensors", protocol::SettingKey::STROKE_SENSORS},
+      {"logLevel", protocol::SettingKey::LOG_LEVEL},
+      {"analysisTimeout", protocol::SettingKey::ANALYSIS_TIMEOUT},
+  };
+  for (const auto& field : FIELDS) {
+    if (!json.containsKey(field.name)) continue;
+    // Booleans read back as 0/1
+    applySetting(field.key, json[field.name].as<uint32_t>());
   }
 }
 
 void SlaveController::sendState() {
+  PROFILE_SCOPE("sendState");
+  if (binaryMode) {
+    protocol::PayloadWriter payload;
+    uint8_t flags = 0;
+    if (lastState.pushCylinder) flags |= protocol::STATE_FLAG_PUSH;
+    if (lastState.riserCylinder) flags |= protocol::STATE_FLAG_RISER;
+    if (lastState.ejectionCylinder) flags |= protocol::STATE_FLAG_EJECTION;
+    if (lastState.sensor1) flags |= protocol::STATE_FLAG_SENSOR1;
+    payload.u8(static_cast<uint8_t>(currentStatus));
+    payload.u8(static_cast<uint8_t>(lastState.state));
+    payload.u8(flags);
+    sendFrame(protocol::MessageType::STATE, payload, SerialOutput::CRITICAL);
+    return;
+  }
+
   StaticJsonDocument<200> doc;
   doc["status"] = stateToString(currentStatus);
-  doc["router_state"] = routerStateToString(router.getState());
-  doc["push_cylinder"] = router.isPushCylinderActive() ? "ON" : "OFF";
-  doc["riser_cylinder"] = router.isRiserCylinderActive() ? "ON" : "OFF";
-  doc["ejection_cylinder"] = router.isEjectionCylinderActive() ? "ON" : "OFF";
-  doc["sensor1"] = router.isSensor1Active() ? "ON" : "OFF";
-
-  String output;
-  serializeJson(doc, output);
-  Serial.println("STATE " + output);
-}
-
-String SlaveController::stateToString(Status state) {
-  switch (state) {
-    case Status::IDLE:
-      return "IDLE";
-    case Status::BUSY:
-      return "BUSY";
-    case Status::ERROR:
-      return "ERROR";
+  doc["router_state"] = routerStateToString(lastState.state);
+  doc["push_cylinder"] = lastState.pushCylinder ? "ON" : "OFF";
+  doc["riser_cylinder"] = lastState.riserCylinder ? "ON" : "OFF";
+  doc["ejection_cylinder"] = lastState.ejectionCylinder ? "ON" : "OFF";
+  doc["sensor1"] = lastState.sensor1 ? "ON" : "OFF";
+
+  sendJson("STATE", doc, SerialOutput::CRITICAL);
+}
+
+// ANALYSIS_ARM <id> <eta ms> <uptime ms> goes out ahead of the riser
+// settling, ANALYSIS_START <id> <uptime ms> once it has settled.
+// CAPTURE_EDGE <id> <micros> reports when the camera strobe fired.
+void SlaveController::sendRequest(SlaveRequest request, uint32_t boardId,
+                                  uint32_t value) {
+  const uint32_t now = hal::millis();
+  if (binaryMode) {
+    protocol::PayloadWriter payload;
+    protocol::MessageType type = protocol::MessageType::NON_ANALYSIS_CYCLE;
+    if (request == SlaveRequest::ANALYSIS_ARM) {
+      type = protocol::MessageType::ANALYSIS_ARM;
+      payload.u32(boardId);
+      payload.u32(value);
+      payload.u32(now);
+    } else if (request == SlaveRequest::ANALYSIS_START) {
+      type = protocol::MessageType::ANALYSIS_START;
+      payload.u32(boardId);
+      payload.u32(now);
+    } else if (request == SlaveRequest::CAPTURE_EDGE) {
+      type = protocol::MessageType::CAPTURE_EDGE;
+      payload.u32(boardId);
+      payload.u32(value);
+    }
+    sendFrame(type, payload, SerialOutput::CRITICAL);
+    return;
+  }
+
+  switch (request) {
+    case SlaveRequest::ANALYSIS_ARM:
+      serialOut.printf(SerialOutput::CRITICAL,
+                       "SLAVE_REQUEST ANALYSIS_ARM %lu %lu %lu\r\n",
+                       static_cast<unsigned long>(boardId),
+                       static_cast<unsigned long>(value),
+                       static_cast<unsigned long>(now));
+      break;
+    case SlaveRequest::ANALYSIS_START:
+      serialOut.printf(SerialOutput::CRITICAL,
+                       "SLAVE_REQUEST ANALYSIS_START %lu %lu\r\n",
+                       static_cast<unsigned long>(boardId),
+                       static_cast<unsigned long>(now));
+      break;
+    case SlaveRequest::NON_ANALYSIS_CYCLE:
+      serialOut.println(SerialOutput::CRITICAL,
+                        "SLAVE_REQUEST NON_ANALYSIS_CYCLE");
+      break;
+    case SlaveRequest::CAPTURE_EDGE:
+      serialOut.printf(SerialOutput::CRITICAL, "CAPTURE_EDGE %lu %lu\r\n",
+                       static_cast<unsigned long>(boardId),
+                       static_cast<unsigned long>(value));
+      break;
+  }
+}
+
+void SlaveController::startCalibration(const CycleTuner::Request& request) {
+  CommandEvent command = {};
+  command.kind = CommandEvent::Kind::CALIBRATE;
+  command.calibrate = request;
+  sendCommand(command);
+}
+
+// CALIBRATION {"persisted":B,"push_status":S,"push_min_ms":N,"push_ms":N,
+// ...} with the riser and ejection fields following the same pattern
+void SlaveController::sendCalibration(const CalibrationReport& report) {
+  // The router has already switched to the tuned timings
+  const CycleTuner::Result& push = report.results[0];
+  const CycleTuner::Result& riser = report.results[1];
+  const CycleTuner::Result& ejection = report.results[2];
+  settings.pushTime = push.recommendedMs;
+  settings.riserTime = riser.recommendedMs;
+  settings.ejectionTime = ejection.recommendedMs;
+
+  if (binaryMode) {
+    // [persisted u8] then per stroke [status u8][min u32][recommended u32]
+    protocol::PayloadWriter payload;
+    payload.u8(report.persisted ? 1 : 0);
+    for (const CycleTuner::Result& result : report.results) {
+      payload.u8(static_cast<uint8_t>(result.status));
+      payload.u32(result.minMs);
+      payload.u32(result.recommendedMs);
+    }
+    sendFrame(protocol::MessageType::CALIBRATION, payload,
+              SerialOutput::CRITICAL);
+    return;
+  }
+
+  StaticJsonDocument<384> doc;
+  doc["persisted"] = report.persisted;
+  for (size_t i = 0; i < STROKE_COUNT; i++) {
+    const CycleTuner::Result& result = report.results[i];
+    doc[CALIBRATION_KEYS[i][0]] =
+        CALIBRATION_STATUS_NAMES[static_cast<size_t>(result.status)];
+    doc[CALIBRATION_KEYS[i][1]] = result.minMs;
+    doc[CALIBRATION_KEYS[i][2]] = result.recommendedMs;
+  }
+  sendJson("CALIBRATION", doc, SerialOutput::CRITICAL);
+}
+
+// One HIST line (or HISTOGRAM frame) per histogram. With reset the counts
+// start over once exported, so HIST RESET at each shift change gives that
+// shift's tail without losing any of it.
+void SlaveController::sendHistograms(bool reset) {
+  constexpr size_t COUNT = static_cast<size_t>(HistogramId::COUNT);
+  for (size_t id = 0; id < COUNT; id++) {
+    const Histogram* histogram = &wakeLatency;
+    const char* name;
+    if (id < ROUTER_STATE_COUNT) {
+      histogram = &router.getStateDwell(static_cast<RouterState>(id));
+      name = ROUTER_STATE_NAMES[id];
+    } else {
+      if (id == static_cast<size_t>(HistogramId::ANALYSIS_ROUND_TRIP)) {
+        histogram = &router.getAnalysisRoundTrip();
+      } else if (id == static_cast<size_t>(HistogramId::SENSOR_TO_PUSH)) {
+        histogram = &router.getSensorToPush();
+      } else if (id == static_cast<size_t>(HistogramId::CONTROL_PASS)) {
+        histogram = &controlMonitor.getPassTime();
+      } else if (id == static_cast<size_t>(HistogramId::COMMS_PASS)) {
+        histogram = &commsMonitor.getPassTime();
+      } else if (id == static_cast<size_t>(HistogramId::LATE_VERDICT)) {
+        histogram = &router.getVerdictLateness();
+      }
+      name = HISTOGRAM_NAMES[id - ROUTER_STATE_COUNT];
+    }
+
+    if (binaryMode) {
+      // [id u8][samples][p50][p90][p99][p99.9][max], all u32 and in us
+      protocol::PayloadWriter payload;
+      payload.u8(static_cast<uint8_t>(id));
+      payload.u32(histogram->getSamples());
+      payload.u32(histogram->percentileUs(50));
+      payload.u32(histogram->percentileUs(90));
+      payload.u32(histogram->percentileUs(99));
+      payload.u32(histogram->perMilleUs(999));
+      payload.u32(histogram->getMaxUs());
+      sendFrame(protocol::MessageType::HISTOGRAM, payload,
+                SerialOutput::CRITICAL);
+      continue;
+    }
+
+    StaticJsonDocument<256> doc;
+    doc["name"] = name;
+    doc["samples"] = histogram->getSamples();
+    doc["p50_us"] = histogram->percentileUs(50);
+    doc["p90_us"] = histogram->percentileUs(90);
+    doc["p99_us"] = histogram->percentileUs(99);
+    doc["p999_us"] = histogram->perMilleUs(999);
+    doc["max_us"] = histogram->getMaxUs();
+    sendJson("HIST", doc, SerialOutput::CRITICAL);
+  }
+
+  // The control task records, so it also clears
+  if (reset) {
+    commsMonitor.resetPassTime();
+    CommandEvent command = {};
+    command.kind = CommandEvent::Kind::RESET_HISTOGRAMS;
+    sendCommand(command);
+  }
+}
+
+// DEBUG traces go out as TRACE frames in binary mode: [format id u32]
+// [micros u32][packed arguments]. Everything else, and everything in text
+// mode, is formatted here, so warnings and errors stay readable without the
+// trace dictionary.
+void SlaveController::sendTrace(const trace::Record& record) {
+  const auto priority = static_cast<SerialOutput::Priority>(record.priority);
+  if (binaryMode && priority == SerialOutput::DEBUG) {
+    protocol::PayloadWriter payload;
+    payload.u32(record.id);
+    payload.u32(record.us);
+    for (size_t i = 0; i < record.length; i++) payload.u8(record.args[i]);
+    sendFrame(protocol::MessageType::TRACE, payload, priority);
+    return;
+  }
+
+  StallMonitor::Scope serializing(commsMonitor,
+                                  StallMonitor::Activity::SERIALIZE);
+  char text[TX_MAX_MESSAGE];
+  trace::format(text, sizeof(text), record.format, record.args,
+                record.length);
+  serialOut.print(priority, text);
+}
+
+void SlaveController::noteStall(const StallMonitor::Stall& stall) {
+  flight::record(flight::Kind::STALL, static_cast<uint8_t>(stall.task),
+                 static_cast<uint16_t>(stall.activity), stall.us);
+  stalls.add(stall);
+  sendStall(stall, SerialOutput::NORMAL);
+}
+
+// STALL {"task":S,"activity":S,"us":N,"activity_us":N,"at_ms":N}, as the
+// stall happens and again for STALLS while it is among the longest
+void SlaveController::sendStall(const StallMonitor::Stall& stall,
+                                SerialOutput::Priority priority) {
+  if (binaryMode) {
+    // [task u8][activity u8][us u32][activity us u32][at ms u32]
+    protocol::PayloadWriter payload;
+    payload.u8(static_cast<uint8_t>(stall.task));
+    payload.u8(static_cast<uint8_t>(stall.activity));
+    payload.u32(stall.us);
+    payload.u32(stall.activityUs);
+    payload.u32(stall.atMs);
+    sendFrame(protocol::MessageType::STALL, payload, priority);
+    return;
+  }
+
+  StaticJsonDocument<192> doc;
+  doc["task"] = STALL_TASK_NAMES[static_cast<size_t>(stall.task)];
+  doc["activity"] = STALL_ACTIVITY_NAMES[static_cast<size_t>(stall.activity)];
+  doc["us"] = stall.us;
+  doc["activity_us"] = stall.activityUs;
+  doc["at_ms"] = stall.atMs;
+  sendJson("STALL", doc, priority);
+}
+
+// The longest stalls since boot or STALLS RESET, longest first
+void SlaveController::sendStalls(bool reset) {
+  for (size_t i = 0; i < stalls.size(); i++) {
+    sendStall(stalls[i], SerialOutput::CRITICAL);
+  }
+  if (reset) stalls.clear();
+}
+
+// DUMP_TRACE sends the flight recorder: the run that ended in the last
+// reset, then this one up to now, oldest first. A dump already running
+// starts over.
+void SlaveController::startDump() {
+  dumping = true;
+  dumpRun = flight::Run::PREVIOUS;
+  dumpSeq = flight::first(dumpRun);
+  dumpEnd = flight::end(dumpRun);
+  dumpSent[0] = dumpSent[1] = 0;
+}
+
+// A line per event while the NORMAL queue has room, so a dump never blocks
+// the comms task or crowds out CRITICAL traffic. FLIGHT_END
+// {"previous":N,"current":N} follows the last event.
+void SlaveController::streamDump() {
+  while (dumping &&
+         serialOut.space(SerialOutput::NORMAL) >= FLIGHT_LINE_ROOM) {
+    if (dumpSeq >= dumpEnd) {
+      if (dumpRun == flight::Run::PREVIOUS) {
+        dumpRun = flight::Run::CURRENT;
+        dumpSeq = flight::first(dumpRun);
+        dumpEnd = flight::end(dumpRun);
+        continue;
+      }
+      dumping = false;
+      if (binaryMode) {
+        // [previous events u16][current events u16]
+        protocol::PayloadWriter payload;
+        payload.u16(dumpSent[0]);
+        payload.u16(dumpSent[1]);
+        sendFrame(protocol::MessageType::FLIGHT, payload,
+                  SerialOutput::NORMAL);
+      } else {
+        StaticJsonDocument<64> doc;
+        doc["previous"] = dumpSent[0];
+        doc["current"] = dumpSent[1];
+        sendJson("FLIGHT_END", doc, SerialOutput::NORMAL);
+      }
+      return;
+    }
+    flight::Event event;
+    if (!flight::read(dumpRun, dumpSeq, event)) {
+      // Overwritten while the dump ran; go on from the oldest left
+      dumpSeq = flight::first(dumpRun);
+      continue;
+    }
+    dumpSeq++;
+    dumpSent[static_cast<size_t>(dumpRun)]++;
+    sendFlightEvent(dumpRun, event);
+  }
+}
+
+// FLIGHT {"run":S,"us":N,"event":S,...} with the fields of the event:
+// BOOT reset_reason, boot; STATE to, from; VALVE pin, level; COMMAND
+// command, arg, value; STALL task, activity, pass_us
+void SlaveController::sendFlightEvent(flight::Run run,
+                                      const flight::Event& event) {
+  if (binaryMode) {
+    // [run u8][us u32][kind u8][a u8][b u16][value u32]
+    protocol::PayloadWriter payload;
+    payload.u8(static_cast<uint8_t>(run));
+    payload.u32(event.us);
+    payload.u8(static_cast<uint8_t>(event.kind));
+    payload.u8(event.a);
+    payload.u16(event.b);
+    payload.u32(event.value);
+    sendFrame(protocol::MessageType::FLIGHT, payload, SerialOutput::NORMAL);
+    return;
+  }
+
+  StaticJsonDocument<256> doc;
+  doc["run"] = run == flight::Run::PREVIOUS ? "previous" : "current";
+  doc["us"] = event.us;
+  doc["event"] = nameOf(FLIGHT_KIND_NAMES, static_cast<size_t>(event.kind));
+  switch (event.kind) {
+    case flight::Kind::BOOT:
+      doc["reset_reason"] = event.a;
+      doc["boot"] = event.value;
+      break;
+    case flight::Kind::STATE:
+      doc["to"] = nameOf(ROUTER_STATE_NAMES, event.a);
+      doc["from"] = nameOf(ROUTER_STATE_NAMES, event.b);
+      break;
+    case flight::Kind::VALVE:
+      doc["pin"] = event.a;
+      doc["level"] = event.b;
+      break;
+    case flight::Kind::COMMAND:
+      doc["command"] = nameOf(COMMAND_NAMES, event.a);
+      doc["arg"] = event.b;
+      doc["value"] = event.value;
+      break;
+    case flight::Kind::STALL:
+      doc["task"] = nameOf(STALL_TASK_NAMES, event.a);
+      doc["activity"] = nameOf(STALL_ACTIVITY_NAMES, event.b);
+      doc["pass_us"] = event.value;
+      break;
     default:
-      return "UNKNOWN";
+      break;
+  }
+  sendJson("FLIGHT", doc, SerialOutput::NORMAL);
+}
+
+// PROFILE {"name":S,"calls":N,"total_ms":N,"mean_ns":N,"p50_ns":N,
+// "p99_ns":N,"max_ns":N} per profiled scope, in text in either protocol
+void SlaveController::sendProfile(bool reset) {
+#ifdef PROFILER_ENABLED
+  const uint32_t cyclesPerUs = hal::cyclesPerUs();
+  auto ns = [cyclesPerUs](uint64_t cycles) {
+    return static_cast<unsigned long>(cycles * 1000 / cyclesPerUs);
+  };
+  for (size_t i = 0; i < profiler::siteCount(); i++) {
+    const profiler::Site& site = profiler::site(i);
+    StaticJsonDocument<256> doc;
+    doc["name"] = site.name;
+    doc["calls"] = site.calls;
+    doc["total_ms"] =
+        static_cast<unsigned long>(site.totalCycles / cyclesPerUs / 1000);
+    doc["mean_ns"] = site.calls ? ns(site.totalCycles / site.calls) : 0;
+    doc["p50_ns"] = ns(profiler::percentileCycles(site, 50));
+    doc["p99_ns"] = ns(profiler::percentileCycles(site, 99));
+    doc["max_ns"] = ns(site.maxCycles);
+    sendJson("PROFILE", doc, SerialOutput::CRITICAL);
+  }
+  // The control task records most sites, so it also clears
+  if (reset) {
+    CommandEvent command = {};
+    command.kind = CommandEvent::Kind::RESET_PROFILE;
+    sendCommand(command);
+  }
+#else
+  (void)reset;
+  sendWarning("Profiler not built in (PROFILER_ENABLED)");
+#endif
+}
+
+void SlaveController::sendFrame(protocol::MessageType type,
+                                const protocol::PayloadWriter& payload,
+                                SerialOutput::Priority priority) {
+  StallMonitor::Scope serializing(commsMonitor,
+                                  StallMonitor::Activity::SERIALIZE);
+  // A truncated payload would still parse on the master, field by field
+  if (payload.overflowed()) {
+    oversizedFrames++;
+    sendWarning("Frame type %u overflowed, not sent",
+                static_cast<unsigned>(type));
+    return;
   }
+  uint8_t encoded[protocol::MAX_ENCODED];
+  size_t length = protocol::encodeFrame(type, txSeq++, payload.data(),
+                                        payload.size(), encoded);
+  serialOut.write(priority, encoded, length);
+}
+
+void SlaveController::sendJson(const char* prefix, const JsonDocument& doc,
+                               SerialOutput::Priority priority) {
+  PROFILE_SCOPE("sendJson");
+  StallMonitor::Scope serializing(commsMonitor,
+                                  StallMonitor::Activity::SERIALIZE);
+  char json[TX_MAX_MESSAGE];
+  serializeJson(doc, json, sizeof(json));
+  serialOut.printf(priority, "%s %s\r\n", prefix, json);
+}
+
+const char* SlaveController::stateToString(Status state) {
+  size_t index = static_cast<size_t>(state);
+  return index < sizeof(STATUS_NAMES) / sizeof(STATUS_NAMES[0])
+             ? STATUS_NAMES[index]
+             : "UNKNOWN";
 }
 
-void SlaveController::sendWarning(const String& message) {
-  Serial.println("WARNING " + message);
+void SlaveController::sendWarning(const char* format, ...) {
+  char message[TX_MAX_MESSAGE];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  serialOut.printf(SerialOutput::NORMAL, "WARNING %s\r\n", message);
 }
 
-void SlaveController::sendError(const String& message) {
-  Serial.println("ERROR " + message);
+void SlaveController::sendError(const char* format, ...) {
+  char message[TX_MAX_MESSAGE];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  serialOut.printf(SerialOutput::CRITICAL, "ERROR %s\r\n", message);
   currentStatus = Status::ERROR;
 }
 
 void SlaveController::sendHeartbeat() {
-  StaticJsonDocument<200> doc;  // Increased buffer size
+  PROFILE_SCOPE("sendHeartbeat");
+  if (binaryMode) {
+    protocol::PayloadWriter payload;
+    payload.u32(hal::millis());
+    payload.u32(bootCount);
+    payload.u32(hal::freeHeap());
+    payload.u8(static_cast<uint8_t>(lastState.state));
+    payload.u8(static_cast<uint8_t>(hal::resetReason()));
+    payload.u32(lastState.cycleCount);
+    payload.u32(lastState.lastCycleTime);
+    payload.u32(reader.getOverruns());
+    payload.u32(reader.getOverlong());
+    payload.u32(serialOut.getDrops(SerialOutput::NORMAL));
+    payload.u32(serialOut.getDrops(SerialOutput::DEBUG));
+    payload.u32(serialOut.getCriticalStalls());
+    payload.u32(linkDrops());
+    payload.u32(lastState.sensorLatencyUs);
+    payload.u32(lastState.sensorLatencyMaxUs);
+    payload.u32(wakeLatency.percentileUs(50));
+    payload.u32(wakeLatency.percentileUs(99));
+    payload.u32(wakeLatency.getMaxUs());
+    payload.u32(lastState.lastIdleSkipped);
+    for (size_t i = 0; i < STROKE_COUNT; i++) {
+      payload.u32(lastState.strokeMs[i]);
+    }
+    for (size_t i = 0; i < STROKE_COUNT; i++) {
+      payload.u32(lastState.strokeMaxMs[i]);
+    }
+    payload.u32(stalls.getTotal());
+    payload.u32(lastState.lateVerdicts);
+    payload.u32(lastState.duplicateVerdicts);
+    payload.u32(lastState.unmatchedVerdicts);
+    payload.u32(oversizedFrames);
+    payload.u32(serialOut.getOversized());
+    sendFrame(protocol::MessageType::HEARTBEAT, payload,
+              SerialOutput::NORMAL);
+    return;
+  }
+
+  // Add more diagnostic info to heartbeat
+  StaticJsonDocument<768> doc;
   doc["type"] = "heartbeat";
-  doc["uptime"] = millis();
+  doc["uptime"] = hal::millis();
   doc["boot_count"] = bootCount;
-  doc["free_heap"] = ESP.getFreeHeap();
-  doc["router_state"] = routerStateToString(router.getState());
-  doc["last_error"] = esp_reset_reason();
+  doc["free_heap"] = hal::freeHeap();
+  doc["router_state"] = routerStateToString(lastState.state);
+  doc["last_error"] = hal::resetReason();
+  doc["cycle_count"] = lastState.cycleCount;
+  doc["last_cycle_time"] = lastState.lastCycleTime;
+  doc["rx_overruns"] = reader.getOverruns();
+  doc["rx_overlong"] = reader.getOverlong();
+  doc["tx_drops_normal"] = serialOut.getDrops(SerialOutput::NORMAL);
+  doc["tx_drops_debug"] = serialOut.getDrops(SerialOutput::DEBUG);
+  doc["tx_critical_stalls"] = serialOut.getCriticalStalls();
+  doc["tx_oversized"] = serialOut.getOversized();
+  doc["link_drops"] = linkDrops();
+  doc["sensor_latency_us"] = lastState.sensorLatencyUs;
+  doc["sensor_latency_max_us"] = lastState.sensorLatencyMaxUs;
+  doc["wake_p50_us"] = wakeLatency.percentileUs(50);
+  doc["wake_p99_us"] = wakeLatency.percentileUs(99);
+  doc["wake_max_us"] = wakeLatency.getMaxUs();
+  doc["idle_skipped_ms"] = lastState.lastIdleSkipped;
+  // Push, riser, ejection
+  JsonArray stroke = doc.createNestedArray("stroke_ms");
+  JsonArray strokeMax = doc.createNestedArray("stroke_max_ms");
+  for (size_t i = 0; i < STROKE_COUNT; i++) {
+    stroke.add(lastState.strokeMs[i]);
+    strokeMax.add(lastState.strokeMaxMs[i]);
+  }
+  doc["stalls"] = stalls.getTotal();
+  doc["late_verdicts"] = lastState.lateVerdicts;
+  doc["duplicate_verdicts"] = lastState.duplicateVerdicts;
+  doc["unmatched_verdicts"] = lastState.unmatchedVerdicts;
+  doc["oversized_frames"] = oversizedFrames;
 
-  String output;
-  serializeJson(doc, output);
-  Serial.println("HEARTBEAT " + output);
+  sendJson("HEARTBEAT", doc, SerialOutput::NORMAL);
 }
\ No newline at end of file
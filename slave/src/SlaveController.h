@@ -1,40 +1,204 @@
 #pragma once
 
-#include <Arduino.h>
 #include <ArduinoJson.h>
 
+#include "CommandReader.h"
+#include "ControlLink.h"
+#include "FlightRecorder.h"
+#include "Hal.h"
+#include "Histogram.h"
+#include "Protocol.h"
 #include "RouterController.h"
+#include "SerialOutput.h"
+#include "StallMonitor.h"
+#include "Trace.h"
 
 // Define your custom types here
 enum class Status { IDLE, BUSY, ERROR };
 
+constexpr const char* STATUS_NAMES[] = {"IDLE", "BUSY", "ERROR"};
+
+// Keys of the text HEARTBEAT in the order they are sent, each with the
+// longest value it can print. The line is bounded from them and must fit
+// TX_MAX_MESSAGE; the simulator checks real lines against the list.
+struct HeartbeatKey {
+  const char* name;
+  size_t valueMax;
+};
+
+constexpr size_t longestName(const char* const* names, size_t count) {
+  size_t longest = 0;
+  for (size_t i = 0; i < count; i++) {
+    size_t length = 0;
+    while (names[i][length]) length++;
+    if (length > longest) longest = length;
+  }
+  return longest;
+}
+
+constexpr size_t U32_TEXT = 10;
+constexpr size_t STROKES_TEXT = STROKE_COUNT * (U32_TEXT + 1) + 1;
+constexpr HeartbeatKey HEARTBEAT_TEXT_KEYS[] = {
+    {"type", 11},  // "heartbeat"
+    {"uptime", U32_TEXT},
+    {"boot_count", U32_TEXT},
+    {"free_heap", U32_TEXT},
+    {"router_state",
+     longestName(ROUTER_STATE_NAMES, ROUTER_STATE_COUNT) + 2},
+    {"last_error", U32_TEXT + 1},  // Signed
+    {"cycle_count", U32_TEXT},
+    {"last_cycle_time", U32_TEXT},
+    {"rx_overruns", U32_TEXT},
+    {"rx_overlong", U32_TEXT},
+    {"tx_drops_normal", U32_TEXT},
+    {"tx_drops_debug", U32_TEXT},
+    {"tx_critical_stalls", U32_TEXT},
+    {"tx_oversized", U32_TEXT},
+    {"link_drops", U32_TEXT},
+    {"sensor_latency_us", U32_TEXT},
+    {"sensor_latency_max_us", U32_TEXT},
+    {"wake_p50_us", U32_TEXT},
+    {"wake_p99_us", U32_TEXT},
+    {"wake_max_us", U32_TEXT},
+    {"idle_skipped_ms", U32_TEXT},
+    {"stroke_ms", STROKES_TEXT},
+    {"stroke_max_ms", STROKES_TEXT},
+    {"stalls", U32_TEXT},
+    {"late_verdicts", U32_TEXT},
+    {"duplicate_verdicts", U32_TEXT},
+    {"unmatched_verdicts", U32_TEXT},
+    {"oversized_frames", U32_TEXT},
+};
+
+// "HEARTBEAT {...}\r\n" with every value at its longest
+constexpr size_t heartbeatTextMax() {
+  size_t length = sizeof("HEARTBEAT {}\r\n") - 1;
+  for (const HeartbeatKey& key : HEARTBEAT_TEXT_KEYS) {
+    length += longestName(&key.name, 1) + 3 + key.valueMax + 1;
+  }
+  return length - 1;  // No comma after the last
+}
+
+// SerialOutput refuses a line that does not fit with its terminator
+static_assert(heartbeatTextMax() < TX_MAX_MESSAGE,
+              "text HEARTBEAT can outgrow TX_MAX_MESSAGE");
+
 struct Settings {
   unsigned long pushTime;
   unsigned long riserTime;
   unsigned long ejectionTime;
   bool analysisMode;
+  bool pipelined;
+  unsigned long captureTime;
+  unsigned long triggerLead;
+  bool staggerSolenoids;
+  uint32_t sensorConfirmUs;
+  unsigned long riserOverlap;
+  unsigned long ejectOverlap;
+  bool continuousFeed;
+  uint8_t strokeSensors;
+  uint8_t logLevel;  // Highest SerialOutput::Priority traced
+  unsigned long analysisTimeout;
 };
 
 class SlaveController {
  private:
   static SlaveController* instance;
+  // Called from the control task; they only queue events for comms
   static void staticSendState();
+  static void staticSendRequest(SlaveRequest request, uint32_t boardId,
+                                uint32_t value);
+  static void staticTrace(const trace::Record& record);
+  static void staticQuietWindow(uint32_t us);
+  static void staticCalibration(const CalibrationReport& report);
+  void queueForComms(ControlEvent& event);
+  uint32_t eventSeq;  // Control side
   Status currentStatus;
   Settings settings;
   RouterController router;
+  ControlLink link;
+  RouterSnapshot lastState;  // Comms side copy of the router state
+  CommandReader reader;
   unsigned long lastHeartbeatTime;
+  unsigned long lastSerialCheck;
+  unsigned long lastMemCheck;
+  unsigned long serialRestartAt;  // Non-zero while the UART is restarting
   unsigned long bootCount;
 
-  void processCommand(const String& command);
+  // Binary framing is off until the master asks for it with PROTOCOL BINARY
+  bool binaryMode;
+  uint8_t txSeq;
+  unsigned long oversizedFrames;  // Refused by sendFrame
+
+  // Due time to the start of the control pass, per wake-up
+  Histogram wakeLatency;
+  // Pass times and stalls; each monitor belongs to the task it times
+  StallMonitor controlMonitor;
+  StallMonitor commsMonitor;
+  StallLog stalls;  // Comms side
+
+  // DUMP_TRACE progress: the run being sent, the next and last sequence
+  // numbers to send, and the events sent per run
+  bool dumping;
+  flight::Run dumpRun;
+  uint32_t dumpSeq;
+  uint32_t dumpEnd;
+  uint32_t dumpSent[2];
+
+  // Control task side
+  void applyCommand(const CommandEvent& command);
+  void applyRouterSetting(protocol::SettingKey key, uint32_t value);
+
+  // Comms task side
+  unsigned long reportedEventDrops;
+  bool popControlEvent(ControlEvent& event);
+  void dispatchControlEvents();
+  void sendCommand(const CommandEvent& command);
+  void pollSerial();
+  void processCommand(const char* command);
+  void handleFrame(uint8_t* buf, size_t length);
   void updateSettings(const JsonObject& json);
+  void applySetting(protocol::SettingKey key, uint32_t value);
   void sendState();
-  String stateToString(Status state);
-  void sendWarning(const String& message);
-  void sendError(const String& message);
+  void sendRequest(SlaveRequest request, uint32_t boardId, uint32_t value);
+  void startCalibration(const CycleTuner::Request& request);
+  void sendCalibration(const CalibrationReport& report);
+  void sendHistograms(bool reset);
+  void sendProfile(bool reset);
+  void sendTrace(const trace::Record& record);
+  void noteStall(const StallMonitor::Stall& stall);
+  void sendStall(const StallMonitor::Stall& stall,
+                 SerialOutput::Priority priority);
+  void sendStalls(bool reset);
+  void startDump();
+  void streamDump();
+  void sendFlightEvent(flight::Run run, const flight::Event& event);
+  void sendFrame(protocol::MessageType type,
+                 const protocol::PayloadWriter& payload,
+                 SerialOutput::Priority priority);
+  void sendJson(const char* prefix, const JsonDocument& doc,
+                SerialOutput::Priority priority);
+  const char* stateToString(Status state);
+  unsigned long linkDrops() const {
+    return link.toComms.getDrops() + link.toCommsLog.getDrops() +
+           link.toControl.getDrops();
+  }
+  void sendWarning(const char* format, ...)
+      __attribute__((format(printf, 2, 3)));
+  void sendError(const char* format, ...)
+      __attribute__((format(printf, 2, 3)));
 
  public:
   SlaveController();
   void setup();
+  // Both steps in turn; the ESP32 build runs them as separate tasks
   void loop();
+  void controlStep();
+  void commsStep();
+  // Microseconds until a step has work that no wake-up will announce
+  uint32_t controlWakeUs();
+  uint32_t commsWakeUs();
+  uint32_t nextWakeUs();
+  void recordWakeLatency(uint32_t us);
   void sendHeartbeat();
 };
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <atomic>
+
+// Lock-free single-producer/single-consumer ring of fixed-size items. One
+// task may push and one other task may pop; neither ever blocks. Capacity
+// must be a power of two so the free-running indices wrap cleanly.
+template <typename T, size_t N>
+class SpscQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0,
+                "SpscQueue capacity must be a power of two");
+
+ public:
+  // Producer side. Returns false (and counts a drop) when full.
+  bool push(const T& item) {
+    size_t tail = tailIndex.load(std::memory_order_relaxed);
+    if (tail - headIndex.load(std::memory_order_acquire) == N) {
+      drops.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    items[tail % N] = item;
+    tailIndex.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side
+  bool pop(T& item) {
+    size_t head = headIndex.load(std::memory_order_relaxed);
+    if (head == tailIndex.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = items[head % N];
+    headIndex.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side; the oldest item, or nullptr when empty
+  const T* peek() const {
+    size_t head = headIndex.load(std::memory_order_relaxed);
+    if (head == tailIndex.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &items[head % N];
+  }
+
+  bool empty() const {
+    return headIndex.load(std::memory_order_acquire) ==
+           tailIndex.load(std::memory_order_acquire);
+  }
+
+  unsigned long getDrops() const {
+    return drops.load(std::memory_order_relaxed);
+  }
+
+ private:
+  T items[N];
+  std::atomic<size_t> headIndex{0};
+  std::atomic<size_t> tailIndex{0};
+  std::atomic<unsigned long> drops{0};
+};
@@ -0,0 +1,50 @@
+#include "StallMonitor.h"
+
+#include "Hal.h"
+
+void StallMonitor::begin(Activity activity) {
+  passStartUs = segmentStartUs = hal::micros();
+  current = longest = activity;
+  longestUs = 0;
+}
+
+StallMonitor::Activity StallMonitor::mark(Activity activity) {
+  closeSegment(hal::micros());
+  Activity previous = current;
+  current = activity;
+  return previous;
+}
+
+bool StallMonitor::end(Stall& stall) {
+  uint32_t now = hal::micros();
+  closeSegment(now);
+  uint32_t us = now - passStartUs;
+  passTime.record(us);
+  if (us < STALL_THRESHOLD_US) return false;
+  stall.task = task;
+  stall.activity = longest;
+  stall.us = us;
+  stall.activityUs = longestUs;
+  stall.atMs = hal::millis();
+  return true;
+}
+
+void StallMonitor::closeSegment(uint32_t nowUs) {
+  uint32_t us = nowUs - segmentStartUs;
+  if (us > longestUs) {
+    longestUs = us;
+    longest = current;
+  }
+  segmentStartUs = nowUs;
+}
+
+void StallLog::add(const StallMonitor::Stall& stall) {
+  total++;
+  // Insertion into the sorted records; the shortest falls off when full
+  size_t i = count < STALL_RECORDS ? count++ : STALL_RECORDS;
+  while (i > 0 && stalls[i - 1].us < stall.us) {
+    if (i < STALL_RECORDS) stalls[i] = stalls[i - 1];
+    i--;
+  }
+  if (i < STALL_RECORDS) stalls[i] = stall;
+}
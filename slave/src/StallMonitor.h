@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Histogram.h"
+#include "config.h"
+
+// Times every pass of one task (a controlStep() or commsStep()) into a
+// histogram, the task's jitter. mark() splits a pass into segments by what
+// it is doing; a pass of STALL_THRESHOLD_US or more is a stall and is
+// blamed on its longest segment. Owned by the task it times; the histogram
+// may be read by any task.
+class StallMonitor {
+ public:
+  enum class Task : uint8_t { CONTROL, COMMS };
+
+  enum class Activity : uint8_t {
+    ROUTER,       // Sensor, state machine and valve edges
+    COMMAND,      // Applying or parsing a command
+    UART_READ,    // Draining the UART into the command reader
+    SERIALIZE,    // Formatting JSON lines or binary frames
+    UART_WRITE,   // Feeding the UART driver from the output queues
+    EVENTS,       // Control task events reaching the comms task
+    HEARTBEAT,
+    HEAP_REPORT,
+    SERIAL_LINK,  // Connection check and restart
+    COUNT,
+  };
+
+  struct Stall {
+    Task task;
+    Activity activity;    // Longest segment of the pass
+    uint32_t us;          // Whole pass
+    uint32_t activityUs;  // Longest segment
+    uint32_t atMs;        // millis() at the end of the pass
+  };
+
+  // Times a nested activity, returning to the enclosing one on exit
+  class Scope {
+   public:
+    Scope(StallMonitor& monitor, Activity activity)
+        : monitor(monitor), previous(monitor.mark(activity)) {}
+    ~Scope() { monitor.mark(previous); }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    StallMonitor& monitor;
+    Activity previous;
+  };
+
+  explicit StallMonitor(Task task) : task(task) {}
+
+  void begin(Activity activity);
+  // Closes the running segment and starts one for activity; returns the
+  // activity that was running
+  Activity mark(Activity activity);
+  // True, with stall filled in, when the pass ran STALL_THRESHOLD_US or more
+  bool end(Stall& stall);
+
+  const Histogram& getPassTime() const { return passTime; }
+  void resetPassTime() { passTime.reset(); }
+
+ private:
+  void closeSegment(uint32_t nowUs);
+
+  Task task;
+  Histogram passTime;
+  Activity current = Activity::ROUTER;
+  Activity longest = Activity::ROUTER;
+  uint32_t passStartUs = 0;
+  uint32_t segmentStartUs = 0;
+  uint32_t longestUs = 0;
+};
+
+// The longest STALL_RECORDS stalls of both tasks, longest first, plus a
+// count of all of them. Kept by the comms task.
+class StallLog {
+ public:
+  void add(const StallMonitor::Stall& stall);
+  void clear() { count = total = 0; }
+
+  size_t size() const { return count; }
+  const StallMonitor::Stall& operator[](size_t i) const { return stalls[i]; }
+  uint32_t getTotal() const { return total; }
+
+ private:
+  StallMonitor::Stall stalls[STALL_RECORDS] = {};
+  size_t count = 0;
+  uint32_t total = 0;
+};
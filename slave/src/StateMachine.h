@@ -0,0 +1,221 @@
+#pragma once
+
+#include <limits.h>
+#include <stddef.h>
+
+// Table-driven state machine. Each row reads: in state `from`, once the
+// state has been active for timeoutMs and guard holds, run action and enter
+// `to`. Rows of one state are tried in table order and the first that fires
+// wins. A row with to == from is internal: its action runs without
+// re-entering the state, so the state timer keeps running.
+//
+// dispatch() runs to completion, so a state whose guards are already
+// satisfied on entry is left in the same pass (a choice point). The table
+// checks below are meant for static_assert next to the table definition.
+template <typename Context, typename State, size_t STATE_COUNT>
+struct StateTable {
+  using Guard = bool (*)(const Context&);
+  using Action = void (*)(Context&);
+  using Timeout = unsigned long (*)(const Context&);
+
+  struct Transition {
+    State from;
+    Guard guard;        // nullptr: always
+    Action action;      // nullptr: nothing to do
+    Timeout timeoutMs;  // nullptr: untimed
+    State to;
+  };
+
+  // Rows [first, last) for each state
+  struct Index {
+    size_t first[STATE_COUNT];
+    size_t last[STATE_COUNT];
+  };
+
+  // Row entries from context members, e.g. run<&Router::lower>
+  template <void (Context::*F)()>
+  static void run(Context& context) {
+    (context.*F)();
+  }
+  template <bool (Context::*F)() const>
+  static bool when(const Context& context) {
+    return (context.*F)();
+  }
+  template <unsigned long (Context::*F)() const>
+  static unsigned long after(const Context& context) {
+    return (context.*F)();
+  }
+  template <unsigned long MS>
+  static unsigned long afterMs(const Context&) {
+    return MS;
+  }
+
+  static constexpr size_t id(State state) {
+    return static_cast<size_t>(state);
+  }
+
+  template <size_t N>
+  static constexpr Index index(const Transition (&rows)[N]) {
+    Index result{};
+    for (size_t i = N; i-- > 0;) {
+      size_t state = id(rows[i].from);
+      if (result.last[state] == 0) result.last[state] = i + 1;
+      result.first[state] = i;
+    }
+    return result;
+  }
+
+  // Fires rows until none is due; returns true if any fired. entered runs
+  // after every state change, so states passed through are still seen.
+  template <size_t N>
+  static bool dispatch(const Transition (&rows)[N], const Index& index,
+                       Context& context, State& state,
+                       unsigned long& enteredAt, unsigned long nowMs,
+                       Action entered = nullptr) {
+    bool fired = false;
+    // Bounded so a guard that never clears cannot hang the loop
+    for (size_t step = 0; step < 2 * STATE_COUNT; step++) {
+      const Transition* row = due(rows, index, context, state,
+                                  nowMs - enteredAt);
+      if (!row) break;
+      if (row->action) row->action(context);
+      if (row->to != state) {
+        state = row->to;
+        enteredAt = nowMs;
+        if (entered) entered(context);
+      }
+      fired = true;
+    }
+    return fired;
+  }
+
+  // Time until the earliest timed row of the state comes due; rows already
+  // due but held by their guard wait for an event instead. ULONG_MAX if none.
+  template <size_t N>
+  static unsigned long nextTimeoutMs(const Transition (&rows)[N],
+                                     const Index& index,
+                                     const Context& context, State state,
+                                     unsigned long elapsedMs) {
+    unsigned long next = ULONG_MAX;
+    for (size_t i = index.first[id(state)]; i < index.last[id(state)]; i++) {
+      if (!rows[i].timeoutMs) continue;
+      unsigned long timeout = rows[i].timeoutMs(context);
+      if (timeout > elapsedMs && timeout - elapsedMs < next) {
+        next = timeout - elapsedMs;
+      }
+    }
+    return next;
+  }
+
+  // Compile-time checks
+
+  template <size_t N>
+  static constexpr bool statesInRange(const Transition (&rows)[N]) {
+    for (size_t i = 0; i < N; i++) {
+      if (id(rows[i].from) >= STATE_COUNT || id(rows[i].to) >= STATE_COUNT) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Rows of a state must be contiguous for index()
+  template <size_t N>
+  static constexpr bool rowsGrouped(const Transition (&rows)[N]) {
+    for (size_t i = 1; i < N; i++) {
+      if (rows[i].from == rows[i - 1].from) continue;
+      for (size_t j = 0; j + 1 < i; j++) {
+        if (rows[j].from == rows[i].from) return false;
+      }
+    }
+    return true;
+  }
+
+  // Every state is reachable from one of the roots (the initial state and
+  // any state entered from outside the table)
+  template <size_t N, size_t R>
+  static constexpr bool allReachable(const Transition (&rows)[N],
+                                     const State (&roots)[R]) {
+    bool seen[STATE_COUNT] = {};
+    for (size_t r = 0; r < R; r++) seen[id(roots[r])] = true;
+    for (size_t pass = 0; pass < STATE_COUNT; pass++) {
+      for (size_t i = 0; i < N; i++) {
+        if (seen[id(rows[i].from)]) seen[id(rows[i].to)] = true;
+      }
+    }
+    for (size_t s = 0; s < STATE_COUNT; s++) {
+      if (!seen[s]) return false;
+    }
+    return true;
+  }
+
+  // Every state except the terminal ones can be left
+  template <size_t N, size_t T>
+  static constexpr bool allExit(const Transition (&rows)[N],
+                                const State (&terminal)[T]) {
+    for (size_t s = 0; s < STATE_COUNT; s++) {
+      bool exits = false;
+      for (size_t t = 0; t < T; t++) exits |= id(terminal[t]) == s;
+      for (size_t i = 0; i < N; i++) {
+        exits |= id(rows[i].from) == s && rows[i].to != rows[i].from;
+      }
+      if (!exits) return false;
+    }
+    return true;
+  }
+
+  // A state with a timer has a timed way out
+  template <size_t N>
+  static constexpr bool timedStatesExit(const Transition (&rows)[N]) {
+    for (size_t s = 0; s < STATE_COUNT; s++) {
+      bool timed = false;
+      bool timedExit = false;
+      for (size_t i = 0; i < N; i++) {
+        if (id(rows[i].from) != s || !rows[i].timeoutMs) continue;
+        timed = true;
+        timedExit |= rows[i].to != rows[i].from;
+      }
+      if (timed && !timedExit) return false;
+    }
+    return true;
+  }
+
+  // In state from, the row guarded by first is tried before the one guarded
+  // by then
+  template <size_t N>
+  static constexpr bool triedBefore(const Transition (&rows)[N], State from,
+                                    Guard first, Guard then) {
+    for (size_t i = 0; i < N; i++) {
+      if (rows[i].from != from) continue;
+      if (rows[i].guard == then) return false;
+      if (rows[i].guard == first) return true;
+    }
+    return false;
+  }
+
+  // Nothing follows a row that always fires
+  template <size_t N>
+  static constexpr bool noShadowedRows(const Transition (&rows)[N]) {
+    for (size_t i = 0; i + 1 < N; i++) {
+      if (!rows[i].guard && !rows[i].timeoutMs &&
+          rows[i + 1].from == rows[i].from) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  template <size_t N>
+  static const Transition* due(const Transition (&rows)[N],
+                               const Index& index, const Context& context,
+                               State state, unsigned long elapsedMs) {
+    for (size_t i = index.first[id(state)]; i < index.last[id(state)]; i++) {
+      const Transition& row = rows[i];
+      if (row.timeoutMs && elapsedMs < row.timeoutMs(context)) continue;
+      if (row.guard && !row.guard(context)) continue;
+      return &row;
+    }
+    return nullptr;
+  }
+};
@@ -0,0 +1,124 @@
+#include "Trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+
+namespace trace {
+
+namespace {
+
+std::atomic<uint8_t> maxPriority{TRACE_MAX_PRIORITY};
+
+uint32_t readU32(const uint8_t* args) {
+  return uint32_t(args[0]) | uint32_t(args[1]) << 8 |
+         uint32_t(args[2]) << 16 | uint32_t(args[3]) << 24;
+}
+
+}  // namespace
+
+bool enabled(uint8_t priority) {
+  return priority <= maxPriority.load(std::memory_order_relaxed);
+}
+
+void setMaxPriority(uint8_t priority) {
+  maxPriority.store(priority, std::memory_order_relaxed);
+}
+
+uint8_t getMaxPriority() {
+  return maxPriority.load(std::memory_order_relaxed);
+}
+
+void packString(Record& record, const char* text) {
+  if (record.length >= TRACE_ARGS_MAX) return;
+  size_t room = TRACE_ARGS_MAX - record.length - 1;
+  size_t length = text ? strlen(text) : 0;
+  if (length > room) length = room;
+  if (length > UINT8_MAX) length = UINT8_MAX;
+  record.args[record.length++] = static_cast<uint8_t>(length);
+  memcpy(record.args + record.length, text, length);
+  record.length += length;
+}
+
+void packU32(Record& record, uint32_t value) {
+  if (record.length + 4 > TRACE_ARGS_MAX) {
+    record.length = TRACE_ARGS_MAX;  // Later arguments read as missing
+    return;
+  }
+  for (int i = 0; i < 4; i++) {
+    record.args[record.length++] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+size_t format(char* out, size_t size, const char* format,
+              const uint8_t* args, size_t length) {
+  size_t written = 0;
+  size_t read = 0;
+  auto put = [&](const char* text, size_t count) {
+    for (size_t i = 0; i < count; i++, written++) {
+      if (written + 1 < size) out[written] = text[i];
+    }
+  };
+
+  while (*format) {
+    if (*format != '%') {
+      put(format++, 1);
+      continue;
+    }
+    // One conversion: %[flags][width][length]type
+    const char* start = format++;
+    while (*format && strchr("-+ #0", *format)) format++;
+    while ((*format >= '0' && *format <= '9') || *format == '.') format++;
+    while (*format == 'h' || *format == 'l') format++;
+    char type = *format;
+    if (type) format++;
+
+    // The spec without its length modifier, so 32-bit arguments print
+    // the same on every host
+    char spec[16];
+    size_t specLength = 0;
+    for (const char* c = start; c < format && specLength < 14; c++) {
+      if (*c != 'h' && *c != 'l') spec[specLength++] = *c;
+    }
+    spec[specLength] = '\0';
+
+    char text[TRACE_ARGS_MAX + 16];
+    int count = 0;
+    if (type == '%') {
+      count = snprintf(text, sizeof(text), "%%");
+    } else if (type == 's') {
+      size_t stringLength = read < length ? args[read] : 0;
+      if (read + 1 + stringLength > length) stringLength = 0;
+      char string[TRACE_ARGS_MAX];
+      size_t copied = stringLength < sizeof(string) - 1 ? stringLength
+                                                        : sizeof(string) - 1;
+      memcpy(string, args + read + 1, copied);
+      string[copied] = '\0';
+      read += 1 + stringLength;
+      count = snprintf(text, sizeof(text), spec, string);
+    } else if (type && strchr("diuxXc", type)) {
+      uint32_t value = read + 4 <= length ? readU32(args + read) : 0;
+      read += 4;
+      if (type == 'd' || type == 'i') {
+        count = snprintf(text, sizeof(text), spec, static_cast<int>(value));
+      } else {
+        count = snprintf(text, sizeof(text), spec,
+                         static_cast<unsigned>(value));
+      }
+    } else {
+      // Unsupported conversion: copy it through as written
+      put(start, format - start);
+      continue;
+    }
+    if (count > 0) {
+      put(text, static_cast<size_t>(count) < sizeof(text)
+                    ? static_cast<size_t>(count)
+                    : sizeof(text) - 1);
+    }
+  }
+  if (size > 0) out[written < size ? written : size - 1] = '\0';
+  return written;
+}
+
+}  // namespace trace
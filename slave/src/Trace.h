@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <type_traits>
+
+#include "config.h"
+
+// Log records that carry a format string ID and raw arguments instead of
+// text. TRACE_TO(sink, priority, "format", args...) hashes the format at
+// compile time, packs the arguments and hands a Record to sink. The comms
+// task then sends it as a TRACE frame in binary mode, or formats it on the
+// spot in text mode, so the text on the wire is unchanged.
+//
+// The host keeps the format strings: slave/tools/trace_tool.cpp builds the
+// dictionary from the sources and decodes captured TRACE frames with it.
+// Formats may use %d %i %u %x %X %c and %s, with flags, width and the h/l
+// length modifiers. Integers travel as 32 bits, strings as [length u8] and
+// bytes, cut to fit TRACE_ARGS_MAX.
+//
+// Priorities above TRACE_MAX_PRIORITY are compiled out; setMaxPriority()
+// drops more at run time, before anything is packed.
+#ifndef TRACE_MAX_PRIORITY
+#define TRACE_MAX_PRIORITY 2  // SerialOutput::DEBUG
+#endif
+
+namespace trace {
+
+struct Record {
+  const char* format;  // The literal itself, for formatting in text mode
+  uint32_t id;
+  uint32_t us;       // micros() when it was recorded
+  uint8_t priority;  // SerialOutput::Priority
+  uint8_t length;
+  uint8_t args[TRACE_ARGS_MAX];
+};
+
+// FNV-1a of the format string
+constexpr uint32_t formatId(const char* format) {
+  uint32_t hash = 2166136261u;
+  while (*format) {
+    hash = (hash ^ static_cast<uint8_t>(*format++)) * 16777619u;
+  }
+  return hash;
+}
+
+bool enabled(uint8_t priority);
+void setMaxPriority(uint8_t priority);
+uint8_t getMaxPriority();
+
+void packString(Record& record, const char* text);
+void packU32(Record& record, uint32_t value);
+
+inline void pack(Record&) {}
+
+template <typename T, typename... Rest>
+void pack(Record& record, T value, Rest... rest) {
+  if constexpr (std::is_convertible_v<T, const char*>) {
+    packString(record, value);
+  } else {
+    static_assert(std::is_integral_v<T> || std::is_enum_v<T>,
+                  "trace arguments are integers or strings");
+    packU32(record, static_cast<uint32_t>(value));
+  }
+  pack(record, rest...);
+}
+
+// Formats packed arguments with their format string; returns the length
+// written, as snprintf would. Shared with the host decoder.
+size_t format(char* out, size_t size, const char* format,
+              const uint8_t* args, size_t length);
+
+// Never called; lets the compiler check TRACE_TO arguments against the
+// format
+inline void checkFormat(const char*, ...)
+    __attribute__((format(printf, 1, 2)));
+inline void checkFormat(const char*, ...) {}
+
+}  // namespace trace
+
+// Expands where Hal.h is visible, for the micros() timestamp
+#define TRACE_TO(sink, level, fmt, ...)                                \
+  do {                                                                 \
+    if constexpr ((level) <= TRACE_MAX_PRIORITY) {                     \
+      if (false) trace::checkFormat(fmt, ##__VA_ARGS__);               \
+      if (trace::enabled(level)) {                                     \
+        static constexpr uint32_t traceId_ = trace::formatId(fmt);     \
+        trace::Record traceRecord_;                                    \
+        traceRecord_.format = fmt;                                     \
+        traceRecord_.id = traceId_;                                    \
+        traceRecord_.us = hal::micros();                               \
+        traceRecord_.priority = (level);                               \
+        traceRecord_.length = 0;                                       \
+        trace::pack(traceRecord_, ##__VA_ARGS__);                      \
+        sink(traceRecord_);                                            \
+      }                                                                \
+    }                                                                  \
+  } while (0)
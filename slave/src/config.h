@@ -7,18 +7,122 @@
 #define EJECTION_CYLINDER_PIN 5
 #define RISER_CYLINDER_PIN 19
 #define SENSOR1_PIN 25
+// End-of-stroke reed switches, active low; only read when enabled by the
+// strokeSensors setting
+#define PUSH_STROKE_PIN 26
+#define RISER_STROKE_PIN 27
+#define EJECTION_STROKE_PIN 14
+#define CAMERA_TRIGGER_PIN 23  // Strobe to the camera's external trigger
 
 // Constants
 #define BAUD_RATE 115200
 #define BUTTON_DEBOUNCE_MS 50
 
+// Serial command input
+#define COMMAND_MAX_LENGTH 256     // Longest line or encoded frame accepted
+#define COMMAND_QUEUE_DEPTH 4      // Complete commands buffered between loops
+#define MAX_COMMANDS_PER_LOOP 2    // Commands executed per loop() pass
+
+// Serial output queues (bytes). The UART driver buffer is drained by the TX
+// interrupt; the per-priority rings feed it without ever blocking.
+#define TX_UART_BUFFER 1024
+#define TX_CRITICAL_BUFFER 2048
+#define TX_NORMAL_BUFFER 1024
+#define TX_DEBUG_BUFFER 2048
+// Longest formatted line, terminator included; longer ones are refused.
+// The text HEARTBEAT is the longest, bounded by heartbeatTextMax().
+#define TX_MAX_MESSAGE 832
+#define TX_PUMP_INTERVAL_US 1000   // Retry while the driver buffer is full
+
+// Control/comms task split (ESP32: control on the app core, comms on the
+// protocol core; the simulator runs both steps cooperatively)
+#define CONTROL_QUEUE_DEPTH 32     // Events each way, power of two
+#define CONTROL_TASK_CORE 1
+#define CONTROL_TASK_PRIORITY 5
+#define CONTROL_TASK_STACK 4096
+#define COMMS_TASK_CORE 0
+#define COMMS_TASK_PRIORITY 2
+#define COMMS_TASK_STACK 8192
+// Both tasks sleep until their next deadline or a wake-up; this bounds the
+// sleep when nothing is pending
+#define MAX_SLEEP_US 100000
+
+// A control or comms pass this long is reported to the master as a STALL,
+// blamed on what it spent longest doing; STALLS lists the longest kept
+#define STALL_THRESHOLD_US 5000
+#define STALL_RECORDS 8
+
+// Trace records (Trace.h): argument bytes per record, strings cut to fit.
+// Build with -D TRACE_MAX_PRIORITY=1 to compile out every DEBUG trace.
+#define TRACE_ARGS_MAX 80
+
+// Flight recorder (FlightRecorder.h): events kept through a reset, in RTC
+// slow memory on the board
+#define FLIGHT_RECORDER_EVENTS 256  // 12 bytes each, power of two
+#define RETAINED_MEMORY_SIZE 4096
+
 // Default timing values (in milliseconds)
 #define DEFAULT_PUSH_TIME 3000
 #define DEFAULT_RISER_TIME 3000
 #define DEFAULT_EJECTION_TIME 1000
-#define ANALYSIS_TIMEOUT 5000
+// A board with no verdict by then passes unsorted. Verdicts carry the board
+// id, so one arriving later is dropped rather than applied to the next board
+#define DEFAULT_ANALYSIS_TIMEOUT 4000
 #define CYCLE_DELAY 1000
 #define SENSOR_DELAY_TIME 300
-#define SENSOR_DEBOUNCE_TIME 100  // 50ms debounce time
+
+// Sensor edges are timestamped by a GPIO interrupt and debounced by an
+// integrator: a new level is confirmed once it has held for this long in
+// total, net of bounces back
+#define DEFAULT_SENSOR_CONFIRM_US 3000
+#define INPUT_EDGE_QUEUE_DEPTH 32  // Edges between control passes, power of two
+
+// With a reed switch fitted, a phase ends as soon as its stroke is
+// confirmed; pushTime/riserTime/ejectionTime remain the upper bound.
+// DEFAULT_STROKE_SENSORS has a bit per fitted switch (1 push, 2 riser,
+// 4 ejection).
+#define DEFAULT_STROKE_SENSORS 0
+#define STROKE_CONFIRM_US 2000
+
+// Solenoid switching noise: after each valve edge, serial output is held and
+// sensor 1 is not sampled for this long, while loop() keeps running. With
+// staggering on, a second edge waits for the first window to close.
+#define EMI_QUIET_WINDOW_US 10000
+#define DEFAULT_STAGGER_SOLENOIDS true
+#define POWER_SETTLE_TIME 100  // Sensor ignored after boot (ms)
+#define SERIAL_RESTART_DELAY 100  // Between Serial.end() and begin() (ms)
+
+// Pipelined mode: the riser lowers once the camera has its image and the
+// verdict is applied at an ejector PIPELINE_EJECT_OFFSET board pitches
+// downstream, so the next board can be pushed while analysis runs.
+#define PIPELINE_DEPTH 4                // Boards tracked in flight
+#define PIPELINE_EJECT_OFFSET 1         // Pushes from riser to ejector
+#define DEFAULT_CAPTURE_TIME 1600       // Riser hold for the camera
+
+// Pre-trigger: ANALYSIS_ARM goes out this long before the riser settles so
+// the master can wake the camera; 0 sends only ANALYSIS_START at settle.
+#define DEFAULT_TRIGGER_LEAD 0
+
+// Actuation overlap: the riser starts this long before the push retracts,
+// and in pipelined mode the ejector fires this long before the riser
+// settles. Interlocks in RouterController hold an overlap back when the
+// board has not cleared the infeed or the push cylinder is still out.
+#define DEFAULT_RISER_OVERLAP 0
+#define DEFAULT_EJECT_OVERLAP 0
+
+// Continuous feed: a board already waiting on sensor 1 while the riser
+// lowers is pushed as soon as the lowering dwell ends, with its settle
+// delay served during the dwell instead of after it.
+#define DEFAULT_CONTINUOUS_FEED false
+
+// Calibration (CALIBRATE command): dry strokes with the infeed empty, each
+// stroke timing searched down to this resolution; a candidate passes after
+// this many complete strokes in a row. The margin is added to the minimum.
+#define CALIBRATION_CYCLES 10
+#define CALIBRATION_STEP_MS 10
+#define CALIBRATION_MARGIN_PERCENT 20
+
+// Camera strobe, fired by a hardware timer at the moment the riser settles
+#define CAMERA_TRIGGER_PULSE_US 1000
 
 #endif  // CONFIG_H
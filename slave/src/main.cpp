@@ -1,14 +1,45 @@
+#include <Arduino.h>
+
+#include "SerialOutput.h"
 #include "SlaveController.h"
 
 SlaveController controller;
 
+// The router runs alone on one core so serial traffic, JSON and logging on
+// the other core cannot delay a valve edge. The tasks only share the SPSC
+// queues inside the controller. Neither polls: each sleeps until its next
+// deadline or until an interrupt or the other task wakes it.
+static void controlTask(void*) {
+  hal::bindWakeTarget(hal::WakeTarget::CONTROL);
+  for (;;) {
+    uint32_t dueUs = hal::waitForWake(hal::WakeTarget::CONTROL,
+                                      controller.controlWakeUs());
+    controller.recordWakeLatency(hal::micros() - dueUs);
+    controller.controlStep();
+  }
+}
+
+static void commsTask(void*) {
+  hal::bindWakeTarget(hal::WakeTarget::COMMS);
+  for (;;) {
+    hal::waitForWake(hal::WakeTarget::COMMS, controller.commsWakeUs());
+    controller.commsStep();
+  }
+}
+
 void setup() {
-  Serial.begin(115200);
-  Serial.println("Main setup started");
+  serialOut.begin(BAUD_RATE);
+  serialOut.println(SerialOutput::NORMAL, "Main setup started");
   controller.setup();
-  Serial.println("Main setup completed");
+
+  xTaskCreatePinnedToCore(controlTask, "control", CONTROL_TASK_STACK, nullptr,
+                          CONTROL_TASK_PRIORITY, nullptr, CONTROL_TASK_CORE);
+  xTaskCreatePinnedToCore(commsTask, "comms", COMMS_TASK_STACK, nullptr,
+                          COMMS_TASK_PRIORITY, nullptr, COMMS_TASK_CORE);
+  serialOut.println(SerialOutput::NORMAL, "Main setup completed");
 }
 
 void loop() {
-  controller.loop();
-}
\ No newline at end of file
+  // All work happens in the pinned tasks
+  vTaskDelete(nullptr);
+}
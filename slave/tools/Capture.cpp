@@ -0,0 +1,137 @@
+#include "Capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace capture {
+
+namespace {
+
+FILE* openInput(const char* path) {
+  FILE* file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+  if (!file) fprintf(stderr, "cannot open %s\n", path);
+  return file;
+}
+
+}  // namespace
+
+bool readFile(const char* path, std::string& out) {
+  FILE* file = openInput(path);
+  if (!file) return false;
+  char chunk[4096];
+  size_t count;
+  while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    out.append(chunk, count);
+  }
+  if (file != stdin) fclose(file);
+  return true;
+}
+
+size_t readLiteral(const std::string& text, size_t pos, std::string& out) {
+  if (pos >= text.size() || text[pos] != '"') return std::string::npos;
+  for (pos++; pos < text.size() && text[pos] != '"'; pos++) {
+    char c = text[pos];
+    if (c != '\\') {
+      out += c;
+      continue;
+    }
+    if (++pos >= text.size()) return std::string::npos;
+    switch (text[pos]) {
+      case 'n': out += '\n'; break;
+      case 'r': out += '\r'; break;
+      case 't': out += '\t'; break;
+      case '0': out += '\0'; break;
+      default: out += text[pos]; break;  // \\ \" \'
+    }
+  }
+  return pos < text.size() ? pos + 1 : std::string::npos;
+}
+
+std::string escape(const std::string& text) {
+  std::string out = "\"";
+  for (char c : text) {
+    switch (c) {
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      default: out += c; break;
+    }
+  }
+  return out + "\"";
+}
+
+bool loadDictionary(const char* path, std::map<uint32_t, std::string>& out) {
+  std::string text;
+  if (!readFile(path, text)) return false;
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t end = text.find('\n', pos);
+    if (end == std::string::npos) end = text.size();
+    std::string line = text.substr(pos, end - pos);
+    pos = end + 1;
+    if (line.empty()) continue;
+    std::string format;
+    size_t quote = line.find('"');
+    if (quote == std::string::npos ||
+        readLiteral(line, quote, format) == std::string::npos) {
+      fprintf(stderr, "bad dictionary line: %s\n", line.c_str());
+      return false;
+    }
+    out[static_cast<uint32_t>(strtoul(line.c_str(), nullptr, 16))] = format;
+  }
+  return true;
+}
+
+void Reader::feed(const uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    uint8_t byte = data[i];
+    if (byte == protocol::FRAME_DELIMITER) {
+      // Each frame has a delimiter either side
+      if (inFrame && !block.empty()) {
+        protocol::Frame frame;
+        if (protocol::decodeFrame(block.data(), block.size(), frame)) {
+          sink.onFrame(frame);
+        } else {
+          sink.onCorrupt();
+        }
+        block.clear();
+        inFrame = false;
+      } else {
+        inFrame = true;
+      }
+    } else if (inFrame) {
+      block.push_back(byte);
+    } else if (byte == '\n') {
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      sink.onLine(line);
+      line.clear();
+    } else {
+      line += static_cast<char>(byte);
+    }
+  }
+}
+
+void Reader::finish() {
+  if (line.empty()) return;
+  if (line.back() == '\r') line.pop_back();
+  sink.onLine(line);
+  line.clear();
+}
+
+bool readCapture(const char* path, Reader& reader) {
+  FILE* file = openInput(path);
+  if (!file) return false;
+  uint8_t chunk[65536];
+  size_t count;
+  while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    reader.feed(chunk, count);
+  }
+  if (file != stdin) fclose(file);
+  reader.finish();
+  return true;
+}
+
+}  // namespace capture
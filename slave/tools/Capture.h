@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../src/Protocol.h"
+
+// Pieces shared by the host tools that read the slave's serial output
+namespace capture {
+
+bool readFile(const char* path, std::string& out);
+
+// Reads one C string literal at text[pos] (the opening quote) into out;
+// returns the position after the closing quote, or npos if malformed
+size_t readLiteral(const std::string& text, size_t pos, std::string& out);
+// The C literal for text, quotes included
+std::string escape(const std::string& text);
+
+// trace.dict as written by "trace_tool dict": format strings by ID
+bool loadDictionary(const char* path, std::map<uint32_t, std::string>& out);
+
+// Splits a raw capture into text lines and frames, which sit between 0x00
+// delimiters. Bytes may arrive in chunks of any size, so a multi-hour
+// capture is read a block at a time.
+class Reader {
+ public:
+  struct Sink {
+    virtual ~Sink() = default;
+    // Without the line ending
+    virtual void onLine(const std::string& line) = 0;
+    virtual void onFrame(const protocol::Frame& frame) = 0;
+    virtual void onCorrupt() {}
+  };
+
+  explicit Reader(Sink& sink) : sink(sink) {}
+
+  void feed(const uint8_t* data, size_t length);
+  // Hands over a last line that had no line ending
+  void finish();
+
+ private:
+  Sink& sink;
+  std::vector<uint8_t> block;
+  std::string line;
+  bool inFrame = false;
+};
+
+// Feeds a file (stdin for "-") through reader, then finishes it
+bool readCapture(const char* path, Reader& reader);
+
+}  // namespace capture
@@ -0,0 +1,582 @@
+// Chrome trace-event JSON from a slave log, for chrome://tracing or
+// ui.perfetto.dev (which opens it directly).
+//
+//   pio run -e chrome_trace
+//   .pio/build/chrome_trace/program [--dict trace.dict] [log] > trace.json
+//
+// The log may be the master's text output, a raw capture with binary frames
+// (the simulation's --capture), or both mixed; stdin without a file. It is
+// read a block at a time and events are written as they close, so
+// multi-hour logs need no more memory than short ones.
+//
+// Tracks: the router state as back-to-back spans, a span per cylinder
+// stroke, analysis requests joined to their verdicts by flow arrows, and
+// stalls. A DUMP_TRACE in the log becomes two more processes, one per
+// flight recorder run.
+//
+// Time comes from whatever the slave stamped: micros() on TRACE frames and
+// flight recorder events, uptime ms on HEARTBEAT and ANALYSIS_START, or a
+// "[seconds]" prefix as trace_tool decode writes. Lines without one happen
+// at the last time seen, so a text-mode log is only as sharp as its
+// heartbeats; a binary capture with --dict resolves every state change.
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../src/Protocol.h"
+#include "../src/RouterController.h"
+#include "../src/Trace.h"
+#include "../src/config.h"
+#include "Capture.h"
+
+namespace {
+
+constexpr size_t CYLINDERS = 3;
+constexpr const char* CYLINDER_NAMES[CYLINDERS] = {"push", "riser",
+                                                   "ejection"};
+constexpr uint8_t CYLINDER_PINS[CYLINDERS] = {
+    PUSH_CYLINDER_PIN, RISER_CYLINDER_PIN, EJECTION_CYLINDER_PIN};
+
+// Thread ids within each process
+enum Track : int {
+  ROUTER_TRACK = 1,
+  CYLINDER_TRACK,  // One per cylinder from here
+  ANALYSIS_TRACK = CYLINDER_TRACK + CYLINDERS,
+  CONTROL_STALL_TRACK,
+  COMMS_STALL_TRACK,
+  MESSAGE_TRACK,
+};
+
+// Process ids: the live log, then the flight recorder runs
+enum Process : int { LOG_PROCESS = 1, PREVIOUS_RUN, CURRENT_RUN };
+
+constexpr uint64_t REBOOT_GAP_US = 5000000;
+
+std::string jsonEscape(const std::string& text) {
+  std::string out;
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+class TraceWriter {
+ public:
+  explicit TraceWriter(FILE* out) : out(out) {
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  }
+
+  void finish() { fprintf(out, "\n]}\n"); }
+
+  void name(int pid, int tid, const std::string& name) {
+    next();
+    fprintf(out,
+            "{\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"name\":\"%s\","
+            "\"args\":{\"name\":\"%s\"}}",
+            pid, tid, tid ? "thread_name" : "process_name",
+            jsonEscape(name).c_str());
+  }
+
+  void span(int pid, int tid, const std::string& name, uint64_t startUs,
+            uint64_t endUs) {
+    next();
+    fprintf(out,
+            "{\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"name\":\"%s\","
+            "\"ts\":%llu,\"dur\":%llu}",
+            pid, tid, jsonEscape(name).c_str(),
+            static_cast<unsigned long long>(startUs),
+            static_cast<unsigned long long>(endUs - startUs));
+  }
+
+  // A point on a track, as a 1 us slice so flow arrows can bind to it
+  void mark(int pid, int tid, const std::string& name, uint64_t us) {
+    span(pid, tid, name, us, us + 1);
+  }
+
+  // Phase 's' starts an arrow, 'f' ends it. Board ids restart with each
+  // process, so the arrow id carries the process too.
+  void flow(int pid, int tid, char phase, uint32_t boardId, uint64_t us) {
+    next();
+    fprintf(out,
+            "{\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"name\":\"analysis\","
+            "\"cat\":\"analysis\",\"id\":%llu,\"ts\":%llu%s}",
+            phase, pid, tid,
+            static_cast<unsigned long long>(boardId) * 4 + pid,
+            static_cast<unsigned long long>(us),
+            phase == 'f' ? ",\"bp\":\"e\"" : "");
+  }
+
+ private:
+  void next() {
+    fputs(first ? "\n" : ",\n", out);
+    first = false;
+  }
+
+  FILE* out;
+  bool first = true;
+};
+
+// Microseconds since the first boot in the log. The slave's clocks restart
+// at every boot and micros() wraps every 71.6 minutes; output time never
+// goes backwards.
+class Clock {
+ public:
+  void micros(uint32_t us) {
+    uint64_t raw = (last & ~0xFFFFFFFFull) | us;
+    if (raw + (1ull << 31) < last) {
+      raw += 1ull << 32;
+    } else if (raw > last + (1ull << 31) && raw >= (1ull << 32)) {
+      raw -= 1ull << 32;
+    }
+    advance(raw);
+  }
+
+  void uptimeMs(uint32_t ms) { advance(static_cast<uint64_t>(ms) * 1000); }
+
+  void reboot() {
+    offset += last;
+    last = 0;
+  }
+
+  uint64_t now() const { return offset + last; }
+
+ private:
+  void advance(uint64_t raw) {
+    if (raw + REBOOT_GAP_US < last) {
+      reboot();  // Restarted without a boot line in the log
+    }
+    if (raw > last) last = raw;
+  }
+
+  uint64_t last = 0;
+  uint64_t offset = 0;
+};
+
+// One process: its clock and the spans still open
+class Timeline {
+ public:
+  Timeline(TraceWriter& writer, int pid, const char* name)
+      : writer(writer), pid(pid), name(name) {}
+
+  Clock clock;
+
+  void setState(int state) {
+    if (state == this->state) return;
+    start();
+    uint64_t now = clock.now();
+    if (this->state >= 0) {
+      writer.span(pid, ROUTER_TRACK, ROUTER_STATE_NAMES[this->state],
+                  stateStartUs, now);
+    }
+    this->state = state;
+    stateStartUs = now;
+  }
+
+  void setCylinder(size_t cylinder, bool extended) {
+    if (extended == cylinderOn[cylinder]) return;
+    start();
+    uint64_t now = clock.now();
+    if (cylinderOn[cylinder]) {
+      writer.span(pid, CYLINDER_TRACK + cylinder, "extended",
+                  cylinderStartUs[cylinder], now);
+    }
+    cylinderOn[cylinder] = extended;
+    cylinderStartUs[cylinder] = now;
+  }
+
+  void analysisStart(uint32_t boardId) {
+    start();
+    char label[48];
+    snprintf(label, sizeof(label), "ANALYSIS_START %lu",
+             static_cast<unsigned long>(boardId));
+    writer.mark(pid, ANALYSIS_TRACK, label, clock.now());
+    writer.flow(pid, ANALYSIS_TRACK, 's', boardId, clock.now());
+    pending.push_back(boardId);
+    // Requests that never got a verdict
+    if (pending.size() > PIPELINE_DEPTH * 4) pending.erase(pending.begin());
+  }
+
+  // Board id 0 is a master that sends none: the oldest request
+  void analysisResult(uint32_t boardId, const std::string& verdict) {
+    start();
+    auto found = pending.begin();
+    while (found != pending.end() && boardId && *found != boardId) found++;
+    char label[64];
+    snprintf(label, sizeof(label), "ANALYSIS_RESULT %lu %s",
+             static_cast<unsigned long>(found != pending.end() ? *found
+                                                               : boardId),
+             verdict.c_str());
+    writer.mark(pid, ANALYSIS_TRACK, label, clock.now());
+    if (found != pending.end()) {
+      writer.flow(pid, ANALYSIS_TRACK, 'f', *found, clock.now());
+      pending.erase(found);
+    }
+  }
+
+  // A pass that ended now and took us
+  void stall(bool comms, const std::string& activity, uint32_t us) {
+    start();
+    uint64_t now = clock.now();
+    writer.span(pid, comms ? COMMS_STALL_TRACK : CONTROL_STALL_TRACK,
+                activity, now > us ? now - us : 0, now);
+  }
+
+  void message(const std::string& text) {
+    start();
+    writer.mark(pid, MESSAGE_TRACK, text, clock.now());
+  }
+
+  // Closes whatever is still open at the last time seen
+  void finish() {
+    if (!started) return;
+    setState(-1);
+    for (size_t i = 0; i < CYLINDERS; i++) setCylinder(i, false);
+  }
+
+ private:
+  // Names the process and its tracks on first use
+  void start() {
+    if (started) return;
+    started = true;
+    writer.name(pid, 0, name);
+    writer.name(pid, ROUTER_TRACK, "router state");
+    for (size_t i = 0; i < CYLINDERS; i++) {
+      writer.name(pid, CYLINDER_TRACK + i,
+                  std::string(CYLINDER_NAMES[i]) + " cylinder");
+    }
+    writer.name(pid, ANALYSIS_TRACK, "analysis");
+    writer.name(pid, CONTROL_STALL_TRACK, "control stalls");
+    writer.name(pid, COMMS_STALL_TRACK, "comms stalls");
+    writer.name(pid, MESSAGE_TRACK, "warnings and errors");
+  }
+
+  TraceWriter& writer;
+  const int pid;
+  const char* const name;
+  bool started = false;
+  int state = -1;
+  uint64_t stateStartUs = 0;
+  bool cylinderOn[CYLINDERS] = {};
+  uint64_t cylinderStartUs[CYLINDERS] = {};
+  std::vector<uint32_t> pending;  // Board ids awaiting a verdict
+};
+
+int stateIndex(const std::string& name) {
+  for (int i = 0; i < static_cast<int>(ROUTER_STATE_COUNT); i++) {
+    if (name == ROUTER_STATE_NAMES[i]) return i;
+  }
+  return -1;
+}
+
+// The string or number after "key": in a flat JSON object
+bool jsonString(const char* json, const char* key, std::string& out) {
+  std::string pattern = std::string("\"") + key + "\":\"";
+  const char* found = strstr(json, pattern.c_str());
+  if (!found) return false;
+  found += pattern.size();
+  const char* end = strchr(found, '"');
+  if (!end) return false;
+  out.assign(found, end);
+  return true;
+}
+
+bool jsonNumber(const char* json, const char* key, uint32_t& out) {
+  std::string pattern = std::string("\"") + key + "\":";
+  const char* found = strstr(json, pattern.c_str());
+  if (!found) return false;
+  out = static_cast<uint32_t>(strtoul(found + pattern.size(), nullptr, 10));
+  return true;
+}
+
+uint32_t readU32(const uint8_t* p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24;
+}
+
+class Converter : public capture::Reader::Sink {
+ public:
+  Converter(TraceWriter& writer,
+            const std::map<uint32_t, std::string>& dictionary)
+      : dictionary(dictionary),
+        log(writer, LOG_PROCESS, "slave"),
+        previousRun(writer, PREVIOUS_RUN, "flight recorder, previous run"),
+        currentRun(writer, CURRENT_RUN, "flight recorder, current run") {}
+
+  void onLine(const std::string& text) override {
+    const char* line = text.c_str();
+    // "[seconds] " from trace_tool decode
+    if (line[0] == '[') {
+      char* end;
+      double seconds = strtod(line + 1, &end);
+      if (end != line + 1 && end[0] == ']') {
+        log.clock.micros(static_cast<uint32_t>(seconds * 1e6 + 0.5));
+        line = end + 1;
+        while (*line == ' ') line++;
+      }
+    }
+    handleLine(line);
+  }
+
+  void onFrame(const protocol::Frame& frame) override {
+    const uint8_t* p = frame.payload;
+    switch (frame.type) {
+      case protocol::MessageType::STATE:
+        // [status u8][router state u8][flags u8]
+        if (frame.length < 3) return;
+        log.setState(p[1] < ROUTER_STATE_COUNT ? p[1] : -1);
+        log.setCylinder(0, p[2] & protocol::STATE_FLAG_PUSH);
+        log.setCylinder(1, p[2] & protocol::STATE_FLAG_RISER);
+        log.setCylinder(2, p[2] & protocol::STATE_FLAG_EJECTION);
+        break;
+      case protocol::MessageType::HEARTBEAT:
+        if (frame.length >= 4) log.clock.uptimeMs(readU32(p));
+        break;
+      case protocol::MessageType::ANALYSIS_START:
+        // [board id u32][uptime ms u32]
+        if (frame.length < 8) return;
+        log.clock.uptimeMs(readU32(p + 4));
+        log.analysisStart(readU32(p));
+        break;
+      case protocol::MessageType::STALL:
+        // [task u8][activity u8][us u32][activity us u32][at ms u32]
+        if (frame.length < 14) return;
+        log.clock.uptimeMs(readU32(p + 10));
+        log.stall(p[0] != 0, activityName(p[1]), readU32(p + 2));
+        break;
+      case protocol::MessageType::FLIGHT:
+        // [run u8][us u32][kind u8][a u8][b u16][value u32]
+        if (frame.length < 13) return;
+        flightEvent(p[0] == 0 ? previousRun : currentRun, readU32(p + 1),
+                    p[5], p[6], p[7] | p[8] << 8, readU32(p + 9));
+        break;
+      case protocol::MessageType::TRACE: {
+        // [format id u32][micros u32][packed arguments]
+        if (frame.length < 8) return;
+        log.clock.micros(readU32(p + 4));
+        auto found = dictionary.find(readU32(p));
+        if (found == dictionary.end()) return;
+        char text[1024];
+        trace::format(text, sizeof(text), found->second.c_str(), p + 8,
+                      frame.length - 8);
+        text[strcspn(text, "\r\n")] = '\0';
+        handleLine(text);
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  void onCorrupt() override { corrupt++; }
+
+  void finish() {
+    log.finish();
+    previousRun.finish();
+    currentRun.finish();
+    if (corrupt) fprintf(stderr, "%lu corrupt frames skipped\n", corrupt);
+  }
+
+ private:
+  static const char* activityName(uint8_t activity) {
+    static constexpr const char* NAMES[] = {
+        "ROUTER",    "COMMAND",   "UART_READ",   "SERIALIZE",  "UART_WRITE",
+        "EVENTS",    "HEARTBEAT", "HEAP_REPORT", "SERIAL_LINK"};
+    return activity < sizeof(NAMES) / sizeof(*NAMES) ? NAMES[activity]
+                                                      : "UNKNOWN";
+  }
+
+  // Markers are searched anywhere in the line, so prefixes the master adds
+  // when it prints slave output do not matter
+  void handleLine(const char* line) {
+    const char* found;
+    uint32_t number;
+    std::string value;
+    if ((found = strstr(line, "Current state: "))) {
+      log.setState(stateIndex(found + 15));
+    } else if ((found = strstr(line, "STATE {"))) {
+      if (jsonString(found, "router_state", value)) {
+        log.setState(stateIndex(value));
+      }
+      for (size_t i = 0; i < CYLINDERS; i++) {
+        std::string key = std::string(CYLINDER_NAMES[i]) + "_cylinder";
+        if (jsonString(found, key.c_str(), value)) {
+          log.setCylinder(i, value == "ON");
+        }
+      }
+    } else if ((found = strstr(line, "HEARTBEAT {"))) {
+      if (jsonNumber(found, "uptime", number)) log.clock.uptimeMs(number);
+    } else if ((found = strstr(line, "ANALYSIS_START "))) {
+      // ANALYSIS_START <board id> <uptime ms>
+      char* end;
+      uint32_t boardId = strtoul(found + 15, &end, 10);
+      if (end == found + 15) return;
+      uint32_t uptime = strtoul(end, &end, 10);
+      if (uptime) log.clock.uptimeMs(uptime);
+      log.analysisStart(boardId);
+    } else if ((found = strstr(line, "Analysis result received. "))) {
+      // Text command: Raw value: '<TRUE|FALSE> [id]'; binary: Board <id>:
+      // <EJECT|PASS>
+      found += 26;
+      uint32_t boardId = 0;
+      bool eject = false;
+      if (strncmp(found, "Raw value: '", 12) == 0) {
+        eject = strncmp(found + 12, "TRUE", 4) == 0;
+        const char* id = strchr(found + 12, ' ');
+        if (id) boardId = strtoul(id, nullptr, 10);
+      } else if (strncmp(found, "Board ", 6) == 0) {
+        char* end;
+        boardId = strtoul(found + 6, &end, 10);
+        eject = strstr(end, "EJECT") != nullptr;
+      }
+      log.analysisResult(boardId, eject ? "EJECT" : "PASS");
+    } else if ((found = strstr(line, "STALL {"))) {
+      uint32_t us = 0;
+      if (jsonNumber(found, "at_ms", number)) log.clock.uptimeMs(number);
+      jsonNumber(found, "us", us);
+      jsonString(found, "activity", value);
+      std::string task;
+      jsonString(found, "task", task);
+      log.stall(task == "comms", value, us);
+    } else if ((found = strstr(line, "FLIGHT {"))) {
+      flightLine(found);
+    } else if (strstr(line, "Main setup started")) {
+      log.clock.reboot();
+      log.message("boot");
+    } else if (strncmp(line, "WARNING", 7) == 0 ||
+               strncmp(line, "ERROR", 5) == 0) {
+      log.message(line);
+    } else if (strstr(line, "cylinder activated") ||
+               strstr(line, "cylinder deactivated")) {
+      for (size_t i = 0; i < CYLINDERS; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "%s cylinder", CYLINDER_NAMES[i]);
+        name[0] = static_cast<char>(toupper(name[0]));
+        if (strstr(line, name)) {
+          log.setCylinder(i, strstr(line, "deactivated") == nullptr);
+        }
+      }
+    }
+  }
+
+  // FLIGHT {"run":S,"us":N,"event":S,...} as SlaveController sends it
+  void flightLine(const char* json) {
+    std::string run;
+    std::string event;
+    uint32_t us = 0;
+    if (!jsonString(json, "run", run) || !jsonString(json, "event", event) ||
+        !jsonNumber(json, "us", us)) {
+      return;
+    }
+    Timeline& timeline = run == "previous" ? previousRun : currentRun;
+    timeline.clock.micros(us);
+    std::string text;
+    uint32_t a = 0;
+    uint32_t b = 0;
+    if (event == "BOOT") {
+      timeline.message("boot");
+    } else if (event == "STATE") {
+      jsonString(json, "to", text);
+      timeline.setState(stateIndex(text));
+    } else if (event == "VALVE") {
+      jsonNumber(json, "pin", a);
+      jsonNumber(json, "level", b);
+      valve(timeline, a, b);
+    } else if (event == "COMMAND") {
+      jsonString(json, "command", text);
+      jsonNumber(json, "arg", a);
+      jsonNumber(json, "value", b);
+      if (text == "ANALYSIS_RESULT") {
+        timeline.analysisResult(b, a ? "EJECT" : "PASS");
+      } else {
+        timeline.message(text);
+      }
+    } else if (event == "STALL") {
+      std::string task;
+      jsonString(json, "task", task);
+      jsonString(json, "activity", text);
+      jsonNumber(json, "pass_us", a);
+      timeline.stall(task == "comms", text, a);
+    }
+  }
+
+  // The binary form of the same events (FlightRecorder.h)
+  void flightEvent(Timeline& timeline, uint32_t us, uint8_t kind, uint8_t a,
+                   uint16_t b, uint32_t value) {
+    timeline.clock.micros(us);
+    switch (kind) {
+      case 0:  // BOOT
+        timeline.message("boot");
+        break;
+      case 1:  // STATE
+        timeline.setState(a < ROUTER_STATE_COUNT ? a : -1);
+        break;
+      case 2:  // VALVE
+        valve(timeline, a, b);
+        break;
+      case 3:  // COMMAND; 0 is ANALYSIS_RESULT
+        if (a == 0) timeline.analysisResult(value, b ? "EJECT" : "PASS");
+        break;
+      case 4:  // STALL
+        timeline.stall(a != 0, activityName(static_cast<uint8_t>(b)), value);
+        break;
+      default:
+        break;
+    }
+  }
+
+  static void valve(Timeline& timeline, uint32_t pin, uint32_t level) {
+    for (size_t i = 0; i < CYLINDERS; i++) {
+      if (CYLINDER_PINS[i] == pin) timeline.setCylinder(i, level != 0);
+    }
+  }
+
+  const std::map<uint32_t, std::string>& dictionary;
+  Timeline log;
+  Timeline previousRun;
+  Timeline currentRun;
+  unsigned long corrupt = 0;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const char* dictionaryPath = nullptr;
+  const char* logPath = "-";
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--dict") == 0 && i + 1 < argc) {
+      dictionaryPath = argv[++i];
+    } else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0) {
+      logPath = argv[i];
+    } else {
+      fprintf(stderr, "usage: %s [--dict trace.dict] [log] > trace.json\n",
+              argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::map<uint32_t, std::string> dictionary;
+  if (dictionaryPath && !capture::loadDictionary(dictionaryPath, dictionary)) {
+    return EXIT_FAILURE;
+  }
+  TraceWriter writer(stdout);
+  Converter converter(writer, dictionary);
+  capture::Reader reader(converter);
+  bool read = capture::readCapture(logPath, reader);
+  converter.finish();
+  writer.finish();
+  return read ? EXIT_SUCCESS : EXIT_FAILURE;
+}
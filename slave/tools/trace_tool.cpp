@@ -0,0 +1,208 @@
+// Host side of the binary trace log (src/Trace.h).
+//
+//   pio run -e trace_tool
+//   .pio/build/trace_tool/program dict src/*.cpp > trace.dict
+//   .pio/build/trace_tool/program decode trace.dict capture.bin
+//
+// dict finds every TRACE_TO format string in the sources and writes one
+// "<id> <C string>" line per format, failing if two formats share an ID.
+// decode reads a raw capture of the slave's serial output (a file, or stdin
+// without one), prints text lines as they are and TRACE frames rebuilt from
+// the dictionary, prefixed with their micros() timestamp. Other frames are
+// only counted.
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+
+#include "../src/Protocol.h"
+#include "../src/Trace.h"
+#include "Capture.h"
+
+namespace {
+
+size_t skipSpace(const std::string& text, size_t pos) {
+  while (pos < text.size() && isspace(static_cast<unsigned char>(text[pos]))) {
+    pos++;
+  }
+  return pos;
+}
+
+// The format of the TRACE_TO call whose "(" is at pos: the third argument,
+// adjacent literals joined. False for the macro definition itself.
+bool readFormat(const std::string& text, size_t pos, std::string& format) {
+  int depth = 0;
+  int commas = 0;
+  for (; pos < text.size(); pos++) {
+    char c = text[pos];
+    if (c == '"') {
+      std::string ignored;
+      pos = capture::readLiteral(text, pos, ignored);
+      if (pos == std::string::npos) return false;
+      pos--;
+    } else if (c == '(') {
+      depth++;
+    } else if (c == ')') {
+      if (--depth == 0) return false;
+    } else if (c == ',' && depth == 1 && ++commas == 2) {
+      break;
+    }
+  }
+  pos = skipSpace(text, pos + 1);
+  if (pos >= text.size() || text[pos] != '"') return false;
+  while (pos < text.size() && text[pos] == '"') {
+    pos = capture::readLiteral(text, pos, format);
+    if (pos == std::string::npos) return false;
+    pos = skipSpace(text, pos);
+  }
+  return true;
+}
+
+// Finds TRACE_TO( outside comments and string literals
+void scanSource(const std::string& text,
+                std::map<uint32_t, std::string>& formats, bool& collision) {
+  static const char MACRO[] = "TRACE_TO(";
+  for (size_t pos = 0; pos < text.size(); pos++) {
+    if (text.compare(pos, 2, "//") == 0) {
+      pos = text.find('\n', pos);
+      if (pos == std::string::npos) return;
+    } else if (text.compare(pos, 2, "/*") == 0) {
+      pos = text.find("*/", pos);
+      if (pos == std::string::npos) return;
+      pos++;
+    } else if (text[pos] == '"') {
+      std::string ignored;
+      pos = capture::readLiteral(text, pos, ignored);
+      if (pos == std::string::npos) return;
+      pos--;
+    } else if (text[pos] == '\'') {
+      // Character literal, which may be a quote
+      pos += text.compare(pos, 2, "'\\") == 0 ? 3 : 2;
+    } else if (text.compare(pos, sizeof(MACRO) - 1, MACRO) == 0 &&
+               (pos == 0 || !(isalnum(static_cast<unsigned char>(
+                                  text[pos - 1])) ||
+                              text[pos - 1] == '_'))) {
+      std::string format;
+      if (!readFormat(text, pos + sizeof(MACRO) - 2, format)) continue;
+      uint32_t id = trace::formatId(format.c_str());
+      auto found = formats.find(id);
+      if (found != formats.end() && found->second != format) {
+        fprintf(stderr, "ID %08lx shared by %s and %s\n",
+                static_cast<unsigned long>(id),
+                capture::escape(found->second).c_str(),
+                capture::escape(format).c_str());
+        collision = true;
+      }
+      formats[id] = format;
+    }
+  }
+}
+
+int buildDictionary(int count, char** paths) {
+  std::map<uint32_t, std::string> formats;
+  bool collision = false;
+  for (int i = 0; i < count; i++) {
+    std::string text;
+    if (!capture::readFile(paths[i], text)) return EXIT_FAILURE;
+    scanSource(text, formats, collision);
+  }
+  for (const auto& entry : formats) {
+    printf("%08lx %s\n", static_cast<unsigned long>(entry.first),
+           capture::escape(entry.second).c_str());
+  }
+  return collision ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+struct DecodeStats {
+  unsigned long traces = 0;
+  unsigned long unknown = 0;
+  unsigned long otherFrames = 0;
+  unsigned long corrupt = 0;
+};
+
+// Text lines pass through; TRACE frames are rebuilt from the dictionary and
+// prefixed with their micros() timestamp
+class Decoder : public capture::Reader::Sink {
+ public:
+  explicit Decoder(const std::map<uint32_t, std::string>& dictionary)
+      : dictionary(dictionary) {}
+
+  void onLine(const std::string& line) override {
+    printf("%s\n", line.c_str());
+  }
+
+  void onFrame(const protocol::Frame& frame) override {
+    if (frame.type != protocol::MessageType::TRACE) {
+      stats.otherFrames++;
+      return;
+    }
+    if (frame.length < 8) {
+      stats.corrupt++;
+      return;
+    }
+    const uint8_t* p = frame.payload;
+    uint32_t id = p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24;
+    uint32_t us = p[4] | p[5] << 8 | p[6] << 16 | uint32_t(p[7]) << 24;
+    auto found = dictionary.find(id);
+    char text[1024];
+    if (found == dictionary.end()) {
+      stats.unknown++;
+      snprintf(text, sizeof(text), "<unknown trace %08lx>\n",
+               static_cast<unsigned long>(id));
+    } else {
+      stats.traces++;
+      trace::format(text, sizeof(text), found->second.c_str(), p + 8,
+                    frame.length - 8);
+    }
+    // Text lines from the firmware end in \r\n; the terminal only needs \n
+    size_t length = strlen(text);
+    while (length > 0 &&
+           (text[length - 1] == '\n' || text[length - 1] == '\r')) {
+      text[--length] = '\0';
+    }
+    printf("[%10.6f] %s\n", us / 1e6, text);
+  }
+
+  void onCorrupt() override { stats.corrupt++; }
+
+  DecodeStats stats;
+
+ private:
+  const std::map<uint32_t, std::string>& dictionary;
+};
+
+int decode(const char* dictionaryPath, const char* capturePath) {
+  std::map<uint32_t, std::string> dictionary;
+  if (!capture::loadDictionary(dictionaryPath, dictionary)) {
+    return EXIT_FAILURE;
+  }
+  Decoder decoder(dictionary);
+  capture::Reader reader(decoder);
+  if (!capture::readCapture(capturePath, reader)) return EXIT_FAILURE;
+  const DecodeStats& stats = decoder.stats;
+  fprintf(stderr,
+          "%lu traces decoded, %lu unknown IDs, %lu other frames, "
+          "%lu corrupt\n",
+          stats.traces, stats.unknown, stats.otherFrames, stats.corrupt);
+  return EXIT_SUCCESS;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc >= 3 && strcmp(argv[1], "dict") == 0) {
+    return buildDictionary(argc - 2, argv + 2);
+  }
+  if ((argc == 3 || argc == 4) && strcmp(argv[1], "decode") == 0) {
+    return decode(argv[2], argc == 4 ? argv[3] : "-");
+  }
+  fprintf(stderr,
+          "usage: %s dict <source>... > trace.dict\n"
+          "       %s decode <trace.dict> [capture]\n",
+          argv[0], argv[0]);
+  return EXIT_FAILURE;
+}